@@ -0,0 +1,179 @@
+#include "build_arena.h"
+
+#include <algorithm>
+#include <new>
+
+static const size_t kAlignment = 64;
+static const size_t kChunkSize = 4 << 20;
+
+// Every block starts with its chunk and size, padded so the block keeps its alignment.
+struct BlockHeader
+{
+    void* chunk;
+    size_t size;
+};
+static const size_t kHeaderSize = kAlignment;
+static_assert(sizeof(BlockHeader) <= kHeaderSize, "block header must fit its padding");
+
+// Returns the thread's arena to the pool when the thread exits, e.g. when the worker pool
+// is restarted, so its chunks aren't stranded.
+struct ThreadArenaLease
+{
+    BuildArena::ThreadArena* arena = nullptr;
+
+    ~ThreadArenaLease()
+    {
+        if (arena != nullptr)
+            BuildArena::Get().ReleaseThreadArena(arena);
+    }
+};
+
+static thread_local ThreadArenaLease tArena;
+
+static inline size_t AlignUp(size_t size, size_t alignment)
+{
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+BuildArena& BuildArena::Get()
+{
+    // Never destroyed, BVHs freed during static destruction still return their blocks.
+    static BuildArena* instance = new BuildArena();
+    return *instance;
+}
+
+void* BuildArena::Allocate(size_t size, void* userdata)
+{
+    (void)userdata;
+    BuildArena& buildArena = Get();
+    if (tArena.arena == nullptr)
+        tArena.arena = buildArena.AcquireThreadArena();
+
+    ThreadArena* arena = tArena.arena;
+    std::lock_guard<std::mutex> lock(arena->mutex);
+    return buildArena.AllocateFrom(arena, size);
+}
+
+void BuildArena::Free(void* ptr, void* userdata)
+{
+    (void)userdata;
+    if (ptr == nullptr)
+        return;
+
+    BlockHeader* header = reinterpret_cast<BlockHeader*>(static_cast<char*>(ptr) - kHeaderSize);
+    Get()._used.fetch_sub(static_cast<int64_t>(header->size), std::memory_order_relaxed);
+    // Once this reaches 0 the owning thread may reuse the chunk, so it comes last.
+    static_cast<Chunk*>(header->chunk)->liveBlocks.fetch_sub(1, std::memory_order_release);
+}
+
+void BuildArena::GetUsage(int64_t* used, int64_t* peak, int64_t* reserved)
+{
+    if (used != nullptr)
+        *used = _used.load(std::memory_order_relaxed);
+    if (peak != nullptr)
+        *peak = _peak.load(std::memory_order_relaxed);
+    if (reserved != nullptr)
+        *reserved = _reserved.load(std::memory_order_relaxed);
+}
+
+int64_t BuildArena::Trim()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    int64_t released = 0;
+    for (ThreadArena* arena : _arenas)
+    {
+        std::lock_guard<std::mutex> arenaLock(arena->mutex);
+        auto unused = std::stable_partition(arena->chunks.begin(), arena->chunks.end(), [](Chunk* chunk)
+        {
+            return chunk->liveBlocks.load(std::memory_order_acquire) != 0;
+        });
+        for (auto it = unused; it != arena->chunks.end(); ++it)
+        {
+            Chunk* chunk = *it;
+            if (chunk == arena->current)
+                arena->current = nullptr;
+            released += static_cast<int64_t>(chunk->size);
+            ::operator delete(chunk->memory, std::align_val_t(kAlignment));
+            delete chunk;
+        }
+        arena->chunks.erase(unused, arena->chunks.end());
+    }
+    _reserved.fetch_sub(released, std::memory_order_relaxed);
+    return released;
+}
+
+BuildArena::ThreadArena* BuildArena::AcquireThreadArena()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_freeArenas.empty())
+    {
+        ThreadArena* arena = _freeArenas.back();
+        _freeArenas.pop_back();
+        return arena;
+    }
+    ThreadArena* arena = new ThreadArena();
+    _arenas.push_back(arena);
+    return arena;
+}
+
+void BuildArena::ReleaseThreadArena(ThreadArena* arena)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _freeArenas.push_back(arena);
+}
+
+void* BuildArena::AllocateFrom(ThreadArena* arena, size_t size)
+{
+    size_t blockSize = kHeaderSize + AlignUp(size, kAlignment);
+
+    // Large blocks get a chunk of their own so they don't waste the rest of the current one.
+    bool dedicated = blockSize > kChunkSize / 2;
+    Chunk* chunk = dedicated ? nullptr : arena->current;
+    if (chunk != nullptr && chunk->liveBlocks.load(std::memory_order_acquire) == 0)
+        chunk->offset = 0;
+    if (chunk == nullptr || chunk->offset + blockSize > chunk->size)
+    {
+        chunk = FindChunk(arena, blockSize);
+        if (chunk == nullptr)
+        {
+            chunk = new Chunk();
+            chunk->size = std::max(blockSize, kChunkSize);
+            chunk->memory = static_cast<char*>(::operator new(chunk->size, std::align_val_t(kAlignment)));
+            arena->chunks.push_back(chunk);
+            _reserved.fetch_add(static_cast<int64_t>(chunk->size), std::memory_order_relaxed);
+        }
+        if (!dedicated)
+            arena->current = chunk;
+    }
+
+    char* block = chunk->memory + chunk->offset;
+    chunk->offset += blockSize;
+    chunk->liveBlocks.fetch_add(1, std::memory_order_relaxed);
+
+    BlockHeader* header = reinterpret_cast<BlockHeader*>(block);
+    header->chunk = chunk;
+    header->size = size;
+
+    int64_t used = _used.fetch_add(static_cast<int64_t>(size), std::memory_order_relaxed) + static_cast<int64_t>(size);
+    int64_t peak = _peak.load(std::memory_order_relaxed);
+    while (used > peak && !_peak.compare_exchange_weak(peak, used, std::memory_order_relaxed))
+    {
+    }
+    return block + kHeaderSize;
+}
+
+// Smallest chunk nothing is allocated from that fits the block, reset for reuse.
+BuildArena::Chunk* BuildArena::FindChunk(ThreadArena* arena, size_t size)
+{
+    Chunk* best = nullptr;
+    for (Chunk* chunk : arena->chunks)
+    {
+        if (chunk->size < size || chunk->liveBlocks.load(std::memory_order_acquire) != 0)
+            continue;
+        if (best == nullptr || chunk->size < best->size)
+            best = chunk;
+    }
+    if (best != nullptr)
+        best->offset = 0;
+    return best;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Memory for BLAS builds, handed to tinybvh through BVHContext so builds stop going to the
+// system allocator for every buffer. Each thread bump-allocates from its own chunks, so a
+// build's buffers sit together. A chunk is reused once everything allocated from it has
+// been freed, and chunks are kept between builds until Trim releases the unused ones.
+// Buffers a BVH keeps after its build stay valid until the BVH frees them, as usual.
+class BuildArena
+{
+public:
+    static BuildArena& Get();
+
+    // BVHContext hooks. Blocks are 64 byte aligned and can be freed from any thread.
+    static void* Allocate(size_t size, void* userdata);
+    static void Free(void* ptr, void* userdata);
+
+    // Bytes in blocks that are still allocated, the most there have been at once, and the
+    // bytes held in chunks.
+    void GetUsage(int64_t* used, int64_t* peak, int64_t* reserved);
+
+    // Releases every chunk nothing is allocated from, returns the number of bytes released.
+    int64_t Trim();
+
+private:
+    struct Chunk
+    {
+        char* memory = nullptr;
+        size_t size = 0;
+        // Only touched under the owning thread arena's lock.
+        size_t offset = 0;
+        // Blocks allocated from the chunk that haven't been freed yet.
+        std::atomic<int> liveBlocks { 0 };
+    };
+
+    struct ThreadArena
+    {
+        std::mutex mutex;
+        std::vector<Chunk*> chunks;
+        Chunk* current = nullptr;
+    };
+
+    BuildArena() = default;
+    ThreadArena* AcquireThreadArena();
+    void ReleaseThreadArena(ThreadArena* arena);
+    void* AllocateFrom(ThreadArena* arena, size_t size);
+    Chunk* FindChunk(ThreadArena* arena, size_t size);
+
+    friend struct ThreadArenaLease;
+
+    // Thread arenas are never freed, threads that exit hand theirs to the next thread.
+    std::mutex _mutex;
+    std::vector<ThreadArena*> _arenas;
+    std::vector<ThreadArena*> _freeArenas;
+
+    std::atomic<int64_t> _used { 0 };
+    std::atomic<int64_t> _peak { 0 };
+    std::atomic<int64_t> _reserved { 0 };
+};
@@ -0,0 +1,45 @@
+#include "bvh_build_avx.h"
+
+#ifdef PLUGIN_HAS_AVX_BUILDER
+
+#if !defined(__AVX2__) || !defined(__FMA__) && !defined(_MSC_VER)
+#error "bvh_build_avx.cpp must be compiled with AVX2 and FMA enabled"
+#endif
+
+// Second copy of tinybvh compiled with AVX2, renamed so its types don't clash with the
+// scalar copy in plugin.cpp. Build settings match plugin.h.
+#define tinybvh tinybvh_avx2
+#define TINYBVH_IMPLEMENTATION
+#define TINYBVH_FORK_JOIN PluginForkJoin
+#define MT_BUILD_MAX_DEPTH 8
+#include "tiny_bvh.h"
+
+void BuildBinaryBVHAVX2(const float* vertices, uint32_t vertexCount, const uint32_t* indices, uint32_t triangleCount,
+                        void* (*allocFn)(size_t, void*), void (*freeFn)(void*, void*), void* userdata,
+                        BinaryBVH& out)
+{
+    tinybvh::BVH bvh;
+    bvh.context.malloc = allocFn;
+    bvh.context.free = freeFn;
+    bvh.context.userdata = userdata;
+    tinybvh::bvhvec4slice slice(reinterpret_cast<const tinybvh::bvhvec4*>(vertices), vertexCount, sizeof(tinybvh::bvhvec4));
+    if (indices != nullptr)
+        bvh.BuildAVX(slice, indices, triangleCount);
+    else
+        bvh.BuildAVX(slice);
+
+    out.nodes = bvh.bvhNode;
+    out.primIdx = bvh.primIdx;
+    out.allocatedNodes = bvh.allocatedNodes;
+    out.usedNodes = bvh.usedNodes;
+    out.idxCount = bvh.idxCount;
+    out.aabbMin[0] = bvh.aabbMin.x, out.aabbMin[1] = bvh.aabbMin.y, out.aabbMin[2] = bvh.aabbMin.z;
+    out.aabbMax[0] = bvh.aabbMax.x, out.aabbMax[1] = bvh.aabbMax.y, out.aabbMax[2] = bvh.aabbMax.z;
+    out.mayHaveHoles = bvh.may_have_holes;
+
+    // Ownership of the node and index buffers moves to the caller.
+    bvh.bvhNode = nullptr;
+    bvh.primIdx = nullptr;
+}
+
+#endif
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Instruction sets the plugin checks for at load time.
+enum SimdLevel
+{
+    SIMD_SCALAR = 0,
+    SIMD_SSE42 = 1,
+    SIMD_AVX = 2,
+    SIMD_AVX2 = 3
+};
+
+// The AVX2 builder is only compiled into native x86-64 builds, see Plugin/CMakeLists.txt.
+#if defined(PLUGIN_AVX_BUILDER) && (defined(__x86_64__) || defined(_M_X64))
+#define PLUGIN_HAS_AVX_BUILDER
+#endif
+
+// Binary BVH in tinybvh's 32-byte BVHNode layout. The buffers are allocated with the
+// functions passed to BuildBinaryBVHAVX2 and belong to the caller.
+struct BinaryBVH
+{
+    void* nodes = nullptr;
+    uint32_t* primIdx = nullptr;
+    uint32_t allocatedNodes = 0;
+    uint32_t usedNodes = 0;
+    uint32_t idxCount = 0;
+    float aabbMin[3] = {};
+    float aabbMax[3] = {};
+    bool mayHaveHoles = false;
+};
+
+#ifdef PLUGIN_HAS_AVX_BUILDER
+// Runs tinybvh's BuildAVX over float4 vertices, a triangle soup when indices is null.
+// Must only be called on CPUs with AVX2 and FMA.
+void BuildBinaryBVHAVX2(const float* vertices, uint32_t vertexCount, const uint32_t* indices, uint32_t triangleCount,
+                        void* (*allocFn)(size_t, void*), void (*freeFn)(void*, void*), void* userdata,
+                        BinaryBVH& out);
+#endif
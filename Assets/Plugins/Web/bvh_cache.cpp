@@ -0,0 +1,350 @@
+#include "bvh_cache.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "plugin.h"
+
+namespace fs = std::filesystem;
+
+static const uint32_t kCacheMagic = 0x48564243; // "CBVH"
+static const char* kCacheExtension = ".cwbvh";
+
+// Data starts 64 bytes into the file so the mapped nodes keep their alignment.
+struct CacheFileHeader
+{
+    uint32_t magic;
+    uint32_t cacheVersion;
+    uint32_t tinybvhVersion;
+    uint32_t layout;
+    uint64_t key;
+    int32_t triCount;
+    int32_t nodesSize;
+    int32_t trisSize;
+    float aabbMin[3];
+    float aabbMax[3];
+    uint32_t padding;
+};
+static_assert(sizeof(CacheFileHeader) == 64, "cache data must stay 64 byte aligned");
+
+static uint32_t TinyBVHVersion()
+{
+    return TINY_BVH_VERSION_SUB + (TINY_BVH_VERSION_MINOR << 8) + (TINY_BVH_VERSION_MAJOR << 16);
+}
+
+static inline uint64_t Rotate(uint64_t x, int bits)
+{
+    return (x << bits) | (x >> (64 - bits));
+}
+
+BVHCache& BVHCache::Get()
+{
+    static BVHCache instance;
+    return instance;
+}
+
+void BVHCache::SetDirectory(const char* path, int64_t maxBytes)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _directory = path != nullptr ? path : "";
+    _maxBytes = maxBytes;
+    _totalBytes = 0;
+
+    if (_directory.empty())
+        return;
+
+    std::error_code error;
+    fs::create_directories(_directory, error);
+    if (!fs::is_directory(_directory, error))
+    {
+        _directory.clear();
+        return;
+    }
+    Evict();
+}
+
+bool BVHCache::IsEnabled()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return !_directory.empty();
+}
+
+uint64_t BVHCache::Hash(const void* data, size_t size)
+{
+    // xxHash64-style: four independent lanes over 8-byte words so hashing runs close to
+    // memory bandwidth, folded together and avalanched at the end.
+    const uint64_t prime1 = 0x9E3779B185EBCA87ull;
+    const uint64_t prime2 = 0xC2B2AE3D27D4EB4Full;
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+
+    uint64_t lanes[4] = { prime1 + prime2, prime2, 0, 0 - prime1 };
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32)
+    {
+        for (int lane = 0; lane < 4; ++lane)
+        {
+            uint64_t word;
+            memcpy(&word, bytes + i + lane * 8, 8);
+            lanes[lane] = Rotate(lanes[lane] + word * prime2, 31) * prime1;
+        }
+    }
+
+    uint64_t hash = Rotate(lanes[0], 1) + Rotate(lanes[1], 7) + Rotate(lanes[2], 12) + Rotate(lanes[3], 18);
+    hash += size;
+    for (; i < size; ++i)
+        hash = Rotate(hash ^ (bytes[i] * prime1), 11) * prime2;
+
+    hash ^= hash >> 33;
+    hash *= prime2;
+    hash ^= hash >> 29;
+    hash *= prime1;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+std::string BVHCache::GetPath(uint64_t key)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(key));
+    return (fs::path(_directory) / (std::string(name) + kCacheExtension)).string();
+}
+
+static bool MapFile(const std::string& path, BVHCacheEntry* entry)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart < static_cast<LONGLONG>(sizeof(CacheFileHeader)))
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    // Copy-on-write, so the BVH can be modified in place like any other.
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (mapping == nullptr)
+        return false;
+
+    void* data = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+    if (data == nullptr)
+    {
+        CloseHandle(mapping);
+        return false;
+    }
+
+    entry->mapping = data;
+    entry->mappingSize = static_cast<size_t>(size.QuadPart);
+    entry->mappingHandle = mapping;
+    return true;
+#else
+    int file = open(path.c_str(), O_RDONLY);
+    if (file < 0)
+        return false;
+
+    struct stat info;
+    if (fstat(file, &info) != 0 || info.st_size < static_cast<off_t>(sizeof(CacheFileHeader)))
+    {
+        close(file);
+        return false;
+    }
+
+    // Copy-on-write, so the BVH can be modified in place like any other.
+    void* data = mmap(nullptr, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+    close(file);
+    if (data == MAP_FAILED)
+        return false;
+
+    entry->mapping = data;
+    entry->mappingSize = static_cast<size_t>(info.st_size);
+    return true;
+#endif
+}
+
+BVHCacheEntry* BVHCache::Load(uint64_t key, int triCount)
+{
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_directory.empty())
+            return nullptr;
+        path = GetPath(key);
+    }
+
+    BVHCacheEntry* entry = new BVHCacheEntry();
+    if (!MapFile(path, entry))
+    {
+        delete entry;
+        return nullptr;
+    }
+
+    const CacheFileHeader* header = static_cast<const CacheFileHeader*>(entry->mapping);
+    bool valid = header->magic == kCacheMagic &&
+        header->cacheVersion == TINY_BVH_CACHE_VERSION &&
+        header->tinybvhVersion == TinyBVHVersion() &&
+        header->layout == tinybvh::BVHBase::LAYOUT_CWBVH &&
+        header->key == key &&
+        header->triCount == triCount &&
+        header->nodesSize >= 0 && header->trisSize >= 0 &&
+        entry->mappingSize == sizeof(CacheFileHeader) + header->nodesSize + header->trisSize;
+    if (!valid)
+    {
+        Release(entry);
+        return nullptr;
+    }
+
+    char* data = static_cast<char*>(entry->mapping) + sizeof(CacheFileHeader);
+    entry->nodes = data;
+    entry->tris = data + header->nodesSize;
+    entry->nodesSize = header->nodesSize;
+    entry->trisSize = header->trisSize;
+    entry->triCount = header->triCount;
+    memcpy(entry->aabbMin, header->aabbMin, sizeof(entry->aabbMin));
+    memcpy(entry->aabbMax, header->aabbMax, sizeof(entry->aabbMax));
+
+    // Eviction is least recently used first, so mark the file as used.
+    std::error_code error;
+    fs::last_write_time(path, fs::file_time_type::clock::now(), error);
+    return entry;
+}
+
+void BVHCache::Release(BVHCacheEntry* entry)
+{
+    if (entry == nullptr)
+        return;
+
+#ifdef _WIN32
+    if (entry->mapping != nullptr)
+        UnmapViewOfFile(entry->mapping);
+    if (entry->mappingHandle != nullptr)
+        CloseHandle(entry->mappingHandle);
+#else
+    if (entry->mapping != nullptr)
+        munmap(entry->mapping, entry->mappingSize);
+#endif
+    delete entry;
+}
+
+void BVHCache::Store(uint64_t key, const BVHCacheEntry& entry)
+{
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_directory.empty())
+            return;
+        path = GetPath(key);
+    }
+
+    CacheFileHeader header = {};
+    header.magic = kCacheMagic;
+    header.cacheVersion = TINY_BVH_CACHE_VERSION;
+    header.tinybvhVersion = TinyBVHVersion();
+    header.layout = tinybvh::BVHBase::LAYOUT_CWBVH;
+    header.key = key;
+    header.triCount = entry.triCount;
+    header.nodesSize = entry.nodesSize;
+    header.trisSize = entry.trisSize;
+    memcpy(header.aabbMin, entry.aabbMin, sizeof(header.aabbMin));
+    memcpy(header.aabbMax, entry.aabbMax, sizeof(header.aabbMax));
+
+    // Several workers may store the same key at once, each writes its own temporary file.
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%zx.tmp", std::hash<std::thread::id>()(std::this_thread::get_id()));
+    std::string tempPath = path + suffix;
+
+    FILE* file = fopen(tempPath.c_str(), "wb");
+    if (file == nullptr)
+        return;
+
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+        fwrite(entry.nodes, 1, entry.nodesSize, file) == static_cast<size_t>(entry.nodesSize) &&
+        fwrite(entry.tris, 1, entry.trisSize, file) == static_cast<size_t>(entry.trisSize);
+    written = fclose(file) == 0 && written;
+
+    // A file stored for the same key before is replaced, its size no longer counts.
+    std::error_code error;
+    int64_t replacedSize = static_cast<int64_t>(fs::file_size(path, error));
+    if (error)
+        replacedSize = 0;
+    error.clear();
+
+    if (written)
+        fs::rename(tempPath, path, error);
+    if (!written || error)
+    {
+        fs::remove(tempPath, error);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _totalBytes += static_cast<int64_t>(sizeof(header)) + entry.nodesSize + entry.trisSize - replacedSize;
+    if (_totalBytes > _maxBytes)
+        Evict();
+}
+
+// Removes the least recently used files until the cache fits its limit, and recounts the size
+// of the cache. Files that are still mapped can't be removed on Windows, they are skipped
+// until the next eviction.
+void BVHCache::Evict()
+{
+    struct CacheFile
+    {
+        fs::path path;
+        fs::file_time_type lastUsed;
+        int64_t size;
+    };
+
+    std::vector<CacheFile> files;
+    int64_t totalSize = 0;
+
+    std::error_code error;
+    for (fs::directory_iterator it(_directory, error), end; !error && it != end; it.increment(error))
+    {
+        if (it->path().extension() != kCacheExtension)
+            continue;
+
+        CacheFile file;
+        file.path = it->path();
+        file.lastUsed = fs::last_write_time(file.path, error);
+        file.size = static_cast<int64_t>(fs::file_size(file.path, error));
+        if (error)
+        {
+            error.clear();
+            continue;
+        }
+        files.push_back(file);
+        totalSize += file.size;
+    }
+
+    _totalBytes = totalSize;
+    if (totalSize <= _maxBytes)
+        return;
+
+    std::sort(files.begin(), files.end(), [](const CacheFile& a, const CacheFile& b) { return a.lastUsed < b.lastUsed; });
+    for (const CacheFile& file : files)
+    {
+        if (totalSize <= _maxBytes)
+            break;
+        if (fs::remove(file.path, error))
+            totalSize -= file.size;
+    }
+    _totalBytes = totalSize;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+// An encoded CWBVH mapped from a cache file. nodes and tris point into the mapping and
+// stay valid until the entry is released.
+struct BVHCacheEntry
+{
+    void* nodes = nullptr;
+    void* tris = nullptr;
+    int nodesSize = 0;
+    int trisSize = 0;
+    int triCount = 0;
+    float aabbMin[3] = {};
+    float aabbMax[3] = {};
+
+    // Set by the user of the entry, see FreeCachedBVHData in plugin.cpp.
+    int openViews = 0;
+
+    void* mapping = nullptr;
+    size_t mappingSize = 0;
+#ifdef _WIN32
+    void* mappingHandle = nullptr;
+#endif
+};
+
+// Content-addressed on-disk cache of encoded CWBVHs, keyed by a hash of the vertex soup
+// they were built from. Hits are memory-mapped instead of read, and the least recently
+// used files are evicted once the cache grows past its size limit. Disabled until a
+// directory is set.
+class BVHCache
+{
+public:
+    static BVHCache& Get();
+
+    // Points the cache at a directory, creating it if needed. An empty path disables the
+    // cache. maxBytes bounds the total size of the cache files.
+    void SetDirectory(const char* path, int64_t maxBytes);
+
+    bool IsEnabled();
+
+    static uint64_t Hash(const void* data, size_t size);
+
+    // Maps the entry built from the hashed vertices, or returns null on a miss or if the
+    // file was written by a different tinybvh version.
+    BVHCacheEntry* Load(uint64_t key, int triCount);
+
+    static void Release(BVHCacheEntry* entry);
+
+    // Writes an entry back and evicts old ones once the cache grows past its limit. The file
+    // is written under a temporary name first, so concurrent loads never see a partial file.
+    void Store(uint64_t key, const BVHCacheEntry& entry);
+
+private:
+    std::string GetPath(uint64_t key);
+    void Evict();
+
+    std::mutex _mutex;
+    std::string _directory;
+    int64_t _maxBytes = 0;
+    // Size of the cache files, counted by SetDirectory and every eviction and kept up to date
+    // by stores in between, so only a store that takes the cache past its limit scans it.
+    int64_t _totalBytes = 0;
+};
@@ -0,0 +1,379 @@
+#include "cwbvh_traversal.h"
+
+#include <cmath>
+#include <cstring>
+
+#ifdef CWBVH_TRAVERSAL_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+using tinybvh::bvhvec3;
+using tinybvh::bvhvec4;
+
+// Far more than the shaders' BVH_STACK_SIZE, so trees deep enough to overflow the GPU stack
+// still trace correctly here.
+static const int kStackSize = 256;
+
+static inline uint32_t AsUint(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static inline float AsFloat(uint32_t bits)
+{
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static inline uint32_t FirstBitHigh(uint32_t value)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse(&index, value);
+    return index;
+#else
+    return 31 - __builtin_clz(value);
+#endif
+}
+
+// Not popcnt, which older x86 CPUs don't have.
+static inline uint32_t CountBits(uint32_t value)
+{
+    value = value - ((value >> 1) & 0x55555555);
+    value = (value & 0x33333333) + ((value >> 2) & 0x33333333);
+    return (((value + (value >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+}
+
+static inline uint32_t ExtractByte(uint32_t value, uint32_t byteIndex)
+{
+    return (value >> (byteIndex * 8)) & 0xFF;
+}
+
+// HLSL's max and min return the other operand when one is NaN, as fmaxf and fminf do. NaNs
+// come up for rays parallel to an axis, where 0 * inf meets a slab.
+static inline float Max(float a, float b)
+{
+    return fmaxf(a, b);
+}
+
+static inline float Min(float a, float b)
+{
+    return fminf(a, b);
+}
+
+static bvhvec3 GetNodeInvDir(float n0w, const bvhvec3& invDir)
+{
+    uint32_t packed = AsUint(n0w);
+
+    // Extract each byte and sign extend
+    uint32_t e_x = (ExtractByte(packed, 0) ^ 0x80) - 0x80;
+    uint32_t e_y = (ExtractByte(packed, 1) ^ 0x80) - 0x80;
+    uint32_t e_z = (ExtractByte(packed, 2) ^ 0x80) - 0x80;
+
+    return bvhvec3(
+        AsFloat((e_x + 127) << 23) * invDir.x,
+        AsFloat((e_y + 127) << 23) * invDir.y,
+        AsFloat((e_z + 127) << 23) * invDir.z
+    );
+}
+
+// The quantized child bounds IntersectCWBVHNode reads for half i of the children, for the
+// ray's direction: lo and hi in x, y and z, four bytes each.
+static void NodeChildBounds(const bvhvec4* node, const bvhvec3& invDir, int i, uint32_t bounds[6])
+{
+    bounds[0] = AsUint(invDir.x < 0.0f ? (i == 0 ? node[3].z : node[3].w) : (i == 0 ? node[2].x : node[2].y));
+    bounds[1] = AsUint(invDir.y < 0.0f ? (i == 0 ? node[4].x : node[4].y) : (i == 0 ? node[2].z : node[2].w));
+    bounds[2] = AsUint(invDir.z < 0.0f ? (i == 0 ? node[4].z : node[4].w) : (i == 0 ? node[3].x : node[3].y));
+    bounds[3] = AsUint(invDir.x < 0.0f ? (i == 0 ? node[2].x : node[2].y) : (i == 0 ? node[3].z : node[3].w));
+    bounds[4] = AsUint(invDir.y < 0.0f ? (i == 0 ? node[2].z : node[2].w) : (i == 0 ? node[4].x : node[4].y));
+    bounds[5] = AsUint(invDir.z < 0.0f ? (i == 0 ? node[3].x : node[3].y) : (i == 0 ? node[4].z : node[4].w));
+}
+
+// Adds the children of half i of a node the ray hits to the hitmask. hits has a bit per child.
+static uint32_t ChildHitBits(uint32_t meta, uint32_t octinv4, uint32_t hits)
+{
+    uint32_t isInner = (meta & (meta << 1)) & 0x10101010;
+    uint32_t innerMask = (isInner >> 4) * 0xffu;
+    uint32_t bitIndex = (meta ^ (octinv4 & innerMask)) & 0x1F1F1F1F;
+    uint32_t childBits = (meta >> 5) & 0x07070707;
+
+    uint32_t hitmask = 0;
+    for (int j = 0; j < 4; ++j)
+    {
+        if ((hits & (1 << j)) != 0)
+        {
+            uint32_t shiftBits = (childBits >> (j * 8)) & 255;
+            uint32_t bitShift = (bitIndex >> (j * 8)) & 31;
+            hitmask |= shiftBits << bitShift;
+        }
+    }
+    return hitmask;
+}
+
+static uint32_t IntersectCWBVHNodeScalar(const bvhvec3& origin, const bvhvec3& invDir, uint32_t octinv4, float tmax, const bvhvec4* node)
+{
+    uint32_t hitmask = 0;
+    bvhvec3 nodeInvDir = GetNodeInvDir(node[0].w, invDir);
+    bvhvec3 nodePos = (bvhvec3(node[0]) - origin) * invDir;
+
+    // i = 0 checks the first 4 children, i = 1 checks the second 4 children.
+    for (int i = 0; i < 2; ++i)
+    {
+        uint32_t meta = AsUint(i == 0 ? node[1].z : node[1].w);
+        uint32_t bounds[6];
+        NodeChildBounds(node, invDir, i, bounds);
+
+        uint32_t hits = 0;
+        for (int j = 0; j < 4; ++j)
+        {
+            float lox = static_cast<float>(ExtractByte(bounds[0], j));
+            float loy = static_cast<float>(ExtractByte(bounds[1], j));
+            float loz = static_cast<float>(ExtractByte(bounds[2], j));
+            float hix = static_cast<float>(ExtractByte(bounds[3], j));
+            float hiy = static_cast<float>(ExtractByte(bounds[4], j));
+            float hiz = static_cast<float>(ExtractByte(bounds[5], j));
+
+            float tminx = lox * nodeInvDir.x + nodePos.x;
+            float tmaxx = hix * nodeInvDir.x + nodePos.x;
+            float tminy = loy * nodeInvDir.y + nodePos.y;
+            float tmaxy = hiy * nodeInvDir.y + nodePos.y;
+            float tminz = loz * nodeInvDir.z + nodePos.z;
+            float tmaxz = hiz * nodeInvDir.z + nodePos.z;
+
+            float cmin = Max(Max(Max(tminx, tminy), tminz), 0.0f);
+            float cmax = Min(Min(Min(tmaxx, tmaxy), tmaxz), tmax);
+
+            if (cmin <= cmax)
+                hits |= 1 << j;
+        }
+        hitmask |= ChildHitBits(meta, octinv4, hits);
+    }
+
+    return hitmask;
+}
+
+#ifdef CWBVH_TRAVERSAL_SSE2
+// The four bytes of value as floats, like ExtractBytes in common.hlsl.
+static inline __m128 ExtractBytes4(uint32_t value)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i bytes = _mm_cvtsi32_si128(static_cast<int>(value));
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(bytes, zero), zero));
+}
+
+// _mm_max_ps and _mm_min_ps return b when either is NaN, these return the other operand like
+// fmaxf and fminf.
+static inline __m128 Max4(__m128 a, __m128 b)
+{
+    __m128 nanB = _mm_cmpunord_ps(b, b);
+    return _mm_or_ps(_mm_and_ps(nanB, a), _mm_andnot_ps(nanB, _mm_max_ps(a, b)));
+}
+
+static inline __m128 Min4(__m128 a, __m128 b)
+{
+    __m128 nanB = _mm_cmpunord_ps(b, b);
+    return _mm_or_ps(_mm_and_ps(nanB, a), _mm_andnot_ps(nanB, _mm_min_ps(a, b)));
+}
+
+// IntersectCWBVHNodeScalar with the four children of each half tested at once.
+static uint32_t IntersectCWBVHNodeSSE2(const bvhvec3& origin, const bvhvec3& invDir, uint32_t octinv4, float tmax, const bvhvec4* node)
+{
+    uint32_t hitmask = 0;
+    bvhvec3 nodeInvDir = GetNodeInvDir(node[0].w, invDir);
+    bvhvec3 nodePos = (bvhvec3(node[0]) - origin) * invDir;
+    const __m128 invDirX = _mm_set1_ps(nodeInvDir.x), posX = _mm_set1_ps(nodePos.x);
+    const __m128 invDirY = _mm_set1_ps(nodeInvDir.y), posY = _mm_set1_ps(nodePos.y);
+    const __m128 invDirZ = _mm_set1_ps(nodeInvDir.z), posZ = _mm_set1_ps(nodePos.z);
+    const __m128 zero = _mm_setzero_ps(), tmax4 = _mm_set1_ps(tmax);
+
+    for (int i = 0; i < 2; ++i)
+    {
+        uint32_t meta = AsUint(i == 0 ? node[1].z : node[1].w);
+        uint32_t bounds[6];
+        NodeChildBounds(node, invDir, i, bounds);
+
+        __m128 tminx = _mm_add_ps(_mm_mul_ps(ExtractBytes4(bounds[0]), invDirX), posX);
+        __m128 tmaxx = _mm_add_ps(_mm_mul_ps(ExtractBytes4(bounds[3]), invDirX), posX);
+        __m128 tminy = _mm_add_ps(_mm_mul_ps(ExtractBytes4(bounds[1]), invDirY), posY);
+        __m128 tmaxy = _mm_add_ps(_mm_mul_ps(ExtractBytes4(bounds[4]), invDirY), posY);
+        __m128 tminz = _mm_add_ps(_mm_mul_ps(ExtractBytes4(bounds[2]), invDirZ), posZ);
+        __m128 tmaxz = _mm_add_ps(_mm_mul_ps(ExtractBytes4(bounds[5]), invDirZ), posZ);
+
+        __m128 cmin = Max4(Max4(Max4(tminx, tminy), tminz), zero);
+        __m128 cmax = Min4(Min4(Min4(tmaxx, tmaxy), tmaxz), tmax4);
+
+        uint32_t hits = static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(cmin, cmax)));
+        hitmask |= ChildHitBits(meta, octinv4, hits);
+    }
+
+    return hitmask;
+}
+#endif
+
+static uint32_t IntersectCWBVHNode(const bvhvec3& origin, const bvhvec3& invDir, uint32_t octinv4, float tmax, const bvhvec4* node, bool simd)
+{
+#ifdef CWBVH_TRAVERSAL_SSE2
+    if (simd)
+        return IntersectCWBVHNodeSSE2(origin, invDir, octinv4, tmax, node);
+#else
+    (void)simd;
+#endif
+    return IntersectCWBVHNodeScalar(origin, invDir, octinv4, tmax, node);
+}
+
+// A vertex of a compressed triangle block, stored as packed float3s from vertexBase.
+static bvhvec3 LoadCWBVHVertex(const bvhvec4* tris, uint32_t vertexBase, uint32_t vertex)
+{
+    bvhvec3 position;
+    memcpy(&position, reinterpret_cast<const float*>(&tris[vertexBase]) + vertex * 3, sizeof(position));
+    return position;
+}
+
+uint32_t LoadCWBVHTriangle(const bvhvec4* tris, bool compressedTris, uint32_t triBase, uint32_t triangleIndex,
+                           bvhvec4& v0, bvhvec3& e1, bvhvec3& e2)
+{
+    if (compressedTris)
+    {
+        uint32_t triAddr = triBase + (triangleIndex >> 1);
+        uint32_t tri[2];
+        memcpy(tri, reinterpret_cast<const uint32_t*>(&tris[triAddr]) + (triangleIndex & 1) * 2, sizeof(tri));
+        uint32_t vertexBase = triBase + (tri[0] >> 24);
+        bvhvec3 p0 = LoadCWBVHVertex(tris, vertexBase, tri[0] & 0xFF);
+        v0 = bvhvec4(p0, AsFloat(tri[1]));
+        e1 = LoadCWBVHVertex(tris, vertexBase, (tri[0] >> 8) & 0xFF) - p0;
+        e2 = LoadCWBVHVertex(tris, vertexBase, (tri[0] >> 16) & 0xFF) - p0;
+        return triAddr;
+    }
+
+    uint32_t triAddr = triBase + triangleIndex * 3;
+    v0 = tris[triAddr + 2];
+    e1 = bvhvec3(tris[triAddr + 1]);
+    e2 = bvhvec3(tris[triAddr + 0]);
+    return triAddr;
+}
+
+static bool IntersectTriangle(const bvhvec4* tris, bool compressedTris, uint32_t triBase, uint32_t triangleIndex,
+                              const CWBVHRay& ray, CWBVHHit& hit)
+{
+    bvhvec4 tri;
+    bvhvec3 e1, e2;
+    uint32_t triAddr = LoadCWBVHTriangle(tris, compressedTris, triBase, triangleIndex, tri, e1, e2);
+    bvhvec3 v0 = bvhvec3(tri);
+
+    bvhvec3 r = tinybvh::tinybvh_cross(ray.direction, e2);
+    float a = tinybvh::tinybvh_dot(e1, r);
+
+    if (fabsf(a) > 0.0000001f)
+    {
+        float f = 1.0f / a;
+        bvhvec3 s = ray.origin - v0;
+        float u = f * tinybvh::tinybvh_dot(s, r);
+
+        if (u >= 0.0f && u <= 1.0f)
+        {
+            bvhvec3 q = tinybvh::tinybvh_cross(s, e1);
+            float v = f * tinybvh::tinybvh_dot(ray.direction, q);
+
+            if (v >= 0.0f && u + v <= 1.0f)
+            {
+                float d = f * tinybvh::tinybvh_dot(e2, q);
+
+                if (d > ray.tMin && d < hit.distance)
+                {
+                    hit.u = u;
+                    hit.v = v;
+                    hit.triAddr = triAddr;
+                    hit.triIndex = AsUint(tri.w);
+                    hit.distance = d;
+                    return true;
+                }
+            }
+        }
+    }
+
+    return false;
+}
+
+bool IntersectCWBVH(const bvhvec4* nodes, const bvhvec4* tris, bool compressedTris,
+                    const CWBVHRay& ray, CWBVHHit& hit, bool anyHit, bool simd)
+{
+    const bvhvec3 invDir(1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z);
+    const uint32_t octinv4 = (7 - ((ray.direction.x < 0 ? 4 : 0) | (ray.direction.y < 0 ? 2 : 0) | (ray.direction.z < 0 ? 1 : 0))) * 0x1010101;
+
+    // Groups of nodes or triangles: the index of the first one, and a bit per node in the
+    // high byte or per triangle in the low three bytes.
+    struct Group
+    {
+        uint32_t x;
+        uint32_t y;
+    };
+    Group stack[kStackSize];
+    uint32_t stackPtr = 0;
+    Group nodeGroup = { 0, 0x80000000 };
+    Group triGroup = { 0, 0 };
+    bool hitFound = false;
+
+    while (true)
+    {
+        if (nodeGroup.y > 0x00FFFFFF)
+        {
+            hit.steps += 1;
+            uint32_t mask = nodeGroup.y;
+            uint32_t childBitIndex = FirstBitHigh(mask);
+            uint32_t childNodeBaseIndex = nodeGroup.x;
+
+            nodeGroup.y &= ~(1u << childBitIndex);
+            if (nodeGroup.y > 0x00FFFFFF)
+                stack[stackPtr++] = nodeGroup;
+
+            uint32_t slotIndex = (childBitIndex - 24) ^ (octinv4 & 255);
+            uint32_t relativeIndex = CountBits(mask & ~(0xFFFFFFFFu << slotIndex));
+            uint32_t childNodeIndex = childNodeBaseIndex + relativeIndex;
+
+            const bvhvec4* node = nodes + childNodeIndex * 5;
+            uint32_t hitmask = IntersectCWBVHNode(ray.origin, invDir, octinv4, hit.distance, node, simd);
+
+            nodeGroup.x = AsUint(node[1].x);
+            nodeGroup.y = (hitmask & 0xFF000000) | (AsUint(node[0].w) >> 24);
+            triGroup.x = AsUint(node[1].y);
+            triGroup.y = hitmask & 0x00FFFFFF;
+        }
+        else
+        {
+            triGroup = nodeGroup;
+            nodeGroup = { 0, 0 };
+        }
+
+        // Process all triangles in the current group
+        while (triGroup.y != 0)
+        {
+            hit.steps += 4;
+            uint32_t triangleIndex = FirstBitHigh(triGroup.y);
+
+            if (IntersectTriangle(tris, compressedTris, triGroup.x, triangleIndex, ray, hit))
+            {
+                hitFound = true;
+                if (anyHit)
+                    return true;
+            }
+
+            triGroup.y -= 1u << triangleIndex;
+        }
+
+        if (nodeGroup.y <= 0x00FFFFFF)
+        {
+            if (stackPtr > 0)
+                nodeGroup = stack[--stackPtr];
+            else
+                break;
+        }
+    }
+
+    return hitFound;
+}
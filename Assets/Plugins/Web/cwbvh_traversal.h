@@ -0,0 +1,46 @@
+#pragma once
+
+#include "plugin.h"
+
+// SSE2 is part of every x86-64 target, and Emscripten maps it to WASM SIMD128 when built
+// with -msimd128 -msse2.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CWBVH_TRAVERSAL_SSE2
+#endif
+
+// A ray through a CWBVH, like Ray in the shaders. Only hits past tMin count, bvh.hlsl uses
+// 0.0001 and tlas.hlsl 0.
+struct CWBVHRay
+{
+    tinybvh::bvhvec3 origin;
+    tinybvh::bvhvec3 direction;
+    float tMin;
+};
+
+// Closest hit found so far, like RayHit in the shaders. distance starts at the farthest hit
+// that counts and shrinks with every closer one. triIndex is the triangle index stored with
+// the triangle, triAddr the float4 address of its data, and steps counts the work like
+// bvh.hlsl does: one per node and four per triangle.
+struct CWBVHHit
+{
+    float distance;
+    float u;
+    float v;
+    uint32_t triIndex;
+    uint32_t triAddr;
+    uint32_t steps;
+};
+
+// Traces a ray through CWBVH nodes and triangles laid out like the shaders read them, in
+// the same order and with the same arithmetic as RayIntersectBvh and IntersectCWBVHNode in
+// bvh.hlsl, so it can stand in for the GPU traversal. compressedTris selects the layout of
+// SetBVHCompressedTris. With anyHit it returns at the first hit, for shadow rays. simd
+// selects the SSE2 node test if compiled in, it finds the same hits as the scalar one.
+// Returns true if a hit closer than hit.distance was found.
+bool IntersectCWBVH(const tinybvh::bvhvec4* nodes, const tinybvh::bvhvec4* tris, bool compressedTris,
+                    const CWBVHRay& ray, CWBVHHit& hit, bool anyHit, bool simd);
+
+// Loads a triangle of the block at triBase like LoadBVHTriangle in globals.hlsl: its first
+// vertex, with the triangle index in w, and its two edges. Returns the triangle's address.
+uint32_t LoadCWBVHTriangle(const tinybvh::bvhvec4* tris, bool compressedTris, uint32_t triBase, uint32_t triangleIndex,
+                           tinybvh::bvhvec4& v0, tinybvh::bvhvec3& e1, tinybvh::bvhvec3& e2);
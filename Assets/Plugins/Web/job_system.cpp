@@ -0,0 +1,234 @@
+#include "job_system.h"
+
+// Index of the current thread's queue, -1 on threads outside the pool.
+static thread_local int tWorkerIndex = -1;
+// Jobs taken from other queues that are running on the current thread's stack.
+static thread_local int tStolenJobs = 0;
+
+// A thread waiting in ForkJoin runs other jobs on top of its stack. Its own queue only
+// holds subtrees of the joins it is waiting on, which keeps the nesting to the fork depth,
+// but stolen jobs bring their own forks along. SBVH builds have large frames, so waiting
+// threads only steal while few stolen jobs are below them.
+static const int kMaxStolenJobs = 2;
+
+JobSystem& JobSystem::Get()
+{
+    // Intentionally never destroyed, joining threads from a static destructor can
+    // deadlock while the plugin is being unloaded.
+    static JobSystem* instance = new JobSystem();
+    return *instance;
+}
+
+JobSystem::JobSystem()
+{
+    StartWorkers(0);
+}
+
+void JobSystem::StartWorkers(int count)
+{
+#ifndef PLUGIN_NO_THREADS
+    if (count <= 0)
+    {
+        // Leave one core for the thread that submits the work.
+        unsigned int coreCount = std::thread::hardware_concurrency();
+        count = coreCount > 1 ? static_cast<int>(coreCount) - 1 : 1;
+    }
+
+    _stopping = false;
+    _queues.clear();
+    for (int i = 0; i < count; ++i)
+        _queues.emplace_back(new WorkQueue());
+    for (int i = 0; i < count; ++i)
+        _workers.emplace_back(&JobSystem::WorkerLoop, this, i);
+    _workerCount = count;
+#endif
+}
+
+void JobSystem::StopWorkers()
+{
+    {
+        std::lock_guard<std::mutex> lock(_sleepMutex);
+        _stopping = true;
+    }
+    _jobAvailable.notify_all();
+
+    // Workers only exit once every queue is empty.
+    for (std::thread& worker : _workers)
+        worker.join();
+    _workers.clear();
+    _workerCount = 0;
+}
+
+void JobSystem::SetWorkerCount(int count)
+{
+    std::lock_guard<std::mutex> lock(_configMutex);
+    StopWorkers();
+    StartWorkers(count);
+}
+
+void JobSystem::Submit(std::function<void()> job)
+{
+    if (_workerCount == 0)
+    {
+        job();
+        return;
+    }
+
+    Push(std::move(job));
+}
+
+void JobSystem::SubmitBackground(std::function<void()> job)
+{
+    if (_workerCount == 0)
+    {
+        job();
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_background.mutex);
+        _background.jobs.push_back(std::move(job));
+    }
+    _queuedJobs.fetch_add(1);
+    {
+        std::lock_guard<std::mutex> lock(_sleepMutex);
+    }
+    _jobAvailable.notify_one();
+}
+
+void JobSystem::ForkJoin(const std::function<void()>& taskA, const std::function<void()>& taskB)
+{
+    if (_workerCount == 0)
+    {
+        taskA();
+        taskB();
+        return;
+    }
+
+    std::atomic<bool> doneB { false };
+    Push([&taskB, &doneB]
+    {
+        taskB();
+        doneB.store(true, std::memory_order_release);
+    });
+
+    taskA();
+
+    // Most of the time nobody stole taskB and it's the next job in our own queue.
+    while (!doneB.load(std::memory_order_acquire))
+    {
+        if (!TryRunJob(tStolenJobs < kMaxStolenJobs, false))
+            std::this_thread::yield();
+    }
+}
+
+void JobSystem::ParallelFor(int count, const std::function<void(int)>& body)
+{
+    ParallelRange(0, count, body);
+}
+
+void JobSystem::ParallelRange(int begin, int end, const std::function<void(int)>& body)
+{
+    if (end - begin <= 1)
+    {
+        if (end > begin)
+            body(begin);
+        return;
+    }
+
+    // Split in halves so idle workers steal large ranges first.
+    int middle = begin + (end - begin) / 2;
+    ForkJoin([&] { ParallelRange(begin, middle, body); }, [&] { ParallelRange(middle, end, body); });
+}
+
+void JobSystem::Push(std::function<void()> job)
+{
+    WorkQueue& queue = tWorkerIndex >= 0 ? *_queues[tWorkerIndex] : _injected;
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.jobs.push_back(std::move(job));
+    }
+
+    // Increment after the push so a worker woken by the count always finds the job.
+    _queuedJobs.fetch_add(1);
+    {
+        std::lock_guard<std::mutex> lock(_sleepMutex);
+    }
+    _jobAvailable.notify_one();
+}
+
+bool JobSystem::PopBack(WorkQueue& queue, std::function<void()>& job)
+{
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.jobs.empty())
+        return false;
+
+    job = std::move(queue.jobs.back());
+    queue.jobs.pop_back();
+    return true;
+}
+
+bool JobSystem::PopFront(WorkQueue& queue, std::function<void()>& job)
+{
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.jobs.empty())
+        return false;
+
+    job = std::move(queue.jobs.front());
+    queue.jobs.pop_front();
+    return true;
+}
+
+bool JobSystem::TryRunJob(bool steal, bool background)
+{
+    if (_queuedJobs.load() == 0)
+        return false;
+
+    std::function<void()> job;
+    int queueCount = static_cast<int>(_queues.size());
+    int self = tWorkerIndex;
+
+    // Threads outside the pool push to the injected queue, so that's their own.
+    bool found = PopBack(self >= 0 ? *_queues[self] : _injected, job);
+    bool stolen = !found;
+    if (!found && steal && self >= 0)
+        found = PopFront(_injected, job);
+    for (int i = 1; !found && steal && i <= queueCount; ++i)
+    {
+        int victim = (self + i + queueCount) % queueCount;
+        if (victim != self)
+            found = PopFront(*_queues[victim], job);
+    }
+    if (!found && background)
+        found = PopFront(_background, job);
+
+    if (!found)
+        return false;
+
+    _queuedJobs.fetch_sub(1);
+    tStolenJobs += stolen;
+    job();
+    tStolenJobs -= stolen;
+    return true;
+}
+
+void JobSystem::WorkerLoop(int index)
+{
+    tWorkerIndex = index;
+
+    while (true)
+    {
+        if (TryRunJob(true, true))
+            continue;
+
+        std::unique_lock<std::mutex> lock(_sleepMutex);
+        _jobAvailable.wait(lock, [this] { return _stopping || _queuedJobs.load() > 0; });
+        if (_stopping && _queuedJobs.load() == 0)
+            return;
+    }
+}
+
+void PluginForkJoin(const std::function<void()>& taskA, const std::function<void()>& taskB)
+{
+    JobSystem::Get().ForkJoin(taskA, taskB);
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// WebGL builds without pthread support can't create threads, so jobs run inline.
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+#define PLUGIN_NO_THREADS
+#endif
+
+// Persistent work-stealing pool of worker threads owned by the plugin. Used to run
+// BVH builds off the calling thread and to split a single build across cores.
+class JobSystem
+{
+public:
+    static JobSystem& Get();
+
+    // Queues a job to run on a worker thread. If threads aren't available the job
+    // runs before Submit returns.
+    void Submit(std::function<void()> job);
+
+    // Queues a job that only runs once no other job is queued, on an idle worker. Never
+    // picked up by threads waiting in ForkJoin, so long jobs can't delay a join.
+    void SubmitBackground(std::function<void()> job);
+
+    // Runs both tasks, possibly in parallel, and returns once both are done. The
+    // calling thread runs taskA itself and helps with queued jobs while it waits.
+    void ForkJoin(const std::function<void()>& taskA, const std::function<void()>& taskB);
+
+    // Calls body for every index in [0, count) across the pool and returns when all are done.
+    void ParallelFor(int count, const std::function<void(int)>& body);
+
+    // Restarts the pool with the given number of workers, 0 picks one per core minus
+    // the calling thread. Queued jobs finish first, so callers must not submit work
+    // concurrently.
+    void SetWorkerCount(int count);
+
+    // Number of worker threads, 0 when jobs run inline.
+    int GetWorkerCount() const { return _workerCount.load(); }
+
+private:
+    struct WorkQueue
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()>> jobs;
+    };
+
+    JobSystem();
+    void StartWorkers(int count);
+    void StopWorkers();
+    void WorkerLoop(int index);
+    void ParallelRange(int begin, int end, const std::function<void(int)>& body);
+    void Push(std::function<void()> job);
+    // Runs a job from the thread's own queue, or steals one from another queue if allowed,
+    // and then a background job if allowed.
+    bool TryRunJob(bool steal, bool background);
+    static bool PopBack(WorkQueue& queue, std::function<void()>& job);
+    static bool PopFront(WorkQueue& queue, std::function<void()>& job);
+
+    std::vector<std::thread> _workers;
+    // One queue per worker, the owner pops newest jobs first and idle workers steal
+    // the oldest ones, which are the largest subtrees in a recursive build.
+    std::vector<std::unique_ptr<WorkQueue>> _queues;
+    // Jobs pushed from threads outside the pool.
+    WorkQueue _injected;
+    WorkQueue _background;
+    std::atomic<int> _queuedJobs { 0 };
+    std::atomic<int> _workerCount { 0 };
+    std::mutex _sleepMutex;
+    std::condition_variable _jobAvailable;
+    bool _stopping = false;
+    std::mutex _configMutex;
+};
+
+// Fork-join entry point handed to tinybvh through TINYBVH_FORK_JOIN.
+void PluginForkJoin(const std::function<void()>& taskA, const std::function<void()>& taskB);
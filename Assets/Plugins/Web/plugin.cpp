@@ -1,149 +1,2260 @@
-#include <deque>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <vector>
 
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+
+#define TINYBVH_IMPLEMENTATION
 #include "plugin.h"
+#include "build_arena.h"
+#include "bvh_build_avx.h"
+#include "bvh_cache.h"
+#include "cwbvh_traversal.h"
+#include "reference_renderer.h"
+#include "scene_capture.h"
+#include "slot_map.h"
+
+// Triangles a BLAS is built from: a soup of three vertices per triangle when indices is
+// null, otherwise indexed vertices. quality is one of BVHBuildQuality.
+struct BLASGeometry
+{
+    tinybvh::bvhvec4* vertices = nullptr;
+    int vertexCount = 0;
+    const uint32_t* indices = nullptr;
+    int triangleCount = 0;
+    int quality = BVH_QUALITY_BINNED;
+    // Lean BVHs keep nothing but their encoded CWBVH, see SetBVHLeanBuilds.
+    bool lean = false;
+    // Triangles are stored compressed, see SetBVHCompressedTris.
+    bool compressTris = false;
+};
+
+static BLASGeometry SoupGeometry(tinybvh::bvhvec4* vertices, int triangleCount, int quality)
+{
+    return { vertices, triangleCount * 3, nullptr, triangleCount, quality };
+}
+
+// A BLAS slot. The BVH is only visible through GetBVH once its build has finished.
+struct BVHEntry
+{
+    tinybvh::BVH8_CWBVH* bvh = nullptr;
+    std::atomic<bool> ready { false };
+    // What the BVH was built from, and the SAH cost of that build and of the current,
+    // possibly refit, tree.
+    BLASGeometry geometry;
+    float builtCost = 0.0f;
+    float cost = 0.0f;
+    // Progressive builds: the improved BVH waiting for GetBVHVersion to swap it in, set by
+    // the background build under gBuildMutex, and how many were swapped in so far. A refit
+    // while improving discards the improvement, it was built from the old vertices.
+    tinybvh::BVH8_CWBVH* improved = nullptr;
+    std::atomic<bool> improving { false };
+    bool discardImprovement = false;
+    int version = 0;
+    // Bumped whenever the BVH is refit, rebuilt or swapped for an improved one, so query
+    // scenes can tell they were built over an older BVH even if a new one reuses its memory.
+    uint32_t generation = 0;
+    // Cache key of a deferred BVH that missed the cache, stored from the caller memory the
+    // first write encodes it into. 0 once stored, or if there is nothing to store.
+    uint64_t cacheKey = 0;
+};
+
+// A set of BLASes built together and packed into one node arena and one triangle arena,
+// laid out exactly like the shaders read them. The per-mesh BVHs are freed once packed.
+// A deferred batch skips the arenas and keeps its BVHs until WriteBVHBatchData encodes
+// them into caller memory.
+struct BVHBatch
+{
+    std::vector<tinybvh::BVH8_CWBVH*> bvhs;
+    std::atomic<int> remaining { 0 };
+    std::atomic<bool> ready { false };
+    bool deferred = false;
+    // Like BVHEntry::cacheKey, one per mesh.
+    std::vector<uint64_t> cacheKeys;
+
+    tinybvh::bvhvec4* nodes = nullptr;
+    tinybvh::bvhvec4* tris = nullptr;
+    int64_t nodesSize = 0;
+    int64_t trisSize = 0;
+    // Byte offsets of each mesh's nodes and triangles in the arenas, two per mesh.
+    std::vector<int64_t> offsets;
+
+    // Progressive batches: the meshes, which of them still need improving, and improved BVHs
+    // by mesh waiting for GetBVHBatchVersion to swap them in, set by the background builds
+    // under gBuildMutex. Meshes that weren't swapped in yet keep their BVHs after packing.
+    std::vector<BLASGeometry> meshes;
+    std::vector<uint8_t> improve;
+    std::vector<std::pair<int, tinybvh::BVH8_CWBVH*>> improved;
+    std::atomic<int> improving { 0 };
+    int unpublished = 0;
+    int version = 0;
+
+    ~BVHBatch()
+    {
+        for (tinybvh::BVH8_CWBVH* bvh : bvhs)
+            delete bvh;
+        for (const std::pair<int, tinybvh::BVH8_CWBVH*>& mesh : improved)
+            delete mesh.second;
+        tinybvh::free64(nodes);
+        tinybvh::free64(tris);
+    }
+};
+
+static SlotMap<BVHEntry> gBVHs;
+static SlotMap<BVHBatch> gBatches;
+// A TLAS and what it needs to be refit instead of rebuilt.
+struct TLASEntry
+{
+    tinybvh::BVH_GPU* tlas = nullptr;
+    // SAH cost of the last full build and of the current, possibly refit, tree.
+    float builtCost = 0.0f;
+    float cost = 0.0f;
+    // Copy of the GPU nodes followed by the instance indices as last reported, and the byte
+    // ranges of it that changed with the last update, two ints per range: offset and size.
+    std::vector<uint8_t> image;
+    size_t imageNodesSize = 0;
+    std::vector<int> dirtyRanges;
+};
+
+static SlotMap<TLASEntry> gTLASes;
+// RefitTLAS rebuilds once the SAH cost grows past the last full build's times this.
+static float gTLASRebuildThreshold = 1.5f;
+
+// Signalled whenever an async build finishes.
+static std::mutex gBuildMutex;
+static std::condition_variable gBuildFinished;
+static std::atomic<int> gPendingBuilds { 0 };
+
+static int DetectSimdLevel()
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+    int info[4];
+    __cpuid(info, 1);
+    bool sse42 = (info[2] & (1 << 20)) != 0;
+    bool fma = (info[2] & (1 << 12)) != 0;
+    // AVX also needs the OS to save the YMM registers on context switches.
+    bool avx = (info[2] & (1 << 28)) != 0 && (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+    __cpuidex(info, 7, 0);
+    bool avx2 = avx && fma && (info[1] & (1 << 5)) != 0;
+#elif defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+    bool sse42 = __builtin_cpu_supports("sse4.2");
+    bool avx = __builtin_cpu_supports("avx");
+    bool avx2 = avx && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+    bool sse42 = false, avx = false, avx2 = false;
+#endif
+
+    if (avx2)
+        return SIMD_AVX2;
+    if (avx)
+        return SIMD_AVX;
+    if (sse42)
+        return SIMD_SSE42;
+    return SIMD_SCALAR;
+}
+
+// What the CPU supports, and the level builds are currently allowed to use.
+static const int gSupportedSimdLevel = DetectSimdLevel();
+static std::atomic<int> gSimdLevel { gSupportedSimdLevel };
+
+// Subtree reinsertion passes run by BVH_QUALITY_OPTIMIZED builds.
+static int gOptimizeIterations = 25;
+static bool gOptimizeExtreme = false;
+// Builds start with a quick BVH and are rebuilt at their quality in the background.
+static bool gProgressiveBuilds = false;
+static bool gLeanBuilds = false;
+static bool gCompressedTris = false;
+
+#ifdef PLUGIN_HAS_AVX_BUILDER
+// Binned SAH build of the binary BVH with the AVX2 builder, filling in the same fields as
+// tinybvh's own builders.
+static void BuildBinaryBVHAVX2(tinybvh::BVH& bvh2, const BLASGeometry& geometry)
+{
+    BinaryBVH result;
+    BuildBinaryBVHAVX2(&geometry.vertices[0].x, geometry.vertexCount, geometry.indices, geometry.triangleCount,
+                       bvh2.context.malloc, bvh2.context.free, bvh2.context.userdata, result);
+
+    bvh2.AlignedFree(bvh2.bvhNode);
+    bvh2.AlignedFree(bvh2.primIdx);
+    bvh2.bvhNode = static_cast<tinybvh::BVH::BVHNode*>(result.nodes);
+    bvh2.primIdx = result.primIdx;
+    bvh2.allocatedNodes = result.allocatedNodes;
+    bvh2.usedNodes = result.usedNodes;
+    bvh2.triCount = geometry.triangleCount;
+    bvh2.idxCount = result.idxCount;
+    bvh2.verts = tinybvh::bvhvec4slice(geometry.vertices, geometry.vertexCount, sizeof(tinybvh::bvhvec4));
+    bvh2.vertIdx = const_cast<uint32_t*>(geometry.indices);
+    bvh2.aabbMin = tinybvh::bvhvec3(result.aabbMin[0], result.aabbMin[1], result.aabbMin[2]);
+    bvh2.aabbMax = tinybvh::bvhvec3(result.aabbMax[0], result.aabbMax[1], result.aabbMax[2]);
+    bvh2.may_have_holes = result.mayHaveHoles;
+    bvh2.refittable = true;
+    bvh2.bvh_over_aabbs = false;
+    bvh2.bvh_over_indices = false;
+}
+#endif
+
+// Binned SAH build with the fastest builder the CPU and the plugin binary support.
+static void BuildBinnedBVH(tinybvh::BVH& bvh2, const BLASGeometry& geometry)
+{
+#ifdef PLUGIN_HAS_AVX_BUILDER
+    if (gSimdLevel.load() >= SIMD_AVX2)
+    {
+        BuildBinaryBVHAVX2(bvh2, geometry);
+        return;
+    }
+#endif
+    // BuildDefault is protected; with TINYBVH_NO_SIMD it is the reference builder anyway.
+    tinybvh::bvhvec4slice vertices(geometry.vertices, geometry.vertexCount, sizeof(tinybvh::bvhvec4));
+    if (geometry.indices != nullptr)
+        bvh2.Build(vertices, geometry.indices, geometry.triangleCount);
+    else
+        bvh2.Build(vertices);
+}
+
+// Mid-point split build. tinybvh only has it for soups, so indexed geometry is built from
+// a temporary soup; primitive indices are triangle indices either way.
+static void BuildQuickBVH(tinybvh::BVH& bvh2, const BLASGeometry& geometry)
+{
+    if (geometry.indices == nullptr)
+    {
+        bvh2.BuildQuick(tinybvh::bvhvec4slice(geometry.vertices, geometry.vertexCount, sizeof(tinybvh::bvhvec4)));
+        return;
+    }
+
+    std::vector<tinybvh::bvhvec4> soup(geometry.triangleCount * 3);
+    for (size_t i = 0; i < soup.size(); ++i)
+        soup[i] = geometry.vertices[geometry.indices[i]];
+    bvh2.BuildQuick(tinybvh::bvhvec4slice(soup.data(), static_cast<uint32_t>(soup.size()), sizeof(tinybvh::bvhvec4)));
+    bvh2.verts = tinybvh::bvhvec4slice(geometry.vertices, geometry.vertexCount, sizeof(tinybvh::bvhvec4));
+    bvh2.vertIdx = const_cast<uint32_t*>(geometry.indices);
+}
+
+// Reinserts the subtrees that cost the most, like BVH::Optimize, which leaks its
+// BVH_Verbose copy.
+static void OptimizeBVH(tinybvh::BVH& bvh2)
+{
+    tinybvh::BVH_Verbose verbose(bvh2.context);
+    verbose.ConvertFrom(bvh2);
+    verbose.Optimize(gOptimizeIterations, gOptimizeExtreme);
+    bvh2.ConvertFrom(verbose);
+}
+
+// Builds everything up to the 8-wide BVH the CWBVH is encoded from, with the builder the
+// geometry's quality asks for.
+static void BuildWideBVH(tinybvh::BVH8_CWBVH* bvh, const BLASGeometry& geometry)
+{
+    // Build buffers come from the build arena, the CWBVH encoded from them doesn't, see
+    // BuildCWBVH.
+    bvh->context.malloc = BuildArena::Allocate;
+    bvh->context.free = BuildArena::Free;
+    bvh->context.userdata = nullptr;
+    tinybvh::BVH& bvh2 = bvh->bvh8.bvh;
+    bvh2.context = bvh->bvh8.context = bvh->context;
+
+    switch (geometry.quality)
+    {
+    case BVH_QUALITY_QUICK:
+        BuildQuickBVH(bvh2, geometry);
+        break;
+    case BVH_QUALITY_SPATIAL:
+        if (geometry.indices != nullptr)
+            bvh2.BuildHQ(tinybvh::bvhvec4slice(geometry.vertices, geometry.vertexCount, sizeof(tinybvh::bvhvec4)), geometry.indices, geometry.triangleCount);
+        else
+            bvh2.BuildHQ(tinybvh::bvhvec4slice(geometry.vertices, geometry.vertexCount, sizeof(tinybvh::bvhvec4)));
+        break;
+    case BVH_QUALITY_OPTIMIZED:
+        BuildBinnedBVH(bvh2, geometry);
+        OptimizeBVH(bvh2);
+        break;
+    default:
+        BuildBinnedBVH(bvh2, geometry);
+        break;
+    }
+
+    bvh2.Compact();
+    bvh2.may_have_holes = false;
+    // Spatial splits reserve room for extra references at the end of the index list,
+    // Compact packs the ones in use at the front.
+    bvh2.idxCount = static_cast<uint32_t>(bvh2.PrimCount());
+    bvh2.SplitLeafs(3);
+    bvh->bvh8.ConvertFrom(bvh2, false);
+}
+
+static float BVHCost(const tinybvh::BVH& bvh)
+{
+    float cost = bvh.SAHCost();
+    return cost == cost ? cost : 0.0f; // a degenerate root has no area
+}
+
+// Frees the binary and 8-wide BVHs a CWBVH was encoded from. The CWBVH can't be refit or
+// encoded again afterwards.
+static void FreeIntermediateBVHs(tinybvh::BVH8_CWBVH* bvh)
+{
+    tinybvh::BVH& bvh2 = bvh->bvh8.bvh;
+    bvh2.AlignedFree(bvh2.bvhNode);
+    bvh2.AlignedFree(bvh2.primIdx);
+    bvh2.AlignedFree(bvh2.fragment);
+    bvh->bvh8.AlignedFree(bvh->bvh8.mbvhNode);
+    // Resets the members without freeing anything again.
+    bvh->bvh8 = tinybvh::MBVH<8>();
+}
+
+// Triangles of a CWBVH node: the float4 offset of the first one and how many there are. The
+// leaf children's triangles follow each other, a leaf's meta byte holds its first triangle
+// relative to the node and its count in unary.
+static uint32_t NodeTriangles(const tinybvh::bvhvec4* node, uint32_t* count)
+{
+    const uint8_t* header = reinterpret_cast<const uint8_t*>(&node[0].w);
+    const uint8_t* meta = reinterpret_cast<const uint8_t*>(&node[1]) + 8;
+    *count = 0;
+    for (int i = 0; i < 8; ++i)
+    {
+        if (meta[i] == 0 || (header[3] & (1 << i)) != 0)
+            continue;
+        uint32_t end = meta[i] & 0x1F;
+        for (uint32_t bits = meta[i] >> 5; bits != 0; bits >>= 1)
+            ++end;
+        *count = std::max(*count, end);
+    }
+    uint32_t triangleBaseIndex;
+    memcpy(&triangleBaseIndex, &node[1].y, sizeof(triangleBaseIndex));
+    return triangleBaseIndex;
+}
+
+// Replaces the triangles of an encoded CWBVH with compressed ones, see BVH_COMPRESSED_TRIS in
+// globals.hlsl. Each node's triangles become a block of two uints per triangle, two triangles
+// to a float4, followed by the block's distinct vertices as packed float3s. A triangle's first
+// uint holds the block indices of its three vertices in the low three bytes and the float4
+// offset of the vertices from the start of the block in the high byte, the second its
+// triangle index. The vertices are the positions the CWBVH was encoded from, so the decoded
+// edges are bit for bit those of the uncompressed triangles. The triangles are padded to
+// whole 48 byte triangles, which keeps idxCount giving their size.
+static void CompressCWBVHTris(tinybvh::BVH8_CWBVH* bvh, const BLASGeometry& geometry)
+{
+    std::vector<tinybvh::bvhvec4> compressed;
+    std::vector<tinybvh::bvhvec3> vertices;
+    std::vector<uint32_t> records;
+    const uint32_t nodeCount = bvh->usedBlocks / 5;
+    for (uint32_t n = 0; n < nodeCount; ++n)
+    {
+        tinybvh::bvhvec4* node = &bvh->bvh8Data[n * 5];
+        uint32_t count;
+        const tinybvh::bvhvec4* tris = &bvh->bvh8Tris[NodeTriangles(node, &count)];
+        if (count == 0)
+            continue;
+
+        vertices.clear();
+        records.clear();
+        uint32_t recordBlocks = (count + 1) / 2;
+        for (uint32_t t = 0; t < count; ++t)
+        {
+            uint32_t triIdx;
+            memcpy(&triIdx, &tris[t * 3 + 2].w, sizeof(triIdx));
+            uint32_t record = recordBlocks << 24;
+            for (uint32_t k = 0; k < 3; ++k)
+            {
+                uint32_t index = geometry.indices != nullptr ? geometry.indices[triIdx * 3 + k] : triIdx * 3 + k;
+                tinybvh::bvhvec3 position = geometry.vertices[index];
+                uint32_t local = 0;
+                while (local < vertices.size() && memcmp(&vertices[local], &position, sizeof(position)) != 0)
+                    ++local;
+                if (local == vertices.size())
+                    vertices.push_back(position);
+                record |= local << (k * 8);
+            }
+            records.push_back(record);
+            records.push_back(triIdx);
+        }
+        records.resize(recordBlocks * 4, 0);
+
+        uint32_t blockBase = static_cast<uint32_t>(compressed.size());
+        memcpy(&node[1].y, &blockBase, sizeof(blockBase));
+        compressed.resize(blockBase + recordBlocks + (vertices.size() * 3 + 3) / 4, tinybvh::bvhvec4(0.0f));
+        memcpy(&compressed[blockBase], records.data(), records.size() * sizeof(uint32_t));
+        memcpy(&compressed[blockBase + recordBlocks], vertices.data(), vertices.size() * sizeof(tinybvh::bvhvec3));
+    }
+    compressed.resize((compressed.size() + 2) / 3 * 3, tinybvh::bvhvec4(0.0f));
+
+    bvh->AlignedFree(bvh->bvh8Tris);
+    bvh->bvh8Tris = static_cast<tinybvh::bvhvec4*>(bvh->AlignedAlloc(compressed.size() * sizeof(tinybvh::bvhvec4)));
+    memcpy(bvh->bvh8Tris, compressed.data(), compressed.size() * sizeof(tinybvh::bvhvec4));
+    bvh->idxCount = static_cast<uint32_t>(compressed.size() / 3);
+}
+
+static void BuildCWBVH(tinybvh::BVH8_CWBVH* bvh, const BLASGeometry& geometry)
+{
+    BuildWideBVH(bvh, geometry);
+    // The encoded CWBVH usually outlives the build by far. It comes from the system allocator
+    // so it doesn't keep the arena chunks the intermediate BVHs are freed to.
+    bvh->context = tinybvh::BVHContext();
+    bvh->ConvertFrom(bvh->bvh8, true);
+    // ConvertFrom copies the 8-wide BVH's context along with its other properties.
+    bvh->context = tinybvh::BVHContext();
+    if (geometry.compressTris)
+        CompressCWBVHTris(bvh, geometry);
+    if (geometry.lean)
+        FreeIntermediateBVHs(bvh);
+}
+
+// Size in bytes of a BVH's CWBVH nodes and triangles. Deferred BVHs aren't encoded in
+// plugin memory, their sizes come from the 8-wide BVH they are encoded from.
+static int64_t CWBVHNodesSize(const tinybvh::BVH8_CWBVH* bvh)
+{
+    if (bvh->bvh8Data != nullptr)
+        return static_cast<int64_t>(bvh->usedBlocks) * 16;
+    return static_cast<int64_t>(tinybvh::BVH8_CWBVH::NodeBlocksNeeded(bvh->bvh8)) * 16;
+}
+
+static int64_t CWBVHTrisSize(const tinybvh::BVH8_CWBVH* bvh)
+{
+    // Spatial splits can reference a triangle from several leaves, so there can be more
+    // triangles in the CWBVH than in the mesh.
+    if (bvh->bvh8Tris != nullptr)
+        return static_cast<int64_t>(bvh->idxCount) * 3 * 16;
+    return static_cast<int64_t>(bvh->bvh8.idxCount) * 3 * 16;
+}
+
+// Frees the tinybvh allocations of a BVH whose data is mapped from the cache. The mapping
+// is closed once both the nodes and the triangles have been released.
+static void FreeCachedBVHData(void* ptr, void* userdata)
+{
+    BVHCacheEntry* entry = static_cast<BVHCacheEntry*>(userdata);
+    if (ptr == nullptr)
+        return;
+
+    if (ptr != entry->nodes && ptr != entry->tris)
+    {
+        tinybvh::free64(ptr);
+        return;
+    }
+
+    if (--entry->openViews == 0)
+        BVHCache::Release(entry);
+}
+
+static bool LoadCachedCWBVH(tinybvh::BVH8_CWBVH* bvh, uint64_t key, int triangleCount)
+{
+    BVHCacheEntry* entry = BVHCache::Get().Load(key, triangleCount);
+    if (entry == nullptr)
+        return false;
+
+    entry->openViews = 2;
+    bvh->context.free = FreeCachedBVHData;
+    bvh->context.userdata = entry;
+    bvh->bvh8Data = static_cast<tinybvh::bvhvec4*>(entry->nodes);
+    bvh->bvh8Tris = static_cast<tinybvh::bvhvec4*>(entry->tris);
+    bvh->usedBlocks = bvh->allocatedBlocks = entry->nodesSize / 16;
+    bvh->triCount = entry->triCount;
+    bvh->idxCount = entry->trisSize / (3 * 16);
+    bvh->aabbMin = tinybvh::bvhvec3(entry->aabbMin[0], entry->aabbMin[1], entry->aabbMin[2]);
+    bvh->aabbMax = tinybvh::bvhvec3(entry->aabbMax[0], entry->aabbMax[1], entry->aabbMax[2]);
+    return true;
+}
+
+static void StoreCachedCWBVH(const tinybvh::BVH8_CWBVH* bvh, uint64_t key)
+{
+    // Cache files store 32-bit sizes.
+    if (CWBVHNodesSize(bvh) > INT32_MAX || CWBVHTrisSize(bvh) > INT32_MAX)
+        return;
+
+    BVHCacheEntry entry;
+    entry.nodes = bvh->bvh8Data;
+    entry.tris = bvh->bvh8Tris;
+    entry.nodesSize = static_cast<int>(CWBVHNodesSize(bvh));
+    entry.trisSize = static_cast<int>(CWBVHTrisSize(bvh));
+    entry.triCount = bvh->triCount;
+    memcpy(entry.aabbMin, &bvh->aabbMin, sizeof(entry.aabbMin));
+    memcpy(entry.aabbMax, &bvh->aabbMax, sizeof(entry.aabbMax));
+    BVHCache::Get().Store(key, entry);
+}
+
+static uint64_t CacheKey(const BLASGeometry& geometry)
+{
+    uint64_t key = BVHCache::Hash(geometry.vertices, geometry.vertexCount * sizeof(tinybvh::bvhvec4));
+    if (geometry.indices != nullptr)
+    {
+        uint64_t keys[2] = { key, BVHCache::Hash(geometry.indices, geometry.triangleCount * 3 * sizeof(uint32_t)) };
+        key = BVHCache::Hash(keys, sizeof(keys));
+    }
+    // The same geometry built at another quality or with compressed triangles is a different BVH.
+    uint64_t keys[2] = { key, static_cast<uint64_t>(geometry.quality) | (geometry.compressTris ? 1ull << 32 : 0) };
+    return BVHCache::Hash(keys, sizeof(keys));
+}
+
+// Builds a BLAS, or maps it from the cache when the same geometry was built before. A
+// deferred miss stays deferred if cacheKey is given: it gets the key, and the first write
+// stores the CWBVH from the memory it is encoded into. Without cacheKey the miss is fully
+// encoded so it can be stored right away.
+static void BuildBLAS(tinybvh::BVH8_CWBVH* bvh, const BLASGeometry& geometry, bool deferred, uint64_t* cacheKey)
+{
+    if (BVHCache::Get().IsEnabled())
+    {
+        uint64_t key = CacheKey(geometry);
+        if (LoadCachedCWBVH(bvh, key, geometry.triangleCount))
+            return;
+
+        if (deferred && cacheKey != nullptr)
+        {
+            BuildWideBVH(bvh, geometry);
+            *cacheKey = key;
+            return;
+        }
+
+        BuildCWBVH(bvh, geometry);
+        StoreCachedCWBVH(bvh, key);
+        return;
+    }
+
+    if (deferred)
+        BuildWideBVH(bvh, geometry);
+    else
+        BuildCWBVH(bvh, geometry);
+}
+
+// Progressive builds need a worker to improve the BVH on, without one the BVH is built at
+// its quality right away.
+static bool IsProgressive(const BLASGeometry& geometry)
+{
+    return gProgressiveBuilds && geometry.quality != BVH_QUALITY_QUICK && JobSystem::Get().GetWorkerCount() > 0;
+}
+
+// First build of a BLAS. Progressive builds start with a quick BVH unless the final one is
+// in the cache, and return true if the BVH still has to be improved. cacheKey is as for
+// BuildBLAS.
+static bool BuildInitialBLAS(tinybvh::BVH8_CWBVH* bvh, const BLASGeometry& geometry, bool deferred, bool progressive,
+                             uint64_t* cacheKey)
+{
+    if (!progressive)
+    {
+        BuildBLAS(bvh, geometry, deferred, cacheKey);
+        return false;
+    }
+
+    if (BVHCache::Get().IsEnabled() && LoadCachedCWBVH(bvh, CacheKey(geometry), geometry.triangleCount))
+        return false;
+
+    BLASGeometry quick = geometry;
+    quick.quality = BVH_QUALITY_QUICK;
+    if (deferred)
+        BuildWideBVH(bvh, quick);
+    else
+        BuildCWBVH(bvh, quick);
+    return true;
+}
+
+// Writes a BVH's CWBVH data to caller memory. Deferred BVHs are encoded straight into it,
+// without ever allocating plugin-side copies, and stored to the cache from it if cacheKey
+// holds the key of a miss, which is then cleared.
+static void WriteCWBVH(tinybvh::BVH8_CWBVH* bvh, tinybvh::bvhvec4* nodes, tinybvh::bvhvec4* tris, uint64_t* cacheKey)
+{
+    if (bvh->bvh8Data != nullptr)
+    {
+        memcpy(nodes, bvh->bvh8Data, CWBVHNodesSize(bvh));
+        memcpy(tris, bvh->bvh8Tris, CWBVHTrisSize(bvh));
+        return;
+    }
+
+    bvh->bvh8Data = nodes;
+    bvh->bvh8Tris = tris;
+    bvh->allocatedBlocks = tinybvh::BVH8_CWBVH::NodeBlocksNeeded(bvh->bvh8);
+    bvh->ConvertFrom(bvh->bvh8, true);
+    if (cacheKey != nullptr && *cacheKey != 0)
+    {
+        StoreCachedCWBVH(bvh, *cacheKey);
+        *cacheKey = 0;
+    }
+
+    // The memory belongs to the caller, make sure the BVH never frees or reuses it.
+    bvh->bvh8Data = nullptr;
+    bvh->bvh8Tris = nullptr;
+    bvh->allocatedBlocks = 0;
+}
+
+// Pages must hold whole elements, CWBVH nodes for node pages and float4s for triangle
+// pages, so the shaders never read one across two pages.
+static bool IsValidPagedBuffer(const BVHPagedBuffer* buffer, int64_t elementSize)
+{
+    return buffer != nullptr && buffer->pages != nullptr && buffer->pageCount > 0 &&
+           buffer->pageSize > 0 && buffer->pageSize % elementSize == 0;
+}
+
+static bool FitsPagedBuffer(const BVHPagedBuffer& buffer, int64_t offset, int64_t size)
+{
+    return offset >= 0 && offset + size <= buffer.pageSize * buffer.pageCount;
+}
+
+// Address of a byte range of a paged buffer if it lies in a single page, null otherwise.
+static tinybvh::bvhvec4* PagedRange(const BVHPagedBuffer& buffer, int64_t offset, int64_t size)
+{
+    int64_t page = offset / buffer.pageSize;
+    int64_t pageOffset = offset - page * buffer.pageSize;
+    if (page >= buffer.pageCount || pageOffset + size > buffer.pageSize)
+        return nullptr;
+    return reinterpret_cast<tinybvh::bvhvec4*>(reinterpret_cast<char*>(buffer.pages[page]) + pageOffset);
+}
+
+static void CopyToPagedBuffer(const BVHPagedBuffer& buffer, int64_t offset, const void* data, int64_t size)
+{
+    const char* source = static_cast<const char*>(data);
+    while (size > 0)
+    {
+        int64_t page = offset / buffer.pageSize;
+        int64_t pageOffset = offset - page * buffer.pageSize;
+        int64_t chunk = std::min(size, buffer.pageSize - pageOffset);
+        memcpy(reinterpret_cast<char*>(buffer.pages[page]) + pageOffset, source, chunk);
+        source += chunk;
+        offset += chunk;
+        size -= chunk;
+    }
+}
+
+// Like WriteCWBVH, to byte offsets of paged buffers. Deferred BVHs whose data lies within
+// single pages are still encoded straight into them, the others go through a temporary copy.
+static void WriteCWBVHPaged(tinybvh::BVH8_CWBVH* bvh, const BVHPagedBuffer& nodes, int64_t nodesOffset,
+                            const BVHPagedBuffer& tris, int64_t trisOffset, uint64_t* cacheKey)
+{
+    int64_t nodesSize = CWBVHNodesSize(bvh);
+    int64_t trisSize = CWBVHTrisSize(bvh);
+    tinybvh::bvhvec4* nodesRange = PagedRange(nodes, nodesOffset, nodesSize);
+    tinybvh::bvhvec4* trisRange = PagedRange(tris, trisOffset, trisSize);
+    if (nodesRange != nullptr && trisRange != nullptr)
+    {
+        WriteCWBVH(bvh, nodesRange, trisRange, cacheKey);
+        return;
+    }
+
+    if (bvh->bvh8Data != nullptr)
+    {
+        CopyToPagedBuffer(nodes, nodesOffset, bvh->bvh8Data, nodesSize);
+        CopyToPagedBuffer(tris, trisOffset, bvh->bvh8Tris, trisSize);
+        return;
+    }
+
+    tinybvh::bvhvec4* nodesCopy = static_cast<tinybvh::bvhvec4*>(tinybvh::malloc64(nodesSize));
+    tinybvh::bvhvec4* trisCopy = static_cast<tinybvh::bvhvec4*>(tinybvh::malloc64(trisSize));
+    WriteCWBVH(bvh, nodesCopy, trisCopy, cacheKey);
+    CopyToPagedBuffer(nodes, nodesOffset, nodesCopy, nodesSize);
+    CopyToPagedBuffer(tris, trisOffset, trisCopy, trisSize);
+    tinybvh::free64(nodesCopy);
+    tinybvh::free64(trisCopy);
+}
+
+// Places BLASes in pages one after another, moving on to the next page whenever one doesn't
+// fit in what is left of the current page. sizes holds the node and triangle bytes of each
+// BLAS, two per BLAS like batch offsets.
+static bool LayoutPages(const std::vector<int64_t>& sizes, int64_t pageSize, BVHPageEntry* table,
+                        int64_t* nodePageSizes, int64_t* triPageSizes)
+{
+    const int64_t elementSizes[2] = { 80, 16 };
+    int64_t* pageSizes[2] = { nodePageSizes, triPageSizes };
+    size_t count = sizes.size() / 2;
+    if (pageSize < elementSizes[0] || pageSize / elementSizes[1] > INT32_MAX)
+        return false;
+
+    for (int stream = 0; stream < 2; ++stream)
+    {
+        int64_t elementSize = elementSizes[stream];
+        int64_t pageBytes = pageSize / elementSize * elementSize;
+        std::fill(pageSizes[stream], pageSizes[stream] + count, 0);
+
+        int page = 0;
+        int64_t used = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            int64_t size = sizes[i * 2 + stream];
+            if (size > pageBytes)
+                return false;
+            if (used + size > pageBytes)
+            {
+                ++page;
+                used = 0;
+            }
+
+            int offset = static_cast<int>(used / elementSize);
+            if (stream == 0)
+            {
+                table[i].nodePage = page;
+                table[i].nodeOffset = offset;
+            }
+            else
+            {
+                table[i].triPage = page;
+                table[i].triOffset = offset;
+            }
+            used += size;
+            pageSizes[stream][page] = used;
+        }
+    }
+    return true;
+}
+
+// Byte offset of an entry's element in a paged buffer.
+static int64_t PageEntryOffset(const BVHPagedBuffer& buffer, int page, int offset, int64_t elementSize)
+{
+    return page * buffer.pageSize + offset * elementSize;
+}
+
+// BVHs mapped from the cache come without the binary and 8-wide BVHs they were encoded
+// from, so they can't be refit, and neither can BVHs with spatial splits.
+static bool IsRefittable(const tinybvh::BVH8_CWBVH* bvh)
+{
+    return bvh->bvh8.bvh.bvhNode != nullptr && bvh->bvh8.mbvhNode != nullptr && bvh->bvh8.bvh.refittable;
+}
+
+// Rewrites an encoded CWBVH for moved vertices without changing its layout: the triangles
+// are read again from the vertices, and each node is quantized against its children's new
+// bounds. Children are always encoded after their parent, so one backwards pass over the
+// nodes is bottom-up. Unlike a full encode, the children keep their slots.
+static void RequantizeCWBVH(tinybvh::BVH8_CWBVH* bvh)
+{
+    const tinybvh::BVH& bvh2 = bvh->bvh8.bvh;
+    tinybvh::bvhvec4* tris = bvh->bvh8Tris;
+    auto vertexIndices = [&bvh2](const tinybvh::bvhvec4* tri, uint32_t* indices)
+    {
+        uint32_t triIdx;
+        memcpy(&triIdx, &tri[2].w, sizeof(triIdx));
+        for (uint32_t k = 0; k < 3; ++k)
+            indices[k] = bvh2.vertIdx != nullptr ? bvh2.vertIdx[triIdx * 3 + k] : triIdx * 3 + k;
+    };
+
+    const uint32_t triCount = static_cast<uint32_t>(CWBVHTrisSize(bvh) / (3 * 16));
+    for (uint32_t i = 0; i < triCount; ++i)
+    {
+        // Same layout as BVH8_CWBVH::ConvertFrom: both edges, then the first vertex, whose w
+        // keeps the triangle index.
+        tinybvh::bvhvec4* tri = &tris[i * 3];
+        uint32_t v[3];
+        vertexIndices(tri, v);
+        float w = tri[2].w;
+        tinybvh::bvhvec4 v0 = bvh2.verts[v[0]];
+        tri[0] = bvh2.verts[v[2]] - v0;
+        tri[1] = bvh2.verts[v[1]] - v0;
+        tri[2] = v0;
+        tri[2].w = w;
+    }
+
+    const uint32_t nodeCount = bvh->usedBlocks / 5;
+    std::vector<tinybvh::bvhvec3> bounds(nodeCount * 2);
+    for (uint32_t n = nodeCount; n-- > 0;)
+    {
+        tinybvh::bvhvec4* node = &bvh->bvh8Data[n * 5];
+        uint8_t* header = reinterpret_cast<uint8_t*>(&node[0].w);
+        uint32_t childBaseIndex, triangleBaseIndex;
+        memcpy(&childBaseIndex, &node[1].x, sizeof(childBaseIndex));
+        memcpy(&triangleBaseIndex, &node[1].y, sizeof(triangleBaseIndex));
+        const uint8_t* meta = reinterpret_cast<const uint8_t*>(&node[1]) + 8;
+        const uint8_t imask = header[3];
+
+        tinybvh::bvhvec3 childMin[8], childMax[8];
+        tinybvh::bvhvec3 nodeMin(BVH_FAR), nodeMax(-BVH_FAR);
+        uint32_t interiorRank = 0;
+        for (int i = 0; i < 8; ++i)
+        {
+            if (meta[i] == 0)
+                continue; // empty slot
+
+            if (imask & (1 << i))
+            {
+                // Interior children are stored next to each other in slot order.
+                uint32_t child = childBaseIndex + interiorRank++;
+                childMin[i] = bounds[child * 2];
+                childMax[i] = bounds[child * 2 + 1];
+            }
+            else
+            {
+                // Leaf children: a unary triangle count and the offset of the first one.
+                childMin[i] = tinybvh::bvhvec3(BVH_FAR);
+                childMax[i] = tinybvh::bvhvec3(-BVH_FAR);
+                uint32_t first = triangleBaseIndex + (meta[i] & 0x1F) * 3;
+                for (uint32_t bits = meta[i] >> 5; bits != 0; bits >>= 1, first += 3)
+                {
+                    uint32_t v[3];
+                    vertexIndices(&tris[first], v);
+                    for (uint32_t k = 0; k < 3; ++k)
+                    {
+                        tinybvh::bvhvec3 position = bvh2.verts[v[k]];
+                        childMin[i] = tinybvh::tinybvh_min(childMin[i], position);
+                        childMax[i] = tinybvh::tinybvh_max(childMax[i], position);
+                    }
+                }
+            }
+            nodeMin = tinybvh::tinybvh_min(nodeMin, childMin[i]);
+            nodeMax = tinybvh::tinybvh_max(nodeMax, childMax[i]);
+        }
+        bounds[n * 2] = nodeMin;
+        bounds[n * 2 + 1] = nodeMax;
+
+        // Same quantization as BVH8_CWBVH::ConvertFrom.
+        const int32_t ex = (int32_t)((int8_t)ceilf(log2f((nodeMax.x - nodeMin.x) / 255.0f)));
+        const int32_t ey = (int32_t)((int8_t)ceilf(log2f((nodeMax.y - nodeMin.y) / 255.0f)));
+        const int32_t ez = (int32_t)((int8_t)ceilf(log2f((nodeMax.z - nodeMin.z) / 255.0f)));
+        const float sx = ldexpf(1.0f, ex), sy = ldexpf(1.0f, ey), sz = ldexpf(1.0f, ez);
+        uint8_t* quantized = reinterpret_cast<uint8_t*>(&node[2]);
+        for (int i = 0; i < 8; ++i)
+        {
+            if (meta[i] == 0)
+                continue;
+            quantized[i + 0] = (uint8_t)(int32_t)floorf((childMin[i].x - nodeMin.x) / sx);
+            quantized[i + 8] = (uint8_t)(int32_t)floorf((childMin[i].y - nodeMin.y) / sy);
+            quantized[i + 16] = (uint8_t)(int32_t)floorf((childMin[i].z - nodeMin.z) / sz);
+            quantized[i + 24] = (uint8_t)(int32_t)ceilf((childMax[i].x - nodeMin.x) / sx);
+            quantized[i + 32] = (uint8_t)(int32_t)ceilf((childMax[i].y - nodeMin.y) / sy);
+            quantized[i + 40] = (uint8_t)(int32_t)ceilf((childMax[i].z - nodeMin.z) / sz);
+        }
+        node[0].x = nodeMin.x;
+        node[0].y = nodeMin.y;
+        node[0].z = nodeMin.z;
+        header[0] = (uint8_t)ex;
+        header[1] = (uint8_t)ey;
+        header[2] = (uint8_t)ez;
+    }
+    bvh->aabbMin = bounds[0];
+    bvh->aabbMax = bounds[1];
+}
+
+// Moves the BVH to new positions of the vertices it was built from. The binary BVH is refit
+// for the cost metric, and an encoded CWBVH is requantized in its own buffers. Deferred BVHs
+// are encoded from the 8-wide BVH by the next write as usual.
+static void RefitBLAS(tinybvh::BVH8_CWBVH* bvh, tinybvh::bvhvec4* vertices, int vertexCount)
+{
+    tinybvh::BVH& bvh2 = bvh->bvh8.bvh;
+    bvh2.verts = tinybvh::bvhvec4slice(vertices, vertexCount, sizeof(tinybvh::bvhvec4));
+    bvh2.Refit();
+
+    // The 8-wide BVH keeps the binary BVH's index for every node it didn't collapse, and a
+    // node covers the same triangles in both. MBVH::Refit can't be used, the CWBVH encoding
+    // spreads each node's children over all eight slots.
+    tinybvh::MBVH<8>& bvh8 = bvh->bvh8;
+    for (uint32_t i = 0; i < bvh2.usedNodes; ++i)
+    {
+        if (i == 1)
+            continue;
+        bvh8.mbvhNode[i].aabbMin = bvh2.bvhNode[i].aabbMin;
+        bvh8.mbvhNode[i].aabbMax = bvh2.bvhNode[i].aabbMax;
+    }
+    // A leaf root is moved to node 1 under an interior root for the encoding.
+    if (bvh2.bvhNode[0].isLeaf())
+        bvh8.mbvhNode[1].aabbMin = bvh2.aabbMin, bvh8.mbvhNode[1].aabbMax = bvh2.aabbMax;
+    bvh8.aabbMin = bvh2.aabbMin;
+    bvh8.aabbMax = bvh2.aabbMax;
+
+    if (bvh->bvh8Data != nullptr)
+        RequantizeCWBVH(bvh);
+}
+
+static int64_t AddBVH(BVHEntry* newEntry)
+{
+    return gBVHs.Add(newEntry);
+}
+
+static BVHEntry* GetBVHEntry(int64_t handle)
+{
+    return gBVHs.Get(handle);
+}
+
+extern "C" tinybvh::BVH8_CWBVH* GetBVH(int64_t handle)
+{
+    BVHEntry* entry = GetBVHEntry(handle);
+    if (entry != nullptr && entry->ready.load(std::memory_order_acquire))
+        return entry->bvh;
+    return nullptr;
+}
+
+extern "C" void* GetBVHPtr(int64_t handle)
+{
+    return GetBVH(handle);
+}
+
+// Rebuilds a progressive BVH at its quality on an idle worker, for GetBVHVersion to swap in.
+static void StartBVHImprovement(BVHEntry* entry, bool deferred)
+{
+    BLASGeometry geometry = entry->geometry;
+    entry->improving = true;
+    JobSystem::Get().SubmitBackground([entry, geometry, deferred]()
+    {
+        // Without a key a cache miss is encoded right away and stored, the improvement
+        // only replaces the BVH, and its key, once swapped in.
+        tinybvh::BVH8_CWBVH* bvh = new tinybvh::BVH8_CWBVH();
+        BuildBLAS(bvh, geometry, deferred, nullptr);
+        {
+            std::lock_guard<std::mutex> lock(gBuildMutex);
+            entry->improved = bvh;
+            entry->improving.store(false);
+        }
+        gBuildFinished.notify_all();
+    });
+}
+
+// Builds the entry's BVH and remembers what it needs for refits.
+static void BuildBVHEntry(BVHEntry* entry, const BLASGeometry& geometry, bool deferred, bool progressive)
+{
+    bool improve = BuildInitialBLAS(entry->bvh, geometry, deferred, progressive, &entry->cacheKey);
+    entry->geometry = geometry;
+    entry->builtCost = entry->cost = IsRefittable(entry->bvh) ? BVHCost(entry->bvh->bvh8.bvh) : 0.0f;
+    if (improve)
+        StartBVHImprovement(entry, deferred);
+}
+
+// The settings a build starts with stay with the BVH, for its improvement and rebuilds.
+static BLASGeometry WithBuildSettings(BLASGeometry geometry)
+{
+    geometry.lean = gLeanBuilds;
+    geometry.compressTris = gCompressedTris;
+    return geometry;
+}
+
+// Start time of a call for SceneCapture::Record, 0 while no capture is active.
+static int64_t CaptureStartTime()
+{
+    return SceneCapture::Get().IsActive() ? SceneCapture::Now() : 0;
+}
+
+// Records a BLAS build or refit if a capture is active: the vertices the BVH reads and, if it
+// is indexed, its indices.
+static void CaptureBLAS(CaptureRecordType type, const BLASGeometry& geometry, int64_t startTime, int64_t handle)
+{
+    SceneCapture& capture = SceneCapture::Get();
+    if (!capture.IsActive())
+        return;
+
+    CaptureArray arrays[2] =
+    {
+        { geometry.vertices, static_cast<uint64_t>(geometry.vertexCount) * sizeof(tinybvh::bvhvec4) },
+        { geometry.indices, static_cast<uint64_t>(geometry.triangleCount) * 3 * sizeof(uint32_t) },
+    };
+    capture.Record(type, geometry.triangleCount, geometry.quality, startTime, handle, arrays, geometry.indices != nullptr ? 2 : 1);
+}
+
+static int64_t BuildBVHNow(const BLASGeometry& buildGeometry)
+{
+    BLASGeometry geometry = WithBuildSettings(buildGeometry);
+    BVHEntry* entry = new BVHEntry();
+    entry->bvh = new tinybvh::BVH8_CWBVH();
+    BuildBVHEntry(entry, geometry, false, IsProgressive(geometry));
+    entry->ready = true;
+    return AddBVH(entry);
+}
+
+extern "C" int64_t BuildBVH(tinybvh::bvhvec4* vertices, int triangleCount, int quality)
+{
+    int64_t startTime = CaptureStartTime();
+    BLASGeometry geometry = SoupGeometry(vertices, triangleCount, quality);
+    int64_t handle = BuildBVHNow(geometry);
+    CaptureBLAS(CAPTURE_BUILD_BVH, geometry, startTime, handle);
+    return handle;
+}
+
+extern "C" int64_t BuildBVHIndexed(tinybvh::bvhvec4* vertices, int vertexCount, const uint32_t* indices, int triangleCount, int quality)
+{
+    int64_t startTime = CaptureStartTime();
+    BLASGeometry geometry = { vertices, vertexCount, indices, triangleCount, quality };
+    int64_t handle = BuildBVHNow(geometry);
+    CaptureBLAS(CAPTURE_BUILD_BVH_INDEXED, geometry, startTime, handle);
+    return handle;
+}
+
+static int64_t StartBVHBuild(CaptureRecordType captureType, const BLASGeometry& buildGeometry, bool deferBuild)
+{
+    int64_t startTime = CaptureStartTime();
+    BLASGeometry geometry = WithBuildSettings(buildGeometry);
+    // Lean BVHs are encoded right away, the CWBVH takes less memory than the BVHs it is
+    // encoded from. Compressed triangles are only written by the build.
+    bool deferred = deferBuild && !geometry.lean && !geometry.compressTris;
+    BVHEntry* entry = new BVHEntry();
+    entry->bvh = new tinybvh::BVH8_CWBVH();
+    int64_t handle = AddBVH(entry);
+    bool progressive = IsProgressive(geometry);
+
+    gPendingBuilds++;
+    JobSystem::Get().Submit([entry, geometry, deferred, progressive]()
+    {
+        BuildBVHEntry(entry, geometry, deferred, progressive);
+        {
+            std::lock_guard<std::mutex> lock(gBuildMutex);
+            entry->ready.store(true, std::memory_order_release);
+            gPendingBuilds--;
+        }
+        gBuildFinished.notify_all();
+    });
+
+    // Recorded as queued, the build itself runs on in the background.
+    CaptureBLAS(captureType, buildGeometry, startTime, handle);
+    return handle;
+}
+
+extern "C" int64_t BuildBVHAsync(tinybvh::bvhvec4* vertices, int triangleCount, int quality)
+{
+    return StartBVHBuild(CAPTURE_BUILD_BVH_ASYNC, SoupGeometry(vertices, triangleCount, quality), false);
+}
 
-static std::deque<tinybvh::BVH8_CWBVH*> gBVHList;
-static std::deque<tinybvh::BVH_GPU*> gTLASList;
+extern "C" int64_t BuildBVHDeferred(tinybvh::bvhvec4* vertices, int triangleCount, int quality)
+{
+    return StartBVHBuild(CAPTURE_BUILD_BVH_DEFERRED, SoupGeometry(vertices, triangleCount, quality), true);
+}
+
+extern "C" int64_t BuildBVHIndexedDeferred(tinybvh::bvhvec4* vertices, int vertexCount, const uint32_t* indices, int triangleCount, int quality)
+{
+    return StartBVHBuild(CAPTURE_BUILD_BVH_INDEXED_DEFERRED, { vertices, vertexCount, indices, triangleCount, quality }, true);
+}
+
+extern "C" void SetBVHOptimizeSettings(int iterations, bool extreme)
+{
+    gOptimizeIterations = iterations;
+    gOptimizeExtreme = extreme;
+}
+
+extern "C" void SetBVHProgressiveBuilds(bool enabled)
+{
+    gProgressiveBuilds = enabled;
+}
+
+extern "C" void SetBVHLeanBuilds(bool enabled)
+{
+    gLeanBuilds = enabled;
+}
+
+extern "C" void SetBVHCompressedTris(bool enabled)
+{
+    gCompressedTris = enabled;
+}
+
+static void WaitForEntry(BVHEntry* entry)
+{
+    std::unique_lock<std::mutex> lock(gBuildMutex);
+    gBuildFinished.wait(lock, [entry] { return entry->ready.load(); });
+}
+
+static void WaitForImprovement(BVHEntry* entry)
+{
+    std::unique_lock<std::mutex> lock(gBuildMutex);
+    gBuildFinished.wait(lock, [entry] { return !entry->improving.load(); });
+}
+
+extern "C" void WaitForBVH(int64_t handle)
+{
+    BVHEntry* entry = GetBVHEntry(handle);
+    if (entry != nullptr)
+        WaitForEntry(entry);
+}
+
+extern "C" int GetPendingBVHCount()
+{
+    return gPendingBuilds.load();
+}
+
+extern "C" void SetWorkerCount(int count)
+{
+    {
+        std::unique_lock<std::mutex> lock(gBuildMutex);
+        gBuildFinished.wait(lock, [] { return gPendingBuilds.load() == 0; });
+    }
+    JobSystem::Get().SetWorkerCount(count);
+}
+
+extern "C" int GetWorkerCount()
+{
+    return JobSystem::Get().GetWorkerCount();
+}
+
+extern "C" int GetSimdLevel()
+{
+    return gSimdLevel.load();
+}
+
+extern "C" void SetSimdLevel(int level)
+{
+    gSimdLevel = level < gSupportedSimdLevel ? level : gSupportedSimdLevel;
+}
+
+extern "C" void SetBVHCacheDirectory(const char* path, int maxSizeMB)
+{
+    BVHCache::Get().SetDirectory(path, static_cast<int64_t>(maxSizeMB) * 1024 * 1024);
+}
+
+extern "C" bool StartSceneCapture(const char* path)
+{
+    return SceneCapture::Get().Start(path);
+}
+
+extern "C" void StopSceneCapture()
+{
+    SceneCapture::Get().Stop();
+}
+
+extern "C" void GetBuildArenaUsage(int64_t* used, int64_t* peak, int64_t* reserved)
+{
+    BuildArena::Get().GetUsage(used, peak, reserved);
+}
+
+extern "C" int64_t TrimBuildArena()
+{
+    return BuildArena::Get().Trim();
+}
+
+extern "C" void DestroyBVH(int64_t handle) 
+{
+    if (SceneCapture::Get().IsActive())
+        SceneCapture::Get().RecordDestroy(CAPTURE_DESTROY_BVH, handle);
+    BVHEntry* entry = gBVHs.Remove(handle);
+    if (entry != nullptr)
+    {
+        // A worker may still be writing to the BVH, or building its improvement.
+        WaitForEntry(entry);
+        WaitForImprovement(entry);
+        delete entry->bvh;
+        delete entry->improved;
+        delete entry;
+    }
+}
+
+static bool RefitBVHEntry(BVHEntry* entry, tinybvh::bvhvec4* vertices)
+{
+    {
+        std::lock_guard<std::mutex> lock(gBuildMutex);
+        if (entry->improving || entry->improved != nullptr)
+            entry->discardImprovement = true;
+    }
+
+    // Compressed triangles would have to be compressed again as well.
+    if (!IsRefittable(entry->bvh) || entry->geometry.compressTris)
+    {
+        // Deforming geometry isn't worth caching, rebuild it without the cache. SBVHs are
+        // rebuilt at the quality they were built with.
+        BLASGeometry geometry = entry->geometry;
+        geometry.vertices = vertices;
+        delete entry->bvh;
+        entry->bvh = new tinybvh::BVH8_CWBVH();
+        entry->cacheKey = 0;
+        BuildCWBVH(entry->bvh, geometry);
+        entry->geometry = geometry;
+        entry->builtCost = entry->cost = IsRefittable(entry->bvh) ? BVHCost(entry->bvh->bvh8.bvh) : 0.0f;
+        ++entry->generation;
+        return true;
+    }
+
+    RefitBLAS(entry->bvh, vertices, entry->geometry.vertexCount);
+    // The key was of the vertices the BVH no longer fits.
+    entry->cacheKey = 0;
+    entry->geometry.vertices = vertices;
+    entry->cost = BVHCost(entry->bvh->bvh8.bvh);
+    ++entry->generation;
+    return false;
+}
+
+extern "C" bool RefitBVH(int64_t handle, tinybvh::bvhvec4* vertices)
+{
+    BVHEntry* entry = GetBVHEntry(handle);
+    if (GetBVH(handle) == nullptr)
+        return false;
+
+    int64_t startTime = CaptureStartTime();
+    bool rebuilt = RefitBVHEntry(entry, vertices);
+    CaptureBLAS(CAPTURE_REFIT_BVH, entry->geometry, startTime, handle);
+    return rebuilt;
+}
+
+extern "C" float GetBVHCostRatio(int64_t handle)
+{
+    BVHEntry* entry = GetBVHEntry(handle);
+    if (GetBVH(handle) == nullptr || entry->builtCost <= 0.0f)
+        return 0.0f;
+    return entry->cost / entry->builtCost;
+}
+
+extern "C" int GetBVHVersion(int64_t handle)
+{
+    BVHEntry* entry = GetBVHEntry(handle);
+    if (GetBVH(handle) == nullptr)
+        return 0;
+
+    tinybvh::BVH8_CWBVH* improved = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(gBuildMutex);
+        std::swap(improved, entry->improved);
+    }
+    if (improved == nullptr)
+        return entry->version;
+
+    if (entry->discardImprovement)
+    {
+        entry->discardImprovement = false;
+        delete improved;
+        return entry->version;
+    }
+
+    delete entry->bvh;
+    entry->bvh = improved;
+    entry->cacheKey = 0;
+    entry->builtCost = entry->cost = IsRefittable(improved) ? BVHCost(improved->bvh8.bvh) : 0.0f;
+    ++entry->generation;
+    return ++entry->version;
+}
+
+extern "C" bool IsBVHImproving(int64_t handle)
+{
+    BVHEntry* entry = GetBVHEntry(handle);
+    if (GetBVH(handle) == nullptr)
+        return false;
+
+    std::lock_guard<std::mutex> lock(gBuildMutex);
+    return entry->improving.load() || entry->improved != nullptr;
+}
+
+extern "C" bool IsBVHReady(int64_t handle)
+{
+    tinybvh::BVH8_CWBVH* bvh = GetBVH(handle);
+    return (bvh != nullptr);
+}
+
+// Rays per query job. A job of exactly this many coherent rays is traced as one packet.
+static const int kRayPacketSize = 256;
+
+// Totals over all ray queries since the last ResetRayQueryStats.
+static std::atomic<int64_t> gQueriedRays { 0 };
+static std::atomic<int64_t> gPacketRays { 0 };
+static std::atomic<int64_t> gQueryNanoseconds { 0 };
+
+// The binary BVH a BLAS was encoded from, which ray queries traverse. Null for BVHs that
+// don't keep it: lean BVHs and BVHs mapped from the cache.
+static tinybvh::BVH* QueryBVH(int64_t handle)
+{
+    tinybvh::BVH8_CWBVH* bvh = GetBVH(handle);
+    if (bvh == nullptr || bvh->bvh8.bvh.bvhNode == nullptr)
+        return nullptr;
+    return &bvh->bvh8.bvh;
+}
+
+// The encoded CWBVH of a BLAS and whether its triangles are compressed, for queries on BVHs
+// without a binary BVH. Null while a deferred BVH isn't encoded.
+static const tinybvh::BVH8_CWBVH* QueryCWBVH(int64_t handle, bool* compressedTris)
+{
+    tinybvh::BVH8_CWBVH* bvh = GetBVH(handle);
+    if (bvh == nullptr || bvh->bvh8Data == nullptr)
+        return nullptr;
+    *compressedTris = GetBVHEntry(handle)->geometry.compressTris;
+    return bvh;
+}
+
+// CWBVH traversal uses SSE2 where it is compiled in, unless SetSimdLevel asked for scalar
+// code on a CPU that has more.
+static bool UseSimdTraversal()
+{
+    return gSupportedSimdLevel == SIMD_SCALAR || gSimdLevel.load() > SIMD_SCALAR;
+}
+
+// tinybvh stops the process on rays with NaNs, and a zero direction normalizes to NaNs.
+static bool IsValidRay(const BVHRay& ray)
+{
+    const tinybvh::bvhvec3& o = ray.origin;
+    const tinybvh::bvhvec3& d = ray.direction;
+    return std::isfinite(o.x + o.y + o.z) && std::isfinite(d.x + d.y + d.z) && !std::isnan(ray.tMax)
+        && (d.x != 0.0f || d.y != 0.0f || d.z != 0.0f);
+}
+
+// Intersect256Rays bounds a packet by the planes through its shared origin and its corner
+// rays 0, 51, 204 and 255, and skips every node outside them. That is only exact if all rays
+// start at the origin and stay within the planes, such as a 16x16 tile of camera rays in
+// tinybvh's order of 4x4 blocks of 4x4 rays.
+static bool IsCoherentPacket(const tinybvh::Ray* packet)
+{
+    const tinybvh::bvhvec3 origin = packet[0].O;
+    const tinybvh::bvhvec3 p0 = origin + packet[0].D;
+    const tinybvh::bvhvec3 p1 = origin + packet[51].D;
+    const tinybvh::bvhvec3 p2 = origin + packet[204].D;
+    const tinybvh::bvhvec3 p3 = origin + packet[255].D;
+    const tinybvh::bvhvec3 planes[4] =
+    {
+        tinybvh::tinybvh_normalize(tinybvh::tinybvh_cross(p0 - origin, p0 - p2)),
+        tinybvh::tinybvh_normalize(tinybvh::tinybvh_cross(p3 - origin, p3 - p1)),
+        tinybvh::tinybvh_normalize(tinybvh::tinybvh_cross(p1 - origin, p1 - p0)),
+        tinybvh::tinybvh_normalize(tinybvh::tinybvh_cross(p2 - origin, p2 - p3)),
+    };
+    // The corner rays themselves lie on the planes up to rounding.
+    const float epsilon = 1e-5f * (tinybvh::tinybvh_length(origin) + 1.0f);
+    for (int i = 0; i < kRayPacketSize; ++i)
+    {
+        const tinybvh::Ray& ray = packet[i];
+        if (ray.O.x != origin.x || ray.O.y != origin.y || ray.O.z != origin.z)
+            return false;
+        const tinybvh::bvhvec3 p = origin + ray.D;
+        for (const tinybvh::bvhvec3& plane : planes)
+        {
+            // Degenerate planes normalize to zero and cull nothing, so any ray passes them.
+            if (tinybvh::tinybvh_dot(p - origin, plane) > epsilon)
+                return false;
+        }
+    }
+    return true;
+}
+
+// Traces up to kRayPacketSize rays, filling hits, or occluded if hits is null. Returns the
+// number of rays that hit something.
+static int TraceRayBlock(const tinybvh::BVH& bvh, const BVHRay* rays, int count, BVHHit* hits, uint8_t* occluded)
+{
+    // Too large for the small stacks of some worker threads.
+    static thread_local std::vector<tinybvh::Ray> tPacket(kRayPacketSize);
+    tinybvh::Ray* packet = tPacket.data();
+
+    bool valid = true;
+    for (int i = 0; i < count; ++i)
+    {
+        if (IsValidRay(rays[i]))
+            packet[i] = tinybvh::Ray(rays[i].origin, rays[i].direction, rays[i].tMax);
+        else
+            valid = false;
+    }
+
+    // The packet traversal reads triangles as soups.
+    bool coherent = count == kRayPacketSize && valid && !bvh.isIndexed() && IsCoherentPacket(packet);
+    if (coherent)
+    {
+        bvh.Intersect256Rays(packet);
+        gPacketRays.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    int hitCount = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        tinybvh::Ray& ray = packet[i];
+        bool hit = false;
+        if (coherent || IsValidRay(rays[i]))
+        {
+            if (hits == nullptr)
+                hit = coherent ? ray.hit.t < rays[i].tMax : bvh.IsOccluded(ray);
+            else
+            {
+                if (!coherent)
+                    bvh.Intersect(ray);
+                hit = ray.hit.t < rays[i].tMax;
+            }
+        }
+
+        if (hits != nullptr)
+            hits[i] = hit ? BVHHit { ray.hit.t, ray.hit.u, ray.hit.v, ray.hit.prim } : BVHHit { rays[i].tMax, 0.0f, 0.0f, BVH_NO_HIT };
+        else
+            occluded[i] = hit ? 1 : 0;
+        hitCount += hit ? 1 : 0;
+    }
+    return hitCount;
+}
+
+// Traces count rays in blocks of kRayPacketSize across the worker pool and adds them to the
+// query stats. traceBlock traces the block of rays starting at first and returns how many hit.
+static int RunRayQuery(int count, const std::function<int(int first, int blockSize)>& traceBlock)
+{
+    auto start = std::chrono::steady_clock::now();
+    std::atomic<int> hitCount { 0 };
+    int blockCount = (count + kRayPacketSize - 1) / kRayPacketSize;
+    JobSystem::Get().ParallelFor(blockCount, [&](int block)
+    {
+        int first = block * kRayPacketSize;
+        int blockHits = traceBlock(first, std::min(kRayPacketSize, count - first));
+        hitCount.fetch_add(blockHits, std::memory_order_relaxed);
+    });
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    gQueriedRays.fetch_add(count, std::memory_order_relaxed);
+    gQueryNanoseconds.fetch_add(elapsed.count(), std::memory_order_relaxed);
+    return hitCount.load();
+}
+
+// Traces rays through an encoded CWBVH, like TraceRayBlock. Query rays are normalized and
+// count hits past 0 like the binary BVH's, shader rays are traced as given like bvh.hlsl does,
+// which ignores hits closer than 0.0001. steps gets the traversal steps of each ray if not null.
+static int TraceCWBVHRayBlock(const tinybvh::BVH8_CWBVH& bvh, bool compressedTris, bool shaderRays, const BVHRay* rays,
+                              int count, BVHHit* hits, uint8_t* occluded, uint32_t* steps)
+{
+    bool simd = UseSimdTraversal();
+    int hitCount = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        CWBVHHit hit = { rays[i].tMax, 0.0f, 0.0f, BVH_NO_HIT, 0, 0 };
+        bool found = false;
+        if (IsValidRay(rays[i]))
+        {
+            tinybvh::bvhvec3 direction = shaderRays ? rays[i].direction : tinybvh::tinybvh_normalize(rays[i].direction);
+            CWBVHRay ray = { rays[i].origin, direction, shaderRays ? 0.0001f : 0.0f };
+            found = IntersectCWBVH(bvh.bvh8Data, bvh.bvh8Tris, compressedTris, ray, hit, hits == nullptr, simd);
+        }
+
+        if (hits != nullptr)
+            hits[i] = found ? BVHHit { hit.distance, hit.u, hit.v, hit.triIndex } : BVHHit { rays[i].tMax, 0.0f, 0.0f, BVH_NO_HIT };
+        else
+            occluded[i] = found ? 1 : 0;
+        if (steps != nullptr)
+            steps[i] = hit.steps;
+        hitCount += found ? 1 : 0;
+    }
+    return hitCount;
+}
+
+static int TraceRays(int64_t handle, const BVHRay* rays, int count, BVHHit* hits, uint8_t* occluded)
+{
+    if (count < 0)
+        return -1;
+
+    const tinybvh::BVH* bvh = QueryBVH(handle);
+    if (bvh != nullptr)
+    {
+        return RunRayQuery(count, [&](int first, int blockSize)
+        {
+            return TraceRayBlock(*bvh, rays + first, blockSize, hits != nullptr ? hits + first : nullptr,
+                                 hits != nullptr ? nullptr : occluded + first);
+        });
+    }
+
+    bool compressedTris = false;
+    const tinybvh::BVH8_CWBVH* cwbvh = QueryCWBVH(handle, &compressedTris);
+    if (cwbvh == nullptr)
+        return -1;
+
+    return RunRayQuery(count, [&](int first, int blockSize)
+    {
+        return TraceCWBVHRayBlock(*cwbvh, compressedTris, false, rays + first, blockSize, hits != nullptr ? hits + first : nullptr,
+                                  hits != nullptr ? nullptr : occluded + first, nullptr);
+    });
+}
+
+extern "C" int IntersectRays(int64_t handle, const BVHRay* rays, int count, BVHHit* hits)
+{
+    return TraceRays(handle, rays, count, hits, nullptr);
+}
+
+extern "C" int IsOccludedRays(int64_t handle, const BVHRay* rays, int count, uint8_t* occluded)
+{
+    return TraceRays(handle, rays, count, nullptr, occluded);
+}
+
+extern "C" int IntersectCWBVHRays(int64_t handle, const BVHRay* rays, int count, BVHHit* hits, uint32_t* steps)
+{
+    bool compressedTris = false;
+    const tinybvh::BVH8_CWBVH* cwbvh = QueryCWBVH(handle, &compressedTris);
+    if (cwbvh == nullptr || count < 0)
+        return -1;
+
+    return RunRayQuery(count, [&](int first, int blockSize)
+    {
+        return TraceCWBVHRayBlock(*cwbvh, compressedTris, true, rays + first, blockSize, hits + first, nullptr,
+                                  steps != nullptr ? steps + first : nullptr);
+    });
+}
+
+extern "C" void GetRayQueryStats(int64_t* rays, int64_t* packetRays, double* seconds)
+{
+    if (rays != nullptr)
+        *rays = gQueriedRays.load(std::memory_order_relaxed);
+    if (packetRays != nullptr)
+        *packetRays = gPacketRays.load(std::memory_order_relaxed);
+    if (seconds != nullptr)
+        *seconds = gQueryNanoseconds.load(std::memory_order_relaxed) * 1e-9;
+}
+
+extern "C" void ResetRayQueryStats()
+{
+    gQueriedRays = 0;
+    gPacketRays = 0;
+    gQueryNanoseconds = 0;
+}
+
+extern "C" int64_t GetCWBVHNodesSize(int64_t handle)
+{
+    tinybvh::BVH8_CWBVH* bvh = GetBVH(handle);
+    return bvh != nullptr ? CWBVHNodesSize(bvh) : 0;
+}
+
+extern "C" int64_t GetCWBVHTrisSize(int64_t handle) 
+{
+    tinybvh::BVH8_CWBVH* bvh = GetBVH(handle);
+    return bvh != nullptr ? CWBVHTrisSize(bvh) : 0;
+}
+
+extern "C" bool GetCWBVHData(int64_t handle, tinybvh::bvhvec4** bvhNodes, tinybvh::bvhvec4** bvhTris) 
+{
+    tinybvh::BVH8_CWBVH* bvh = GetBVH(handle);
+    if (bvh == nullptr)
+        return false;
+
+    if (bvh->bvh8Data != nullptr && bvh->bvh8Tris != nullptr)
+    {
+        *bvhNodes = bvh->bvh8Data;
+        *bvhTris  = bvh->bvh8Tris;
+        return true;
+    }
+
+    return false;
+}
+
+extern "C" int64_t DecodeCWBVHTris(int64_t handle, tinybvh::bvhvec4* tris, int64_t capacity)
+{
+    tinybvh::BVH8_CWBVH* bvh = GetBVH(handle);
+    if (bvh == nullptr || bvh->bvh8Data == nullptr)
+        return 0;
+
+    BVHEntry* entry = GetBVHEntry(handle);
+    const uint32_t nodeCount = bvh->usedBlocks / 5;
+    int64_t size = 0;
+    for (uint32_t n = 0; n < nodeCount; ++n)
+    {
+        uint32_t count;
+        uint32_t triBase = NodeTriangles(&bvh->bvh8Data[n * 5], &count);
+        if (size + count * 3 * 16 <= capacity)
+        {
+            tinybvh::bvhvec4* decoded = tris + size / 16;
+            for (uint32_t t = 0; t < count; ++t)
+            {
+                if (entry->geometry.compressTris)
+                {
+                    tinybvh::bvhvec3 e1, e2;
+                    LoadCWBVHTriangle(bvh->bvh8Tris, true, triBase, t, decoded[t * 3 + 2], e1, e2);
+                    decoded[t * 3 + 1] = tinybvh::bvhvec4(e1, 0.0f);
+                    decoded[t * 3 + 0] = tinybvh::bvhvec4(e2, 0.0f);
+                }
+                else
+                    memcpy(&decoded[t * 3], &bvh->bvh8Tris[triBase + t * 3], 3 * 16);
+            }
+        }
+        size += count * 3 * 16;
+    }
+    return size;
+}
+
+extern "C" bool WriteCWBVHData(int64_t handle, tinybvh::bvhvec4* bvhNodes, int64_t nodesCapacity, tinybvh::bvhvec4* bvhTris, int64_t trisCapacity)
+{
+    tinybvh::BVH8_CWBVH* bvh = GetBVH(handle);
+    if (bvh == nullptr || CWBVHNodesSize(bvh) > nodesCapacity || CWBVHTrisSize(bvh) > trisCapacity)
+        return false;
+
+    WriteCWBVH(bvh, bvhNodes, bvhTris, &GetBVHEntry(handle)->cacheKey);
+    return true;
+}
+
+extern "C" bool WriteCWBVHDataPaged(int64_t handle, const BVHPagedBuffer* nodes, int64_t nodesOffset, const BVHPagedBuffer* tris, int64_t trisOffset)
+{
+    tinybvh::BVH8_CWBVH* bvh = GetBVH(handle);
+    if (bvh == nullptr || !IsValidPagedBuffer(nodes, 80) || !IsValidPagedBuffer(tris, 16) ||
+        !FitsPagedBuffer(*nodes, nodesOffset, CWBVHNodesSize(bvh)) || !FitsPagedBuffer(*tris, trisOffset, CWBVHTrisSize(bvh)))
+        return false;
+
+    WriteCWBVHPaged(bvh, *nodes, nodesOffset, *tris, trisOffset, &GetBVHEntry(handle)->cacheKey);
+    return true;
+}
+
+extern "C" bool LayoutBVHPages(const int64_t* handles, int count, int64_t pageSize, BVHPageEntry* table,
+                               int64_t* nodePageSizes, int64_t* triPageSizes)
+{
+    std::vector<int64_t> sizes(count * 2);
+    for (int i = 0; i < count; ++i)
+    {
+        tinybvh::BVH8_CWBVH* bvh = GetBVH(handles[i]);
+        if (bvh == nullptr)
+            return false;
+        sizes[i * 2 + 0] = CWBVHNodesSize(bvh);
+        sizes[i * 2 + 1] = CWBVHTrisSize(bvh);
+    }
+    return LayoutPages(sizes, pageSize, table, nodePageSizes, triPageSizes);
+}
+
+static int64_t AddBatch(BVHBatch* newBatch)
+{
+    return gBatches.Add(newBatch);
+}
+
+static BVHBatch* GetBatch(int64_t handle)
+{
+    return gBatches.Get(handle);
+}
+
+// Lays out every BVH of the batch back to back, then copies them into the arenas and frees
+// them unless the batch is deferred or still improving. Runs on the worker that finished
+// the last build, and again whenever improved BVHs are swapped in.
+static void PackBVHBatch(BVHBatch* batch)
+{
+    size_t meshCount = batch->bvhs.size();
+    batch->offsets.resize(meshCount * 2);
+
+    int64_t nodesSize = 0;
+    int64_t trisSize = 0;
+    for (size_t i = 0; i < meshCount; ++i)
+    {
+        tinybvh::BVH8_CWBVH* bvh = batch->bvhs[i];
+        batch->offsets[i * 2 + 0] = nodesSize;
+        batch->offsets[i * 2 + 1] = trisSize;
+        if (bvh != nullptr)
+        {
+            nodesSize += CWBVHNodesSize(bvh);
+            trisSize += CWBVHTrisSize(bvh);
+        }
+    }
+
+    batch->nodesSize = nodesSize;
+    batch->trisSize = trisSize;
+    if (batch->deferred)
+        return;
+
+    batch->nodes = static_cast<tinybvh::bvhvec4*>(tinybvh::malloc64(nodesSize));
+    batch->tris = static_cast<tinybvh::bvhvec4*>(tinybvh::malloc64(trisSize));
+
+    for (size_t i = 0; i < meshCount; ++i)
+    {
+        tinybvh::BVH8_CWBVH* bvh = batch->bvhs[i];
+        if (bvh == nullptr)
+            continue;
+
+        char* nodes = reinterpret_cast<char*>(batch->nodes) + batch->offsets[i * 2 + 0];
+        char* tris = reinterpret_cast<char*>(batch->tris) + batch->offsets[i * 2 + 1];
+        WriteCWBVH(bvh, reinterpret_cast<tinybvh::bvhvec4*>(nodes), reinterpret_cast<tinybvh::bvhvec4*>(tris), nullptr);
+
+        if (batch->unpublished > 0)
+            continue;
+        delete bvh;
+        batch->bvhs[i] = nullptr;
+    }
+}
+
+// Rebuilds the meshes of a progressive batch at their quality on idle workers, for
+// GetBVHBatchVersion to swap in.
+static void StartBatchImprovements(BVHBatch* batch)
+{
+    for (size_t i = 0; i < batch->improve.size(); ++i)
+    {
+        if (!batch->improve[i])
+            continue;
+
+        int mesh = static_cast<int>(i);
+        JobSystem::Get().SubmitBackground([batch, mesh]()
+        {
+            tinybvh::BVH8_CWBVH* bvh = new tinybvh::BVH8_CWBVH();
+            BuildBLAS(bvh, batch->meshes[mesh], batch->deferred, nullptr);
+            {
+                std::lock_guard<std::mutex> lock(gBuildMutex);
+                batch->improved.emplace_back(mesh, bvh);
+                batch->improving--;
+            }
+            gBuildFinished.notify_all();
+        });
+    }
+}
 
-static int AddBVH(tinybvh::BVH8_CWBVH* newBVH)
+static int64_t StartBVHBatch(std::vector<BLASGeometry> meshes, bool deferred)
 {
-    for (size_t i = 0; i < gBVHList.size(); ++i) 
+    int meshCount = static_cast<int>(meshes.size());
+    for (BLASGeometry& mesh : meshes)
+        mesh = WithBuildSettings(mesh);
+
+    BVHBatch* batch = new BVHBatch();
+    batch->bvhs.resize(meshCount, nullptr);
+    batch->cacheKeys.resize(meshCount, 0);
+    batch->meshes = meshes;
+    batch->improve.resize(meshCount, 0);
+    // Lean meshes and compressed triangles are encoded as they are built, so the batch is
+    // packed like any other.
+    batch->deferred = deferred && !gLeanBuilds && !gCompressedTris;
+    batch->remaining = meshCount + 1;
+    int64_t handle = AddBatch(batch);
+
+    // One count per mesh plus one for this function, so the batch can't be packed while
+    // jobs are still being queued. Whoever drops it to zero packs the batch.
+    auto finishMesh = [batch]()
+    {
+        if (batch->remaining.fetch_sub(1) != 1)
+            return;
+
+        for (uint8_t improve : batch->improve)
+            batch->unpublished += improve;
+        batch->improving = batch->unpublished;
+        PackBVHBatch(batch);
+        // Queued before the batch is ready, a waiting thread may destroy it right after.
+        StartBatchImprovements(batch);
+        {
+            std::lock_guard<std::mutex> lock(gBuildMutex);
+            batch->ready.store(true, std::memory_order_release);
+            gPendingBuilds--;
+        }
+        gBuildFinished.notify_all();
+    };
+
+    gPendingBuilds++;
+    for (int i = 0; i < meshCount; ++i)
     {
-        if (gBVHList[i] == nullptr) 
+        if (meshes[i].triangleCount <= 0)
         {
-            gBVHList[i] = newBVH;
-            return static_cast<int>(i);
+            finishMesh();
+            continue;
         }
+
+        BLASGeometry geometry = meshes[i];
+        bool progressive = IsProgressive(geometry);
+        JobSystem::Get().Submit([batch, i, geometry, progressive, finishMesh]()
+        {
+            tinybvh::BVH8_CWBVH* bvh = new tinybvh::BVH8_CWBVH();
+            batch->improve[i] = BuildInitialBLAS(bvh, geometry, batch->deferred, progressive, &batch->cacheKeys[i]);
+            batch->bvhs[i] = bvh;
+            finishMesh();
+        });
     }
+    finishMesh();
 
-    gBVHList.push_back(newBVH);
-    return static_cast<int>(gBVHList.size() - 1);
+    return handle;
 }
 
-extern "C" tinybvh::BVH8_CWBVH* GetBVH(int index)
+// Batches take one quality per mesh, or null to build every mesh with the default.
+static int MeshQuality(const int* qualities, int mesh)
 {
-    if (index >= 0 && index < static_cast<int>(gBVHList.size())) 
-        return gBVHList[index];
-    return nullptr;
+    return qualities != nullptr ? qualities[mesh] : BVH_QUALITY_BINNED;
+}
+
+static std::vector<BLASGeometry> SoupBatch(tinybvh::bvhvec4* vertices, const int* meshOffsets, const int* triCounts,
+                                           const int* qualities, int meshCount)
+{
+    std::vector<BLASGeometry> meshes(meshCount);
+    for (int i = 0; i < meshCount; ++i)
+        meshes[i] = SoupGeometry(vertices + meshOffsets[i], triCounts[i], MeshQuality(qualities, i));
+    return meshes;
+}
+
+// Records a batch build if a capture is active. The vertex and index arrays are recorded from
+// their start to the end of the last mesh in them.
+static void CaptureBatch(CaptureRecordType type, const std::vector<BLASGeometry>& meshes, const tinybvh::bvhvec4* vertices,
+                         const int* vertexOffsets, const int* vertexCounts, const uint32_t* indices, const int* indexOffsets,
+                         const int* triCounts, const int* qualities, int64_t startTime, int64_t handle)
+{
+    SceneCapture& capture = SceneCapture::Get();
+    if (!capture.IsActive())
+        return;
+
+    int meshCount = static_cast<int>(meshes.size());
+    int64_t vertexCount = 0;
+    int64_t indexCount = 0;
+    for (const BLASGeometry& mesh : meshes)
+    {
+        if (mesh.triangleCount <= 0)
+            continue;
+        vertexCount = std::max(vertexCount, static_cast<int64_t>(mesh.vertices - vertices) + mesh.vertexCount);
+        if (mesh.indices != nullptr)
+            indexCount = std::max(indexCount, static_cast<int64_t>(mesh.indices - indices) + mesh.triangleCount * 3);
+    }
+
+    uint64_t offsetsSize = static_cast<uint64_t>(meshCount) * sizeof(int);
+    CaptureArray vertexArray = { vertices, static_cast<uint64_t>(vertexCount) * sizeof(tinybvh::bvhvec4) };
+    CaptureArray qualityArray = { qualities, offsetsSize };
+    if (indices == nullptr)
+    {
+        CaptureArray arrays[4] = { vertexArray, { vertexOffsets, offsetsSize }, { triCounts, offsetsSize }, qualityArray };
+        capture.Record(type, meshCount, 0, startTime, handle, arrays, 4);
+        return;
+    }
+
+    CaptureArray arrays[7] =
+    {
+        vertexArray, { vertexOffsets, offsetsSize }, { vertexCounts, offsetsSize },
+        { indices, static_cast<uint64_t>(indexCount) * sizeof(uint32_t) }, { indexOffsets, offsetsSize },
+        { triCounts, offsetsSize }, qualityArray,
+    };
+    capture.Record(type, meshCount, 0, startTime, handle, arrays, 7);
+}
+
+extern "C" int64_t BuildBVHBatch(tinybvh::bvhvec4* vertices, const int* meshOffsets, const int* triCounts, const int* qualities, int meshCount)
+{
+    int64_t startTime = CaptureStartTime();
+    std::vector<BLASGeometry> meshes = SoupBatch(vertices, meshOffsets, triCounts, qualities, meshCount);
+    int64_t handle = StartBVHBatch(meshes, false);
+    CaptureBatch(CAPTURE_BUILD_BVH_BATCH, meshes, vertices, meshOffsets, nullptr, nullptr, nullptr, triCounts, qualities, startTime, handle);
+    return handle;
+}
+
+extern "C" int64_t BuildBVHBatchDeferred(tinybvh::bvhvec4* vertices, const int* meshOffsets, const int* triCounts, const int* qualities, int meshCount)
+{
+    int64_t startTime = CaptureStartTime();
+    std::vector<BLASGeometry> meshes = SoupBatch(vertices, meshOffsets, triCounts, qualities, meshCount);
+    int64_t handle = StartBVHBatch(meshes, true);
+    CaptureBatch(CAPTURE_BUILD_BVH_BATCH_DEFERRED, meshes, vertices, meshOffsets, nullptr, nullptr, nullptr, triCounts, qualities,
+                 startTime, handle);
+    return handle;
+}
+
+extern "C" int64_t BuildBVHBatchIndexedDeferred(tinybvh::bvhvec4* vertices, const int* vertexOffsets, const int* vertexCounts,
+                                            const uint32_t* indices, const int* indexOffsets, const int* triCounts,
+                                            const int* qualities, int meshCount)
+{
+    int64_t startTime = CaptureStartTime();
+    std::vector<BLASGeometry> meshes(meshCount);
+    for (int i = 0; i < meshCount; ++i)
+        meshes[i] = { vertices + vertexOffsets[i], vertexCounts[i], indices + indexOffsets[i], triCounts[i], MeshQuality(qualities, i) };
+    int64_t handle = StartBVHBatch(meshes, true);
+    CaptureBatch(CAPTURE_BUILD_BVH_BATCH_INDEXED_DEFERRED, meshes, vertices, vertexOffsets, vertexCounts, indices, indexOffsets,
+                 triCounts, qualities, startTime, handle);
+    return handle;
+}
+
+static void WaitForBatch(BVHBatch* batch)
+{
+    std::unique_lock<std::mutex> lock(gBuildMutex);
+    gBuildFinished.wait(lock, [batch] { return batch->ready.load(); });
 }
 
-extern "C" void* GetBVHPtr(int index)
+extern "C" void WaitForBVHBatch(int64_t handle)
 {
-    return GetBVH(index);
+    BVHBatch* batch = GetBatch(handle);
+    if (batch != nullptr)
+        WaitForBatch(batch);
 }
 
-extern "C" int BuildBVH(tinybvh::bvhvec4* vertices, int triangleCount)
+extern "C" bool IsBVHBatchReady(int64_t handle)
 {
-    tinybvh::BVH8_CWBVH* cwbvh = new tinybvh::BVH8_CWBVH();
-    cwbvh->Build(vertices, triangleCount);
-    return AddBVH(cwbvh);
+    BVHBatch* batch = GetBatch(handle);
+    return batch != nullptr && batch->ready.load(std::memory_order_acquire);
 }
 
-extern "C" void DestroyBVH(int index) 
+extern "C" void DestroyBVHBatch(int64_t handle)
 {
-    if (index >= 0 && index < static_cast<int>(gBVHList.size())) 
+    if (SceneCapture::Get().IsActive())
+        SceneCapture::Get().RecordDestroy(CAPTURE_DESTROY_BVH_BATCH, handle);
+    BVHBatch* batch = gBatches.Remove(handle);
+    if (batch != nullptr)
     {
-        if (gBVHList[index] != nullptr)
+        WaitForBatch(batch);
         {
-            delete gBVHList[index];
-            gBVHList[index] = nullptr;
+            std::unique_lock<std::mutex> lock(gBuildMutex);
+            gBuildFinished.wait(lock, [batch] { return batch->improving.load() == 0; });
         }
+        delete batch;
     }
 }
 
-extern "C" bool IsBVHReady(int index)
+extern "C" int GetBVHBatchVersion(int64_t handle)
 {
-    tinybvh::BVH8_CWBVH* bvh = GetBVH(index);
-    return (bvh != nullptr);
+    if (!IsBVHBatchReady(handle))
+        return 0;
+
+    BVHBatch* batch = GetBatch(handle);
+    std::vector<std::pair<int, tinybvh::BVH8_CWBVH*>> improved;
+    {
+        std::lock_guard<std::mutex> lock(gBuildMutex);
+        improved.swap(batch->improved);
+    }
+    if (improved.empty())
+        return batch->version;
+
+    for (const std::pair<int, tinybvh::BVH8_CWBVH*>& mesh : improved)
+    {
+        delete batch->bvhs[mesh.first];
+        batch->bvhs[mesh.first] = mesh.second;
+        batch->cacheKeys[mesh.first] = 0;
+    }
+    batch->unpublished -= static_cast<int>(improved.size());
+
+    // The sizes changed, so every mesh moves in the arenas.
+    tinybvh::free64(batch->nodes);
+    tinybvh::free64(batch->tris);
+    batch->nodes = nullptr;
+    batch->tris = nullptr;
+    PackBVHBatch(batch);
+    return ++batch->version;
 }
 
-extern "C" int GetCWBVHNodesSize(int index)
+extern "C" bool IsBVHBatchImproving(int64_t handle)
 {
-    tinybvh::BVH8_CWBVH* bvh = GetBVH(index);
-    return bvh != nullptr ? bvh->usedBlocks * 16 : 0;
+    return IsBVHBatchReady(handle) && GetBatch(handle)->unpublished > 0;
 }
 
-extern "C" int GetCWBVHTrisSize(int index) 
+extern "C" int64_t GetBVHBatchNodesSize(int64_t handle)
 {
-    tinybvh::BVH8_CWBVH* bvh = GetBVH(index);
-    return bvh != nullptr ? bvh->triCount * 3 * 16 : 0;
+    return IsBVHBatchReady(handle) ? GetBatch(handle)->nodesSize : 0;
 }
 
-extern "C" bool GetCWBVHData(int index, tinybvh::bvhvec4** bvhNodes, tinybvh::bvhvec4** bvhTris) 
+extern "C" int64_t GetBVHBatchTrisSize(int64_t handle)
 {
-    tinybvh::BVH8_CWBVH* bvh = GetBVH(index);
-    if (bvh == nullptr)
+    return IsBVHBatchReady(handle) ? GetBatch(handle)->trisSize : 0;
+}
+
+extern "C" int64_t* GetBVHBatchOffsets(int64_t handle)
+{
+    return IsBVHBatchReady(handle) ? GetBatch(handle)->offsets.data() : nullptr;
+}
+
+extern "C" bool GetBVHBatchData(int64_t handle, tinybvh::bvhvec4** bvhNodes, tinybvh::bvhvec4** bvhTris, int64_t** offsets)
+{
+    if (!IsBVHBatchReady(handle) || GetBatch(handle)->deferred)
         return false;
 
-    if (bvh->bvh8Data != nullptr && bvh->bvh8Tris != nullptr)
+    BVHBatch* batch = GetBatch(handle);
+    *bvhNodes = batch->nodes;
+    *bvhTris = batch->tris;
+    *offsets = batch->offsets.data();
+    return true;
+}
+
+extern "C" bool WriteBVHBatchData(int64_t handle, tinybvh::bvhvec4* bvhNodes, int64_t nodesCapacity, tinybvh::bvhvec4* bvhTris, int64_t trisCapacity)
+{
+    if (!IsBVHBatchReady(handle))
+        return false;
+
+    BVHBatch* batch = GetBatch(handle);
+    if (batch->nodesSize > nodesCapacity || batch->trisSize > trisCapacity)
+        return false;
+
+    if (!batch->deferred)
     {
-        *bvhNodes = bvh->bvh8Data;
-        *bvhTris  = bvh->bvh8Tris;
+        memcpy(bvhNodes, batch->nodes, batch->nodesSize);
+        memcpy(bvhTris, batch->tris, batch->trisSize);
         return true;
     }
 
-    return false;
+    // Each mesh encodes into its own range of the output, so they can all run at once.
+    JobSystem::Get().ParallelFor(static_cast<int>(batch->bvhs.size()), [batch, bvhNodes, bvhTris](int i)
+    {
+        tinybvh::BVH8_CWBVH* bvh = batch->bvhs[i];
+        if (bvh == nullptr)
+            return;
+
+        char* nodes = reinterpret_cast<char*>(bvhNodes) + batch->offsets[i * 2 + 0];
+        char* tris = reinterpret_cast<char*>(bvhTris) + batch->offsets[i * 2 + 1];
+        WriteCWBVH(bvh, reinterpret_cast<tinybvh::bvhvec4*>(nodes), reinterpret_cast<tinybvh::bvhvec4*>(tris), &batch->cacheKeys[i]);
+    });
+    return true;
+}
+
+// Bytes of a mesh's nodes, stream 0, or triangles, stream 1, in the batch's layout.
+static int64_t BatchMeshSize(const BVHBatch* batch, size_t mesh, int stream)
+{
+    size_t meshCount = batch->bvhs.size();
+    int64_t end = mesh + 1 < meshCount ? batch->offsets[(mesh + 1) * 2 + stream] : (stream == 0 ? batch->nodesSize : batch->trisSize);
+    return end - batch->offsets[mesh * 2 + stream];
 }
 
+extern "C" bool LayoutBVHBatchPages(int64_t handle, int64_t pageSize, BVHPageEntry* table,
+                                    int64_t* nodePageSizes, int64_t* triPageSizes)
+{
+    if (!IsBVHBatchReady(handle))
+        return false;
+
+    BVHBatch* batch = GetBatch(handle);
+    std::vector<int64_t> sizes(batch->offsets.size());
+    for (size_t i = 0; i < batch->bvhs.size(); ++i)
+    {
+        sizes[i * 2 + 0] = BatchMeshSize(batch, i, 0);
+        sizes[i * 2 + 1] = BatchMeshSize(batch, i, 1);
+    }
+    return LayoutPages(sizes, pageSize, table, nodePageSizes, triPageSizes);
+}
 
-static int AddTLAS(tinybvh::BVH_GPU* newBVH)
+extern "C" bool WriteBVHBatchDataPaged(int64_t handle, const BVHPagedBuffer* nodes, const BVHPagedBuffer* tris, const BVHPageEntry* table)
 {
-    for (size_t i = 0; i < gTLASList.size(); ++i) 
+    if (!IsBVHBatchReady(handle) || !IsValidPagedBuffer(nodes, 80) || !IsValidPagedBuffer(tris, 16))
+        return false;
+
+    BVHBatch* batch = GetBatch(handle);
+    int meshCount = static_cast<int>(batch->bvhs.size());
+    std::vector<int64_t> offsets = batch->offsets;
+    if (table != nullptr)
     {
-        if (gTLASList[i] == nullptr) 
+        for (int i = 0; i < meshCount; ++i)
         {
-            gTLASList[i] = newBVH;
-            return static_cast<int>(i);
+            offsets[i * 2 + 0] = PageEntryOffset(*nodes, table[i].nodePage, table[i].nodeOffset, 80);
+            offsets[i * 2 + 1] = PageEntryOffset(*tris, table[i].triPage, table[i].triOffset, 16);
         }
     }
+    for (int i = 0; i < meshCount; ++i)
+    {
+        if (!FitsPagedBuffer(*nodes, offsets[i * 2 + 0], BatchMeshSize(batch, i, 0)) ||
+            !FitsPagedBuffer(*tris, offsets[i * 2 + 1], BatchMeshSize(batch, i, 1)))
+            return false;
+    }
+
+    if (!batch->deferred && table == nullptr)
+    {
+        CopyToPagedBuffer(*nodes, 0, batch->nodes, batch->nodesSize);
+        CopyToPagedBuffer(*tris, 0, batch->tris, batch->trisSize);
+        return true;
+    }
+
+    JobSystem::Get().ParallelFor(meshCount, [batch, nodes, tris, &offsets](int i)
+    {
+        if (!batch->deferred)
+        {
+            const char* packedNodes = reinterpret_cast<const char*>(batch->nodes) + batch->offsets[i * 2 + 0];
+            const char* packedTris = reinterpret_cast<const char*>(batch->tris) + batch->offsets[i * 2 + 1];
+            CopyToPagedBuffer(*nodes, offsets[i * 2 + 0], packedNodes, BatchMeshSize(batch, i, 0));
+            CopyToPagedBuffer(*tris, offsets[i * 2 + 1], packedTris, BatchMeshSize(batch, i, 1));
+            return;
+        }
 
-    gTLASList.push_back(newBVH);
-    return static_cast<int>(gTLASList.size() - 1);
+        tinybvh::BVH8_CWBVH* bvh = batch->bvhs[i];
+        if (bvh != nullptr)
+            WriteCWBVHPaged(bvh, *nodes, offsets[i * 2 + 0], *tris, offsets[i * 2 + 1], &batch->cacheKeys[i]);
+    });
+    return true;
 }
 
-tinybvh::BVH_GPU* GetTLAS(int index)
+static int64_t AddTLAS(TLASEntry* newEntry)
 {
-    if (index >= 0 && index < static_cast<int>(gTLASList.size())) 
-        return gTLASList[index];
-    return nullptr;
+    return gTLASes.Add(newEntry);
+}
+
+static TLASEntry* GetTLASEntry(int64_t handle)
+{
+    return gTLASes.Get(handle);
+}
+
+tinybvh::BVH_GPU* GetTLAS(int64_t handle)
+{
+    TLASEntry* entry = GetTLASEntry(handle);
+    return entry != nullptr ? entry->tlas : nullptr;
+}
+
+// Grows the TLAS's buffers by at least half ahead of a build. tinybvh's Build keeps any
+// buffers that are large enough, but reallocates them to the exact size otherwise.
+static void ReserveTLAS(tinybvh::BVH& bvh, uint32_t instanceCount)
+{
+    if (bvh.allocatedNodes >= instanceCount * 2)
+        return;
+
+    uint32_t capacity = bvh.allocatedNodes / 2 * 3 / 2;
+    if (capacity < instanceCount)
+        capacity = instanceCount;
+
+    bvh.AlignedFree(bvh.bvhNode);
+    bvh.AlignedFree(bvh.primIdx);
+    bvh.AlignedFree(bvh.fragment);
+    bvh.bvhNode = static_cast<tinybvh::BVH::BVHNode*>(bvh.AlignedAlloc(capacity * 2 * sizeof(tinybvh::BVH::BVHNode)));
+    bvh.primIdx = static_cast<uint32_t*>(bvh.AlignedAlloc(capacity * sizeof(uint32_t)));
+    bvh.fragment = static_cast<tinybvh::BVHBase::Fragment*>(bvh.AlignedAlloc(capacity * sizeof(tinybvh::BVHBase::Fragment)));
+    bvh.allocatedNodes = capacity * 2;
+    memset(&bvh.bvhNode[1], 0, sizeof(tinybvh::BVH::BVHNode)); // unused, as Build leaves it
+}
+
+// Compares one part of the new TLAS data against the image in blocks of one GPU node, copies
+// the blocks that changed and records them as dirty ranges. Ranges closer than the merge gap
+// are joined, a slightly larger upload is cheaper than another one.
+static void DiffTLASImage(TLASEntry* entry, size_t offset, const void* data, size_t size)
+{
+    const size_t blockSize = sizeof(tinybvh::BVH_GPU::BVHNode);
+    const size_t mergeGap = 4 * blockSize;
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    std::vector<int>& ranges = entry->dirtyRanges;
+
+    for (size_t i = 0; i < size; i += blockSize)
+    {
+        size_t count = std::min(blockSize, size - i);
+        uint8_t* previous = entry->image.data() + offset + i;
+        if (memcmp(previous, bytes + i, count) == 0)
+            continue;
+        memcpy(previous, bytes + i, count);
+
+        size_t start = offset + i;
+        size_t end = start + count;
+        if (!ranges.empty() && static_cast<size_t>(ranges[ranges.size() - 2]) + ranges.back() + mergeGap >= start)
+            ranges.back() = static_cast<int>(end - ranges[ranges.size() - 2]);
+        else
+        {
+            ranges.push_back(static_cast<int>(start));
+            ranges.push_back(static_cast<int>(count));
+        }
+    }
+}
+
+// Brings the TLAS's image up to date and collects the byte ranges that changed since the last
+// update. If the node count changed the indices moved as well, so all of it is dirty.
+static void UpdateTLASImage(TLASEntry* entry)
+{
+    const tinybvh::BVH_GPU* tlas = entry->tlas;
+    size_t nodesSize = tlas->usedNodes * sizeof(tinybvh::BVH_GPU::BVHNode);
+    size_t indicesSize = tlas->bvh.idxCount * sizeof(uint32_t);
+
+    entry->dirtyRanges.clear();
+    if (entry->imageNodesSize != nodesSize || entry->image.size() != nodesSize + indicesSize)
+    {
+        entry->image.resize(nodesSize + indicesSize);
+        memcpy(entry->image.data(), tlas->bvhNode, nodesSize);
+        memcpy(entry->image.data() + nodesSize, tlas->bvh.primIdx, indicesSize);
+        entry->imageNodesSize = nodesSize;
+        entry->dirtyRanges.push_back(0);
+        entry->dirtyRanges.push_back(static_cast<int>(entry->image.size()));
+        return;
+    }
+
+    DiffTLASImage(entry, 0, tlas->bvhNode, nodesSize);
+    DiffTLASImage(entry, nodesSize, tlas->bvh.primIdx, indicesSize);
 }
 
-extern "C" int BuildTLAS(tinybvh::BLASInstance* instances, int instanceCount)
+// Builds into the TLAS's existing buffers, which only grow.
+static void BuildTLASEntry(TLASEntry* entry, tinybvh::BLASInstance* instances, int instanceCount)
 {
-    tinybvh::BVH_GPU* tlasGPU = new tinybvh::BVH_GPU();
     // Use the BVH owned by the BVH_GPU so we don't need to keep the seperate BVH around.
-    tlasGPU->bvh.Build(instances, instanceCount, nullptr, 0);
-    tlasGPU->ConvertFrom(tlasGPU->bvh);
-    return AddTLAS(tlasGPU);
+    tinybvh::BVH& bvh = entry->tlas->bvh;
+    ReserveTLAS(bvh, instanceCount);
+    bvh.Build(instances, instanceCount, nullptr, 0);
+    // Not compacting sizes the GPU nodes to the BVH's capacity, so they grow along with it.
+    entry->tlas->ConvertFrom(bvh, false);
+    entry->builtCost = entry->cost = BVHCost(bvh);
+    UpdateTLASImage(entry);
 }
 
-extern "C" void DestroyTLAS(int index)
+// Fits the TLAS's binary BVH to the instances' current bounds, keeping its topology. The
+// builder always stores children after their parent, so one backwards pass is bottom-up.
+static void RefitTLASNodes(tinybvh::BVH& bvh, const tinybvh::BLASInstance* instances)
 {
-    if (index >= 0 && index < static_cast<int>(gTLASList.size())) 
+    for (int i = static_cast<int>(bvh.usedNodes) - 1; i >= 0; --i)
     {
-        if (gTLASList[index] != nullptr)
+        // Node 1 is left unused by the builder for cache line alignment.
+        if (i == 1)
+            continue;
+
+        tinybvh::BVH::BVHNode& node = bvh.bvhNode[i];
+        if (node.isLeaf())
         {
-            delete gTLASList[index];
-            gTLASList[index] = nullptr;
+            tinybvh::bvhvec3 aabbMin(BVH_FAR), aabbMax(-BVH_FAR);
+            for (uint32_t j = 0; j < node.triCount; ++j)
+            {
+                const tinybvh::BLASInstance& instance = instances[bvh.primIdx[node.leftFirst + j]];
+                aabbMin = tinybvh::tinybvh_min(aabbMin, instance.aabbMin);
+                aabbMax = tinybvh::tinybvh_max(aabbMax, instance.aabbMax);
+            }
+            node.aabbMin = aabbMin;
+            node.aabbMax = aabbMax;
+            continue;
         }
+
+        const tinybvh::BVH::BVHNode& left = bvh.bvhNode[node.leftFirst];
+        const tinybvh::BVH::BVHNode& right = bvh.bvhNode[node.leftFirst + 1];
+        node.aabbMin = tinybvh::tinybvh_min(left.aabbMin, right.aabbMin);
+        node.aabbMax = tinybvh::tinybvh_max(left.aabbMax, right.aabbMax);
+    }
+    bvh.aabbMin = bvh.bvhNode[0].aabbMin;
+    bvh.aabbMax = bvh.bvhNode[0].aabbMax;
+}
+
+// Records a TLAS build, rebuild or refit and its instances if a capture is active.
+static void CaptureTLAS(CaptureRecordType type, const tinybvh::BLASInstance* instances, int instanceCount, int64_t startTime, int64_t handle)
+{
+    SceneCapture& capture = SceneCapture::Get();
+    if (!capture.IsActive())
+        return;
+
+    CaptureArray array = { instances, static_cast<uint64_t>(std::max(instanceCount, 0)) * sizeof(tinybvh::BLASInstance) };
+    capture.Record(type, instanceCount, 0, startTime, handle, &array, 1);
+}
+
+extern "C" int64_t BuildTLAS(tinybvh::BLASInstance* instances, int instanceCount)
+{
+    int64_t startTime = CaptureStartTime();
+    TLASEntry* entry = new TLASEntry();
+    entry->tlas = new tinybvh::BVH_GPU();
+    BuildTLASEntry(entry, instances, instanceCount);
+    int64_t handle = AddTLAS(entry);
+    CaptureTLAS(CAPTURE_BUILD_TLAS, instances, instanceCount, startTime, handle);
+    return handle;
+}
+
+extern "C" bool RebuildTLAS(int64_t handle, tinybvh::BLASInstance* instances, int instanceCount)
+{
+    TLASEntry* entry = GetTLASEntry(handle);
+    if (entry == nullptr || instanceCount <= 0)
+        return false;
+
+    int64_t startTime = CaptureStartTime();
+    BuildTLASEntry(entry, instances, instanceCount);
+    CaptureTLAS(CAPTURE_REBUILD_TLAS, instances, instanceCount, startTime, handle);
+    return true;
+}
+
+static bool RefitTLASEntry(TLASEntry* entry, tinybvh::BLASInstance* instances, int instanceCount)
+{
+    tinybvh::BVH& bvh = entry->tlas->bvh;
+    if (static_cast<int>(bvh.triCount) != instanceCount)
+    {
+        BuildTLASEntry(entry, instances, instanceCount);
+        return true;
+    }
+
+    bvh.instList = instances;
+    RefitTLASNodes(bvh, instances);
+    entry->cost = BVHCost(bvh);
+    if (entry->cost > entry->builtCost * gTLASRebuildThreshold)
+    {
+        BuildTLASEntry(entry, instances, instanceCount);
+        return true;
+    }
+
+    // Same topology, so this only rewrites the child bounds of each GPU node. Compacting only
+    // clears the nodes in use, the buffers BuildTLASEntry sized to the capacity are kept.
+    entry->tlas->ConvertFrom(bvh);
+    UpdateTLASImage(entry);
+    return false;
+}
+
+extern "C" bool RefitTLAS(int64_t handle, tinybvh::BLASInstance* instances, int instanceCount)
+{
+    TLASEntry* entry = GetTLASEntry(handle);
+    if (entry == nullptr)
+        return false;
+
+    int64_t startTime = CaptureStartTime();
+    bool rebuilt = RefitTLASEntry(entry, instances, instanceCount);
+    CaptureTLAS(CAPTURE_REFIT_TLAS, instances, instanceCount, startTime, handle);
+    return rebuilt;
+}
+
+extern "C" void SetTLASRebuildThreshold(float threshold)
+{
+    gTLASRebuildThreshold = threshold;
+}
+
+extern "C" float GetTLASCostRatio(int64_t handle)
+{
+    TLASEntry* entry = GetTLASEntry(handle);
+    if (entry == nullptr || entry->builtCost <= 0.0f)
+        return 0.0f;
+    return entry->cost / entry->builtCost;
+}
+
+extern "C" void DestroyTLAS(int64_t handle)
+{
+    if (SceneCapture::Get().IsActive())
+        SceneCapture::Get().RecordDestroy(CAPTURE_DESTROY_TLAS, handle);
+    TLASEntry* entry = gTLASes.Remove(handle);
+    if (entry != nullptr)
+    {
+        delete entry->tlas;
+        delete entry;
     }
 }
 
-extern "C" bool IsTLASReady(int index)
+extern "C" bool IsTLASReady(int64_t handle)
 {
-    tinybvh::BVH_GPU* bvh = GetTLAS(index);
+    tinybvh::BVH_GPU* bvh = GetTLAS(handle);
     return bvh != nullptr;
 }
 
-extern "C" int GetTLASNodesSize(int index)
+extern "C" int GetTLASNodesSize(int64_t handle)
 {
-    tinybvh::BVH_GPU* bvh = GetTLAS(index);
+    tinybvh::BVH_GPU* bvh = GetTLAS(handle);
     return bvh != nullptr ? bvh->usedNodes * 16 * 4 : 0;
 }
 
-extern "C" bool GetTLASData(int index, tinybvh::bvhvec4** tlasNodes, uint32_t** tlasIndices)
+extern "C" bool GetTLASDirtyRanges(int64_t handle, uint8_t** tlasData, int** ranges, int* rangeCount)
+{
+    TLASEntry* entry = GetTLASEntry(handle);
+    if (entry == nullptr)
+        return false;
+
+    *tlasData = entry->image.data();
+    *ranges = entry->dirtyRanges.data();
+    *rangeCount = static_cast<int>(entry->dirtyRanges.size() / 2);
+    return true;
+}
+
+extern "C" bool GetTLASData(int64_t handle, tinybvh::bvhvec4** tlasNodes, uint32_t** tlasIndices)
 {
-    tinybvh::BVH_GPU* tlas = GetTLAS(index);
+    tinybvh::BVH_GPU* tlas = GetTLAS(handle);
     if (tlas == nullptr)
         return false;
 
@@ -156,3 +2267,310 @@ extern "C" bool GetTLASData(int index, tinybvh::bvhvec4** tlasNodes, uint32_t**
 
     return false;
 }
+
+// A BLAS of a query scene, traced through its binary BVH if it kept one and through its
+// encoded CWBVH otherwise, like IntersectRays does.
+struct QuerySceneBLAS
+{
+    const tinybvh::BVH* bvh;
+    const tinybvh::BVH8_CWBVH* cwbvh;
+    bool compressedTris;
+};
+
+// BLASes and their instances for CPU ray queries, under a TLAS over the instances' bounds.
+struct QueryScene
+{
+    std::vector<int64_t> blasHandles;
+    // The BLASes when the TLAS was built, and the generation of each. Refits and progressive
+    // builds change them, so queries check the generations against the handles' first.
+    std::vector<QuerySceneBLAS> blases;
+    std::vector<uint32_t> generations;
+    std::vector<tinybvh::BLASInstance> instances;
+    tinybvh::BVH tlas;
+};
+
+static SlotMap<QueryScene> gQueryScenes;
+
+// Unity matrices, as in the BLASInstances BuildTLAS gets, are column-major and tinybvh's are
+// row-major.
+static tinybvh::bvhmat4 TransposedMatrix(const tinybvh::bvhmat4& matrix)
+{
+    tinybvh::bvhmat4 transposed;
+    for (int row = 0; row < 4; ++row)
+    {
+        for (int column = 0; column < 4; ++column)
+            transposed.cell[row * 4 + column] = matrix.cell[column * 4 + row];
+    }
+    return transposed;
+}
+
+static bool IsQuerySceneCurrent(const QueryScene* scene)
+{
+    if (scene->instances.empty())
+        return false;
+    for (size_t i = 0; i < scene->blasHandles.size(); ++i)
+    {
+        BVHEntry* entry = GetBVHEntry(scene->blasHandles[i]);
+        if (GetBVH(scene->blasHandles[i]) == nullptr || entry->generation != scene->generations[i])
+            return false;
+    }
+    return true;
+}
+
+// Traces a world space ray through an instance's BLAS. Returns true if it found a hit closer
+// than ray.hit, which it then replaces.
+static bool TraceInstanceRay(const QueryScene& scene, uint32_t instanceIndex, tinybvh::Ray& ray, bool anyHit, bool simd)
+{
+    const tinybvh::BLASInstance& instance = scene.instances[instanceIndex];
+    const QuerySceneBLAS& blas = scene.blases[instance.blasIdx];
+    // Not normalized, so distances along it are world space distances.
+    tinybvh::bvhvec3 origin = tinybvh::tinybvh_transform_point(ray.O, instance.invTransform);
+    tinybvh::bvhvec3 direction = tinybvh::tinybvh_transform_vector(ray.D, instance.invTransform);
+
+    if (blas.bvh != nullptr)
+    {
+        tinybvh::Ray local;
+        local.O = origin;
+        local.D = direction;
+        local.rD = tinybvh::tinybvh_rcp(direction);
+        local.hit = ray.hit;
+        if (anyHit)
+            return blas.bvh->IsOccluded(local);
+        blas.bvh->Intersect(local);
+        if (local.hit.t >= ray.hit.t)
+            return false;
+        ray.hit = local.hit;
+        ray.hit.inst = instanceIndex;
+        return true;
+    }
+
+    CWBVHRay local = { origin, direction, 0.0f };
+    CWBVHHit hit = { ray.hit.t, 0.0f, 0.0f, BVH_NO_HIT, 0, 0 };
+    if (!IntersectCWBVH(blas.cwbvh->bvh8Data, blas.cwbvh->bvh8Tris, blas.compressedTris, local, hit, anyHit, simd))
+        return false;
+    ray.hit.t = hit.distance;
+    ray.hit.u = hit.u;
+    ray.hit.v = hit.v;
+    ray.hit.prim = hit.triIndex;
+    ray.hit.inst = instanceIndex;
+    return true;
+}
+
+// Traces a ray through the scene's TLAS like BVH::IntersectTLAS and IsOccludedTLAS do, which
+// only take binary BVHs as BLASes. Returns true if anything closer than ray.hit was hit.
+static bool TraceSceneRay(const QueryScene& scene, tinybvh::Ray& ray, bool anyHit, bool simd)
+{
+    const tinybvh::BVH::BVHNode* stack[64];
+    const tinybvh::BVH::BVHNode* node = &scene.tlas.bvhNode[0];
+    uint32_t stackPtr = 0;
+    bool found = false;
+    while (true)
+    {
+        if (node->isLeaf())
+        {
+            for (uint32_t i = 0; i < node->triCount; ++i)
+            {
+                if (TraceInstanceRay(scene, scene.tlas.primIdx[node->leftFirst + i], ray, anyHit, simd))
+                {
+                    if (anyHit)
+                        return true;
+                    found = true;
+                }
+            }
+            if (stackPtr == 0)
+                break;
+            node = stack[--stackPtr];
+            continue;
+        }
+
+        const tinybvh::BVH::BVHNode* child1 = &scene.tlas.bvhNode[node->leftFirst];
+        const tinybvh::BVH::BVHNode* child2 = child1 + 1;
+        float dist1 = tinybvh::tinybvh_intersect_aabb(ray, child1->aabbMin, child1->aabbMax);
+        float dist2 = tinybvh::tinybvh_intersect_aabb(ray, child2->aabbMin, child2->aabbMax);
+        if (dist1 > dist2)
+        {
+            std::swap(dist1, dist2);
+            std::swap(child1, child2);
+        }
+        if (dist1 == BVH_FAR)
+        {
+            if (stackPtr == 0)
+                break;
+            node = stack[--stackPtr];
+            continue;
+        }
+        node = child1;
+        if (dist2 != BVH_FAR)
+            stack[stackPtr++] = child2;
+    }
+    return found;
+}
+
+static int TraceSceneRayBlock(const QueryScene& scene, const BVHRay* rays, int count, BVHSceneHit* hits, uint8_t* occluded)
+{
+    bool simd = UseSimdTraversal();
+    int hitCount = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        bool hit = false;
+        tinybvh::Ray ray;
+        if (IsValidRay(rays[i]))
+        {
+            ray = tinybvh::Ray(rays[i].origin, rays[i].direction, rays[i].tMax);
+            hit = TraceSceneRay(scene, ray, hits == nullptr, simd);
+        }
+
+        if (hits != nullptr)
+            hits[i] = hit ? BVHSceneHit { ray.hit.t, ray.hit.u, ray.hit.v, ray.hit.prim, ray.hit.inst }
+                          : BVHSceneHit { rays[i].tMax, 0.0f, 0.0f, BVH_NO_HIT, BVH_NO_HIT };
+        else
+            occluded[i] = hit ? 1 : 0;
+        hitCount += hit ? 1 : 0;
+    }
+    return hitCount;
+}
+
+static int TraceSceneRays(int64_t handle, const BVHRay* rays, int count, BVHSceneHit* hits, uint8_t* occluded)
+{
+    QueryScene* scene = gQueryScenes.Get(handle);
+    if (scene == nullptr || count < 0 || !IsQuerySceneCurrent(scene))
+        return -1;
+
+    return RunRayQuery(count, [&](int first, int blockSize)
+    {
+        return TraceSceneRayBlock(*scene, rays + first, blockSize, hits != nullptr ? hits + first : nullptr,
+                                  hits != nullptr ? nullptr : occluded + first);
+    });
+}
+
+extern "C" int64_t CreateQueryScene(const int64_t* blasHandles, int blasCount)
+{
+    if (blasCount < 0 || (blasCount > 0 && blasHandles == nullptr))
+        return -1;
+
+    QueryScene* scene = new QueryScene();
+    scene->blasHandles.assign(blasHandles, blasHandles + blasCount);
+    return gQueryScenes.Add(scene);
+}
+
+extern "C" bool SetQuerySceneInstances(int64_t handle, const tinybvh::BLASInstance* instances, int instanceCount)
+{
+    QueryScene* scene = gQueryScenes.Get(handle);
+    if (scene == nullptr || instanceCount <= 0)
+        return false;
+
+    std::vector<QuerySceneBLAS> blases(scene->blasHandles.size());
+    std::vector<uint32_t> generations(blases.size());
+    for (size_t i = 0; i < blases.size(); ++i)
+    {
+        QuerySceneBLAS& blas = blases[i];
+        blas.bvh = QueryBVH(scene->blasHandles[i]);
+        blas.cwbvh = blas.bvh == nullptr ? QueryCWBVH(scene->blasHandles[i], &blas.compressedTris) : nullptr;
+        if (blas.bvh == nullptr && blas.cwbvh == nullptr)
+            return false;
+        generations[i] = GetBVHEntry(scene->blasHandles[i])->generation;
+    }
+    for (int i = 0; i < instanceCount; ++i)
+    {
+        if (instances[i].blasIdx >= blases.size())
+            return false;
+    }
+
+    scene->blases = std::move(blases);
+    scene->generations = std::move(generations);
+    scene->instances.assign(instances, instances + instanceCount);
+    for (tinybvh::BLASInstance& instance : scene->instances)
+    {
+        // Fits the instance's bounds to its BLAS's, which lean and cached BVHs keep as well,
+        // and inverts its transform. Update only reads the BLAS.
+        const QuerySceneBLAS& blas = scene->blases[instance.blasIdx];
+        const tinybvh::BVHBase* bounds = blas.bvh != nullptr ? static_cast<const tinybvh::BVHBase*>(blas.bvh) : blas.cwbvh;
+        instance.transform = TransposedMatrix(instance.transform);
+        instance.Update(const_cast<tinybvh::BVHBase*>(bounds));
+    }
+    // Without BLASes the build takes the instance bounds as they are.
+    scene->tlas.Build(scene->instances.data(), instanceCount, nullptr, 0);
+    // Rays go to object space with the given inverse, exactly like on the GPU.
+    for (int i = 0; i < instanceCount; ++i)
+        scene->instances[i].invTransform = TransposedMatrix(instances[i].invTransform);
+    return true;
+}
+
+extern "C" void DestroyQueryScene(int64_t handle)
+{
+    delete gQueryScenes.Remove(handle);
+}
+
+extern "C" int IntersectSceneRays(int64_t handle, const BVHRay* rays, int count, BVHSceneHit* hits)
+{
+    return TraceSceneRays(handle, rays, count, hits, nullptr);
+}
+
+extern "C" int IsOccludedSceneRays(int64_t handle, const BVHRay* rays, int count, uint8_t* occluded)
+{
+    return TraceSceneRays(handle, rays, count, nullptr, occluded);
+}
+
+// Pixels per side of the tiles RenderReference hands to the worker pool.
+static const int kReferenceTileSize = 16;
+
+// Totals over all reference renders since the last ResetReferenceRenderStats.
+static std::atomic<int64_t> gReferenceSamples { 0 };
+static std::atomic<int64_t> gReferenceRays { 0 };
+static std::atomic<int64_t> gReferenceNanoseconds { 0 };
+
+extern "C" bool RenderReference(const ReferenceScene* scene, const ReferenceRenderSettings* settings, tinybvh::bvhvec4* output)
+{
+    if (scene == nullptr || settings == nullptr || output == nullptr)
+        return false;
+    if (settings->outputWidth <= 0 || settings->outputHeight <= 0)
+        return false;
+    if (scene->bvhNodes == nullptr || scene->bvhTris == nullptr || scene->triangleAttributes == nullptr || scene->materials == nullptr)
+        return false;
+    if (scene->tlasData != nullptr && scene->blasInstances == nullptr)
+        return false;
+    if (scene->lightCount < 0 || (scene->lightCount > 0 && scene->lights == nullptr))
+        return false;
+    if (scene->environmentTexture != nullptr && (scene->environmentCdf == nullptr || scene->environmentTextureWidth <= 0 ||
+                                                 scene->environmentTextureHeight <= 0))
+        return false;
+
+    auto start = std::chrono::steady_clock::now();
+    bool simd = UseSimdTraversal();
+    int width = settings->outputWidth;
+    int height = settings->outputHeight;
+    int tilesX = (width + kReferenceTileSize - 1) / kReferenceTileSize;
+    int tilesY = (height + kReferenceTileSize - 1) / kReferenceTileSize;
+    std::atomic<int64_t> rays { 0 };
+    JobSystem::Get().ParallelFor(tilesX * tilesY, [&](int tile)
+    {
+        int x0 = (tile % tilesX) * kReferenceTileSize;
+        int y0 = (tile / tilesX) * kReferenceTileSize;
+        int64_t tileRays = RenderReferenceTile(*scene, *settings, simd, x0, y0, std::min(x0 + kReferenceTileSize, width),
+                                               std::min(y0 + kReferenceTileSize, height), output);
+        rays.fetch_add(tileRays, std::memory_order_relaxed);
+    });
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    gReferenceSamples.fetch_add(static_cast<int64_t>(width) * height * std::max(1, settings->samplesPerPass), std::memory_order_relaxed);
+    gReferenceRays.fetch_add(rays.load(), std::memory_order_relaxed);
+    gReferenceNanoseconds.fetch_add(elapsed.count(), std::memory_order_relaxed);
+    return true;
+}
+
+extern "C" void GetReferenceRenderStats(int64_t* samples, int64_t* rays, double* seconds)
+{
+    if (samples != nullptr)
+        *samples = gReferenceSamples.load(std::memory_order_relaxed);
+    if (rays != nullptr)
+        *rays = gReferenceRays.load(std::memory_order_relaxed);
+    if (seconds != nullptr)
+        *seconds = gReferenceNanoseconds.load(std::memory_order_relaxed) * 1e-9;
+}
+
+extern "C" void ResetReferenceRenderStats()
+{
+    gReferenceSamples = 0;
+    gReferenceRays = 0;
+    gReferenceNanoseconds = 0;
+}
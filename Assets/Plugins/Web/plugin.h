@@ -6,24 +6,392 @@
 #define PLUGIN_FN
 #endif
 
-#define TINYBVH_IMPLEMENTATION
+#include "job_system.h"
+
 #define TINYBVH_NO_SIMD
+#ifdef PLUGIN_NO_THREADS
 #define NO_THREADED_BUILDS
+#else
+// Large builds split their subtrees across the plugin's worker pool.
+#define TINYBVH_FORK_JOIN PluginForkJoin
+#define MT_BUILD_MAX_DEPTH 8
+#endif
 #include "tiny_bvh.h"
 
+// How much time a BLAS build spends on the quality of the tree, passed to every build.
+enum BVHBuildQuality
+{
+    // Mid-point splits, for proxy geometry and meshes that are rebuilt often.
+    BVH_QUALITY_QUICK = 0,
+    // Binned SAH, the default.
+    BVH_QUALITY_BINNED = 1,
+    // SAH with spatial splits (SBVH). Slowest to build, and the BVH can't be refit.
+    BVH_QUALITY_SPATIAL = 2,
+    // Binned SAH, then subtree reinsertion, see SetBVHOptimizeSettings.
+    BVH_QUALITY_OPTIMIZED = 3,
+};
+
+// Caller memory split into pages of pageSize bytes, such as several GPU buffers that together
+// hold more than a single buffer can. The paged writes treat the pages as one range of
+// pageCount * pageSize bytes. Node pages must hold a whole number of 80 byte CWBVH nodes and
+// triangle pages a whole number of 16 byte float4s.
+struct BVHPagedBuffer
+{
+    tinybvh::bvhvec4** pages;
+    int pageCount;
+    int64_t pageSize;
+};
+
+// Where a BLAS sits in BVH data laid out in pages by LayoutBVHPages: the page holding its
+// nodes and the index of its first node within that page, and likewise for its triangles,
+// in float4s.
+struct BVHPageEntry
+{
+    int nodePage;
+    int nodeOffset;
+    int triPage;
+    int triOffset;
+};
+
+// A ray for IntersectRays and IsOccludedRays. The direction needn't be normalized, hit
+// distances are along the normalized direction, and only hits closer than tMax count.
+struct BVHRay
+{
+    tinybvh::bvhvec3 origin;
+    float tMax;
+    tinybvh::bvhvec3 direction;
+    float padding;
+};
+
+// Closest hit of a ray: its distance, barycentrics and triangle index, which is BVH_NO_HIT
+// with t = tMax if the ray hit nothing.
+struct BVHHit
+{
+    float t;
+    float u;
+    float v;
+    uint32_t prim;
+};
+
+// Closest hit of a ray in a query scene, like BVHHit plus the index of the instance hit. prim
+// is the triangle index within the instance's BLAS, the shaders add the instance's
+// triAttributeOffset to it. Both are BVH_NO_HIT if the ray hit nothing.
+struct BVHSceneHit
+{
+    float t;
+    float u;
+    float v;
+    uint32_t prim;
+    uint32_t instance;
+};
+
+#define BVH_NO_HIT 0xFFFFFFFFu
+
+// Shader data RenderReference reads, laid out like the structs of the same names in
+// common.hlsl and triangle_attributes.hlsl so the buffers uploaded for the PathTracer kernel
+// can be passed as they are. GPUInstance is BLASInstance in the shaders.
+struct MaterialData
+{
+    tinybvh::bvhvec4 data1;
+    tinybvh::bvhvec4 data2;
+    tinybvh::bvhvec4 data3;
+    tinybvh::bvhvec4 data4;
+    tinybvh::bvhvec4 data5;
+    tinybvh::bvhvec2 data6;
+    tinybvh::bvhvec2 textures1;
+    tinybvh::bvhvec4 textures2;
+    tinybvh::bvhvec4 texture1Transform;
+};
+
+struct TriangleAttributes
+{
+    tinybvh::bvhvec3 normal0;
+    float padding0;
+    tinybvh::bvhvec3 normal1;
+    float padding1;
+    tinybvh::bvhvec3 normal2;
+    float padding2;
+    tinybvh::bvhvec3 tangent0;
+    float padding3;
+    tinybvh::bvhvec3 tangent1;
+    float padding4;
+    tinybvh::bvhvec3 tangent2;
+    float padding5;
+    tinybvh::bvhvec2 uv0;
+    tinybvh::bvhvec2 uv1;
+    tinybvh::bvhvec2 uv2;
+    uint32_t materialIndex;
+    float padding6;
+};
+
+struct LightData
+{
+    tinybvh::bvhvec3 position;
+    uint32_t type;
+    tinybvh::bvhvec3 emission;
+    float range;
+    tinybvh::bvhvec3 u;
+    float area;
+    tinybvh::bvhvec3 v;
+    float padding;
+};
+
+// Matrices are stored column by column, like Unity's Matrix4x4.
+struct GPUInstance
+{
+    float localToWorld[16];
+    float worldToLocal[16];
+    int bvhOffset;
+    int triOffset;
+    int triAttributeOffset;
+    int materialIndex;
+    int bvhPage;
+    int triPage;
+    int padding[2];
+};
+
+// The buffers the PathTracer kernel is bound to, named after the shader globals. tlasData
+// and blasInstances are null for scenes rendered without HAS_TLAS, and the second BVH pages
+// are null unless the scene uses BVH_PAGED. textureData, lights and environmentTexture are
+// null without HAS_TEXTURES, HAS_LIGHTS and HAS_ENVIRONMENT_TEXTURE. The environment texture
+// holds RGBA float pixels from its bottom row up, and environmentCdf the running sum of their
+// grayscale values, as PathTracer.cs computes them.
+struct ReferenceScene
+{
+    const tinybvh::bvhvec4* bvhNodes;
+    const tinybvh::bvhvec4* bvhTris;
+    const tinybvh::bvhvec4* bvhNodes1;
+    const tinybvh::bvhvec4* bvhTris1;
+    const TriangleAttributes* triangleAttributes;
+    const MaterialData* materials;
+    const float* tlasData;
+    const GPUInstance* blasInstances;
+    const uint32_t* textureData;
+    const LightData* lights;
+    const tinybvh::bvhvec4* environmentTexture;
+    const float* environmentCdf;
+    uint32_t tlasIndexOffset;
+    // Non-zero if the BVH triangles are compressed, see BVH_COMPRESSED_TRIS.
+    int compressedTris;
+    int lightCount;
+    int environmentTextureWidth;
+    int environmentTextureHeight;
+    float environmentCdfSum;
+};
+
+// The PathTracer kernel's parameters, as PathTracer.cs sets them. Matrices are stored column
+// by column, like Unity's Matrix4x4.
+struct ReferenceRenderSettings
+{
+    float camToWorld[16];
+    float camInvProj[16];
+    int outputWidth;
+    int outputHeight;
+    uint32_t currentSample;
+    uint32_t rngSeedRoot;
+    uint32_t maxRayBounces;
+    int samplesPerPass;
+    int useRussianRoulette;
+    int useFireflyFilter;
+    float maxFireflyLuminance;
+    int environmentMode;
+    float environmentIntensity;
+    float environmentMapRotation;
+    tinybvh::bvhvec3 environmentColor;
+    float aperture;
+    float focalLength;
+};
+
+// BVHs, batches and TLASes are referred to by 64-bit handles, which stay invalid once the
+// object is destroyed instead of referring to whatever is created next. Any thread can
+// create objects and look them up, but an object must not be destroyed while in use.
 extern "C" 
 {
-    extern PLUGIN_FN int BuildBVH(tinybvh::bvhvec4* vertices, int triangleCount);
-    extern PLUGIN_FN void DestroyBVH(int index);
-    extern PLUGIN_FN bool IsBVHReady(int index);
-    extern PLUGIN_FN void* GetBVHPtr(int index);
-    extern PLUGIN_FN int GetCWBVHNodesSize(int index);
-    extern PLUGIN_FN int GetCWBVHTrisSize(int index);
-    extern PLUGIN_FN bool GetCWBVHData(int index, tinybvh::bvhvec4** bvhNodes, tinybvh::bvhvec4** bvhTris);
-
-    extern PLUGIN_FN int BuildTLAS(tinybvh::BLASInstance* instances, int instanceCount);
-    extern PLUGIN_FN void DestroyTLAS(int index);
-    extern PLUGIN_FN bool IsTLASReady(int index);
-    extern PLUGIN_FN int GetTLASNodesSize(int index);
-    extern PLUGIN_FN bool GetTLASData(int index, tinybvh::bvhvec4** tlasNodes, uint32_t** tlasIndices);
+    extern PLUGIN_FN int64_t BuildBVH(tinybvh::bvhvec4* vertices, int triangleCount, int quality);
+    // Builds from indexed vertices, three indices per triangle. Primitive indices in the
+    // CWBVH triangles are triangle indices, like for soups.
+    extern PLUGIN_FN int64_t BuildBVHIndexed(tinybvh::bvhvec4* vertices, int vertexCount, const uint32_t* indices, int triangleCount, int quality);
+    // Queues the build on the plugin's worker threads and returns its handle immediately.
+    // vertices must stay valid until IsBVHReady returns true.
+    extern PLUGIN_FN int64_t BuildBVHAsync(tinybvh::bvhvec4* vertices, int triangleCount, int quality);
+    // Like BuildBVHAsync, but stops before the CWBVH encoding so WriteCWBVHData can encode
+    // straight into caller memory. GetCWBVHData returns false for these BVHs.
+    extern PLUGIN_FN int64_t BuildBVHDeferred(tinybvh::bvhvec4* vertices, int triangleCount, int quality);
+    // vertices and indices must stay valid until the BVH is written.
+    extern PLUGIN_FN int64_t BuildBVHIndexedDeferred(tinybvh::bvhvec4* vertices, int vertexCount, const uint32_t* indices, int triangleCount, int quality);
+    // Reinsertion passes of BVH_QUALITY_OPTIMIZED builds, 25 by default. Extreme passes
+    // reinsert more subtrees each, for better trees at a higher cost.
+    extern PLUGIN_FN void SetBVHOptimizeSettings(int iterations, bool extreme);
+    // Builds started while enabled first build a quick BVH, so rendering can start right away,
+    // then rebuild it at the requested quality on idle workers. The geometry must stay valid
+    // until IsBVHImproving or IsBVHBatchImproving returns false.
+    extern PLUGIN_FN void SetBVHProgressiveBuilds(bool enabled);
+    // BVHs built while enabled free the binary and 8-wide BVHs their CWBVH is encoded from
+    // as soon as it is, including deferred ones, which then are no longer deferred. They only
+    // keep the CWBVH until destroyed, and RefitBVH always rebuilds them.
+    extern PLUGIN_FN void SetBVHLeanBuilds(bool enabled);
+    // BVHs built while enabled store their triangles compressed: the distinct vertices of each
+    // node's triangles and small indices into them, instead of three float4s per triangle. The
+    // shaders read them with BVH_COMPRESSED_TRIS. They are encoded as they are built, like lean
+    // BVHs, and RefitBVH rebuilds them.
+    extern PLUGIN_FN void SetBVHCompressedTris(bool enabled);
+    // Swaps in the improved BVH of a progressive build once it is done, and returns how many
+    // times that happened. The BVH's sizes and data only change during this call.
+    extern PLUGIN_FN int GetBVHVersion(int64_t handle);
+    extern PLUGIN_FN bool IsBVHImproving(int64_t handle);
+    extern PLUGIN_FN void DestroyBVH(int64_t handle);
+    // Fits a BVH to new positions of the vertices it was built from, keeping its topology, and
+    // re-encodes its CWBVH in place. Indexed BVHs keep using the indices they were built from.
+    // BVHs loaded from the cache can't be refit and are rebuilt instead, returns true if so.
+    // vertices must stay valid until the BVH is written, as for builds.
+    extern PLUGIN_FN bool RefitBVH(int64_t handle, tinybvh::bvhvec4* vertices);
+    // Current SAH cost of the BVH relative to its last full build. Refits degrade the tree as
+    // geometry deforms, a rebuild pays off once this grows well past 1.
+    extern PLUGIN_FN float GetBVHCostRatio(int64_t handle);
+    extern PLUGIN_FN bool IsBVHReady(int64_t handle);
+    extern PLUGIN_FN void WaitForBVH(int64_t handle);
+    extern PLUGIN_FN int GetPendingBVHCount();
+    // Waits for pending builds, then restarts the worker pool. 0 picks one worker per core.
+    extern PLUGIN_FN void SetWorkerCount(int count);
+    extern PLUGIN_FN int GetWorkerCount();
+    // Instruction set used for builds: 0 scalar, 1 SSE4.2, 2 AVX, 3 AVX2. Detected at load
+    // time, SetSimdLevel can only lower it, e.g. to compare against the scalar builder. Level 0
+    // also makes CWBVH queries take the scalar traversal instead of the SSE2 one.
+    extern PLUGIN_FN int GetSimdLevel();
+    extern PLUGIN_FN void SetSimdLevel(int level);
+    // Caches built BLASes in the directory, keyed by a hash of their vertices, so identical
+    // geometry is memory-mapped instead of rebuilt. Least recently used files are evicted
+    // past maxSizeMB. An empty or null path disables the cache. Deferred builds that miss
+    // stay deferred and are stored from the memory their first write encodes them into.
+    extern PLUGIN_FN void SetBVHCacheDirectory(const char* path, int maxSizeMB);
+    // Records every BLAS and TLAS build, rebuild, refit and destroy, batches included, with
+    // the vertices, indices, instances and qualities they were given and when each call
+    // started and how long it took, into a new file at path, until StopSceneCapture.
+    // Plugin/tools/scene_replay replays the file offline. Returns false if the file can't be
+    // created.
+    extern PLUGIN_FN bool StartSceneCapture(const char* path);
+    extern PLUGIN_FN void StopSceneCapture();
+    // BLAS builds allocate from an arena that keeps its memory between builds. Reports the bytes
+    // in use, the most in use at once so far, and the bytes the arena holds, any may be null.
+    extern PLUGIN_FN void GetBuildArenaUsage(int64_t* used, int64_t* peak, int64_t* reserved);
+    // Releases the arena memory no BVH or build is using, returns the number of bytes released.
+    extern PLUGIN_FN int64_t TrimBuildArena();
+    // Traces rays against a BLAS on the worker pool, filling one hit per ray, and returns the
+    // number of rays that hit or -1 if the BVH can't be queried. Blocks of 256 rays that share
+    // their origin, such as camera ray tiles, take the packet traversal, all others are traced
+    // one by one. Lean BVHs and BVHs mapped from the cache have no binary BVH, their rays are
+    // traced through the CWBVH instead, which needs no vertices. Deferred BVHs can't be queried
+    // until encoded. The BVH must not be refit, swapped for its improved version or destroyed
+    // during the call, and its vertices must still be valid.
+    extern PLUGIN_FN int IntersectRays(int64_t handle, const BVHRay* rays, int count, BVHHit* hits);
+    // Like IntersectRays, but only finds whether each ray hits anything before tMax, 1 if so.
+    extern PLUGIN_FN int IsOccludedRays(int64_t handle, const BVHRay* rays, int count, uint8_t* occluded);
+    // Traces rays through the CWBVH of a BLAS exactly like bvh.hlsl does: directions are used as
+    // given and hits closer than 0.0001 are ignored. A reference for the GPU traversal, steps
+    // gets each ray's traversal steps if not null. Returns -1 if the CWBVH isn't encoded.
+    extern PLUGIN_FN int IntersectCWBVHRays(int64_t handle, const BVHRay* rays, int count, BVHHit* hits, uint32_t* steps);
+    // Rays traced by the queries since the last reset, how many of them took the packet
+    // traversal, and the time spent in the queries. Any may be null.
+    extern PLUGIN_FN void GetRayQueryStats(int64_t* rays, int64_t* packetRays, double* seconds);
+    extern PLUGIN_FN void ResetRayQueryStats();
+    extern PLUGIN_FN void* GetBVHPtr(int64_t handle);
+    extern PLUGIN_FN int64_t GetCWBVHNodesSize(int64_t handle);
+    extern PLUGIN_FN int64_t GetCWBVHTrisSize(int64_t handle);
+    extern PLUGIN_FN bool GetCWBVHData(int64_t handle, tinybvh::bvhvec4** bvhNodes, tinybvh::bvhvec4** bvhTris);
+    // Writes an encoded BVH's triangles to caller memory decoded to the uncompressed layout, node
+    // by node, for checking compressed triangles against an uncompressed build off the GPU.
+    // Returns the bytes needed, and only writes them if they fit in capacity.
+    extern PLUGIN_FN int64_t DecodeCWBVHTris(int64_t handle, tinybvh::bvhvec4* tris, int64_t capacity);
+    // Writes the CWBVH nodes and triangles to caller memory, such as a mapped GPU buffer.
+    // Capacities are in bytes; returns false if the BVH isn't ready or doesn't fit.
+    extern PLUGIN_FN bool WriteCWBVHData(int64_t handle, tinybvh::bvhvec4* bvhNodes, int64_t nodesCapacity, tinybvh::bvhvec4* bvhTris, int64_t trisCapacity);
+    // Writes the CWBVH nodes and triangles at byte offsets of paged buffers. Returns false if
+    // the BVH isn't ready, the pages are invalid, or the data doesn't fit.
+    extern PLUGIN_FN bool WriteCWBVHDataPaged(int64_t handle, const BVHPagedBuffer* nodes, int64_t nodesOffset, const BVHPagedBuffer* tris, int64_t trisOffset);
+    // Lays out BLASes in pages of at most pageSize bytes, such as the largest storage buffer
+    // binding the GPU allows, without splitting any BLAS across two pages. Node pages hold
+    // pageSize / 80 nodes and triangle pages pageSize / 16 float4s. Fills one entry per BLAS,
+    // and the bytes used in each node and triangle page, count each and 0 past the last page.
+    // Returns false if a BLAS isn't ready or doesn't fit in a page.
+    extern PLUGIN_FN bool LayoutBVHPages(const int64_t* handles, int count, int64_t pageSize, BVHPageEntry* table,
+                                         int64_t* nodePageSizes, int64_t* triPageSizes);
+
+    // Builds every mesh in parallel and packs the results into one node and one triangle
+    // arena. meshOffsets are in vertices from the start of the vertex array. qualities holds
+    // one BVHBuildQuality per mesh, or is null to use the default for all. Once ready,
+    // offsets holds the byte offsets of each mesh's nodes and triangles, two per mesh.
+    extern PLUGIN_FN int64_t BuildBVHBatch(tinybvh::bvhvec4* vertices, const int* meshOffsets, const int* triCounts, const int* qualities, int meshCount);
+    // Builds a batch without packing it, WriteBVHBatchData encodes every mesh in parallel
+    // straight into caller memory. GetBVHBatchData returns false for these batches.
+    extern PLUGIN_FN int64_t BuildBVHBatchDeferred(tinybvh::bvhvec4* vertices, const int* meshOffsets, const int* triCounts, const int* qualities, int meshCount);
+    // Indexed meshes: vertexOffsets are in vertices, indexOffsets in indices, and each mesh's
+    // indices are relative to its first vertex.
+    extern PLUGIN_FN int64_t BuildBVHBatchIndexedDeferred(tinybvh::bvhvec4* vertices, const int* vertexOffsets, const int* vertexCounts,
+                                                      const uint32_t* indices, const int* indexOffsets, const int* triCounts,
+                                                      const int* qualities, int meshCount);
+    extern PLUGIN_FN void DestroyBVHBatch(int64_t handle);
+    extern PLUGIN_FN bool IsBVHBatchReady(int64_t handle);
+    extern PLUGIN_FN void WaitForBVHBatch(int64_t handle);
+    // Like GetBVHVersion, for every mesh of the batch. Swapping in improved meshes changes the
+    // batch's sizes and offsets.
+    extern PLUGIN_FN int GetBVHBatchVersion(int64_t handle);
+    extern PLUGIN_FN bool IsBVHBatchImproving(int64_t handle);
+    extern PLUGIN_FN int64_t GetBVHBatchNodesSize(int64_t handle);
+    extern PLUGIN_FN int64_t GetBVHBatchTrisSize(int64_t handle);
+    extern PLUGIN_FN int64_t* GetBVHBatchOffsets(int64_t handle);
+    extern PLUGIN_FN bool GetBVHBatchData(int64_t handle, tinybvh::bvhvec4** bvhNodes, tinybvh::bvhvec4** bvhTris, int64_t** offsets);
+    extern PLUGIN_FN bool WriteBVHBatchData(int64_t handle, tinybvh::bvhvec4* bvhNodes, int64_t nodesCapacity, tinybvh::bvhvec4* bvhTris, int64_t trisCapacity);
+    // Like LayoutBVHPages, for the meshes of a batch.
+    extern PLUGIN_FN bool LayoutBVHBatchPages(int64_t handle, int64_t pageSize, BVHPageEntry* table,
+                                              int64_t* nodePageSizes, int64_t* triPageSizes);
+    // Like WriteBVHBatchData, into paged buffers. Meshes go where table puts them, one entry
+    // per mesh from LayoutBVHBatchPages, or at the batch's offsets if table is null.
+    extern PLUGIN_FN bool WriteBVHBatchDataPaged(int64_t handle, const BVHPagedBuffer* nodes, const BVHPagedBuffer* tris, const BVHPageEntry* table);
+
+    extern PLUGIN_FN int64_t BuildTLAS(tinybvh::BLASInstance* instances, int instanceCount);
+    // Rebuilds an existing TLAS from scratch, reusing its buffers when they are large enough
+    // and growing them geometrically otherwise.
+    extern PLUGIN_FN bool RebuildTLAS(int64_t handle, tinybvh::BLASInstance* instances, int instanceCount);
+    // Fits an existing TLAS to the instances' new bounds without changing its topology, in
+    // time linear in the instance count. Falls back to a full build once the SAH cost has
+    // grown past the rebuild threshold or the instance count changed, returns true if so.
+    extern PLUGIN_FN bool RefitTLAS(int64_t handle, tinybvh::BLASInstance* instances, int instanceCount);
+    // Ratio of SAH cost growth that triggers a rebuild in RefitTLAS, 1.5 by default.
+    extern PLUGIN_FN void SetTLASRebuildThreshold(float threshold);
+    // Current SAH cost of the TLAS relative to its last full build.
+    extern PLUGIN_FN float GetTLASCostRatio(int64_t handle);
+    extern PLUGIN_FN void DestroyTLAS(int64_t handle);
+    extern PLUGIN_FN bool IsTLASReady(int64_t handle);
+    extern PLUGIN_FN int GetTLASNodesSize(int64_t handle);
+    extern PLUGIN_FN bool GetTLASData(int64_t handle, tinybvh::bvhvec4** tlasNodes, uint32_t** tlasIndices);
+    // Parts of the TLAS that changed with the last build, rebuild or refit. tlasData holds the
+    // GPU nodes followed by the instance indices, laid out like GetTLASData's arrays back to
+    // back, and ranges holds a byte offset and size into it for each changed range.
+    extern PLUGIN_FN bool GetTLASDirtyRanges(int64_t handle, uint8_t** tlasData, int** ranges, int* rangeCount);
+
+    // Query scenes trace rays on the CPU through both levels of a scene, like tlas.hlsl does on
+    // the GPU. A scene refers to BLASes by handle, blasIdx of its instances indexes
+    // blasHandles. BLASes without a binary BVH, lean or mapped from the cache, are traced
+    // through their CWBVH like IntersectRays does. The BLASes must outlive the scene.
+    extern PLUGIN_FN int64_t CreateQueryScene(const int64_t* blasHandles, int blasCount);
+    // Copies the instances, as passed to BuildTLAS, and builds the scene's TLAS over them.
+    // Must be called again after a BLAS is refit or swapped for its improved version, queries
+    // return -1 once a BLAS the TLAS was built with has changed since. Returns false if a BLAS
+    // isn't ready or an instance's blasIdx is out of range.
+    extern PLUGIN_FN bool SetQuerySceneInstances(int64_t handle, const tinybvh::BLASInstance* instances, int instanceCount);
+    extern PLUGIN_FN void DestroyQueryScene(int64_t handle);
+    // Like IntersectRays and IsOccludedRays, for a query scene. Rays are traced one by one on
+    // the worker pool, and the scene must not change during the call.
+    extern PLUGIN_FN int IntersectSceneRays(int64_t handle, const BVHRay* rays, int count, BVHSceneHit* hits);
+    extern PLUGIN_FN int IsOccludedSceneRays(int64_t handle, const BVHRay* rays, int count, uint8_t* occluded);
+
+    // Renders a pass of the PathTracer kernel on the CPU, in tiles across the worker pool, with
+    // the same traversal, materials, lights and sky. output holds a float4 per pixel, row by
+    // row, and like the kernel's output texture it is blended with the previous pass unless
+    // currentSample is 0. Returns false if a buffer the settings need is missing.
+    extern PLUGIN_FN bool RenderReference(const ReferenceScene* scene, const ReferenceRenderSettings* settings, tinybvh::bvhvec4* output);
+    // Pixel samples and rays RenderReference traced since the last reset, and the time it
+    // took, to work out samples per second. Any may be null.
+    extern PLUGIN_FN void GetReferenceRenderStats(int64_t* samples, int64_t* rays, double* seconds);
+    extern PLUGIN_FN void ResetReferenceRenderStats();
 }
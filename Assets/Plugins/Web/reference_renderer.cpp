@@ -0,0 +1,1629 @@
+#include "reference_renderer.h"
+
+#include "cwbvh_traversal.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using tinybvh::bvhvec2;
+using tinybvh::bvhvec3;
+using tinybvh::bvhvec4;
+
+static_assert(sizeof(MaterialData) == 128, "MaterialData must match common.hlsl");
+static_assert(sizeof(TriangleAttributes) == 128, "TriangleAttributes must match triangle_attributes.hlsl");
+static_assert(sizeof(LightData) == 64, "LightData must match Light in common.hlsl");
+static_assert(sizeof(GPUInstance) == 160, "GPUInstance must match BLASInstance in common.hlsl");
+
+// The functions below follow the shader functions of the same names, in the same order of
+// operations and random numbers, so a pass renders the image the kernel would. Only the
+// parts PathTracer.compute uses are ported, HLSL's float literals are floats here too.
+
+static const float EPSILON = 0.0001f;
+static const float PI = 3.14159265358979323f;
+static const float INV_PI = 0.31830988618379067f;
+static const float TWO_PI = 6.28318530717958648f;
+static const float INV_TWO_PI = 0.15915494309189533f;
+static const float FAR_PLANE = 100000.0f;
+
+// PathTracer.compute
+static const float ANTIALIASING_STANDARD_DEVIATION = 0.4246609f;
+
+static const int SKY_MODE_ENVIRONMENT = 0;
+static const int SKY_MODE_BASIC = 1;
+
+static const float ALPHA_MODE_BLEND = 1.0f;
+static const float ALPHA_MODE_MASK = 2.0f;
+
+static const uint32_t LIGHT_TYPE_SPOT = 0;
+static const uint32_t LIGHT_TYPE_POINT = 2;
+static const uint32_t LIGHT_TYPE_RECTANGLE = 3;
+
+static const uint32_t INTERSECT_TRIANGLE = 0;
+static const uint32_t INTERSECT_LIGHT = 1;
+
+// TLAS depth is bounded by the instance count, not the shaders' BVH_STACK_SIZE of 32.
+static const int kTLASStackSize = 256;
+
+// The shader globals and buffers, and the rays traced so far.
+struct RenderContext
+{
+    const ReferenceScene& scene;
+    const ReferenceRenderSettings& settings;
+    bool simd;
+    int64_t rays;
+};
+
+struct Ray
+{
+    bvhvec3 origin;
+    bvhvec3 direction;
+};
+
+struct RayHit
+{
+    bvhvec3 position;
+    float distance;
+    bvhvec2 barycentric;
+    uint32_t triIndex;
+    bvhvec3 normal;
+    bvhvec3 tangent;
+    int materialIndex;
+    bvhvec3 ffnormal;
+    uint32_t intersectType;
+    bvhvec2 uv;
+};
+
+struct ScatterSampleRec
+{
+    bvhvec3 L;
+    float pdf;
+    bvhvec3 f;
+};
+
+struct LightSampleRec
+{
+    bvhvec3 normal;
+    float pdf;
+    bvhvec3 emission;
+    float distance;
+    bvhvec3 direction;
+};
+
+struct Material
+{
+    bvhvec3 baseColor;
+    float opacity;
+    bvhvec3 emission;
+    float alphaMode;
+    float alphaCutoff;
+    float anisotropic;
+    float metallic;
+    float roughness;
+    float subsurface;
+    float specularTint;
+    float sheen;
+    float sheenTint;
+    float clearcoat;
+    float clearcoatRoughness;
+    float specTrans;
+    float ior;
+    float ax;
+    float ay;
+    float eta;
+    float occlusion;
+};
+
+// Rows of a float3x3, as GetONB builds it.
+struct Basis
+{
+    bvhvec3 x;
+    bvhvec3 y;
+    bvhvec3 z;
+};
+
+// HLSL intrinsics. max and min return the other operand for NaNs, as fmaxf and fminf do.
+
+static inline float Dot(const bvhvec3& a, const bvhvec3& b)
+{
+    return tinybvh::tinybvh_dot(a, b);
+}
+
+static inline bvhvec3 Cross(const bvhvec3& a, const bvhvec3& b)
+{
+    return tinybvh::tinybvh_cross(a, b);
+}
+
+static inline float Length(const bvhvec3& v)
+{
+    return sqrtf(Dot(v, v));
+}
+
+// Unlike tinybvh_normalize, a zero vector gives NaNs like it does in the shaders.
+static inline bvhvec3 Normalize(const bvhvec3& v)
+{
+    return v * (1.0f / sqrtf(Dot(v, v)));
+}
+
+static inline bvhvec3 Div(const bvhvec3& v, float s)
+{
+    return bvhvec3(v.x / s, v.y / s, v.z / s);
+}
+
+static inline float Clamp(float x, float lo, float hi)
+{
+    return fminf(fmaxf(x, lo), hi);
+}
+
+static inline float Saturate(float x)
+{
+    return Clamp(x, 0.0f, 1.0f);
+}
+
+static inline float Lerp(float a, float b, float t)
+{
+    return a + t * (b - a);
+}
+
+static inline bvhvec3 Lerp(const bvhvec3& a, const bvhvec3& b, float t)
+{
+    return a + t * (b - a);
+}
+
+static inline bvhvec4 Lerp(const bvhvec4& a, const bvhvec4& b, float t)
+{
+    return a + t * (b - a);
+}
+
+static inline bvhvec3 Pow(const bvhvec3& v, float e)
+{
+    return bvhvec3(powf(v.x, e), powf(v.y, e), powf(v.z, e));
+}
+
+static inline bvhvec3 Reflect(const bvhvec3& i, const bvhvec3& n)
+{
+    return i - 2.0f * Dot(n, i) * n;
+}
+
+static inline bvhvec3 Refract(const bvhvec3& i, const bvhvec3& n, float eta)
+{
+    float cosi = Dot(n, i);
+    float k = 1.0f - eta * eta * (1.0f - cosi * cosi);
+    if (k < 0.0f)
+        return bvhvec3(0.0f);
+    return eta * i - (eta * cosi + sqrtf(k)) * n;
+}
+
+static inline float AsFloat(uint32_t bits)
+{
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static inline uint32_t AsUint(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+// mul(M, float4(v, w)).xyz of a matrix stored column by column.
+static bvhvec3 Mul(const float* m, const bvhvec3& v, float w)
+{
+    return bvhvec3(
+        m[0] * v.x + m[4] * v.y + m[8] * v.z + m[12] * w,
+        m[1] * v.x + m[5] * v.y + m[9] * v.z + m[13] * w,
+        m[2] * v.x + m[6] * v.y + m[10] * v.z + m[14] * w);
+}
+
+// mul(float4(v, 0.0f), M).xyz, the transposed matrix the shaders transform normals with.
+static bvhvec3 MulTransposed(const float* m, const bvhvec3& v)
+{
+    return bvhvec3(
+        m[0] * v.x + m[1] * v.y + m[2] * v.z,
+        m[4] * v.x + m[5] * v.y + m[6] * v.z,
+        m[8] * v.x + m[9] * v.y + m[10] * v.z);
+}
+
+// random.hlsl
+
+static void RngNextInt(uint32_t& state)
+{
+    uint32_t oldState = state + 747796405u + 2891336453u;
+    uint32_t word = ((oldState >> ((oldState >> 28u) + 4u)) ^ oldState) * 277803737u;
+    state = (word >> 22u) ^ word;
+}
+
+static float RandomFloat(uint32_t& state)
+{
+    RngNextInt(state);
+    return (float)state / (float)0xffffffffu;
+}
+
+static Basis GetONB(bvhvec3 z);
+
+static bvhvec3 RandomCosineHemisphere(const bvhvec3& normal, uint32_t& state)
+{
+    float theta = acosf(sqrtf(RandomFloat(state)));
+    float phi = 2.0f * PI * RandomFloat(state);
+    Basis onb = GetONB(normal);
+    return sinf(theta) * (cosf(phi) * onb.x + sinf(phi) * onb.y + cosf(theta) * onb.z);
+}
+
+// common.hlsl
+
+static float Luminance(const bvhvec3& color)
+{
+    return Dot(color, bvhvec3(0.299f, 0.587f, 0.114f));
+}
+
+static void ConcentricSampleDisk(float u1, float u2, float& dx, float& dy)
+{
+    float sx = 2.0f * u1 - 1.0f;
+    float sy = 2.0f * u2 - 1.0f;
+
+    if (sx == 0.0f && sy == 0.0f)
+    {
+        dx = 0.0f;
+        dy = 0.0f;
+        return;
+    }
+
+    float r, theta;
+    if (sx >= -sy)
+    {
+        if (sx > sy)
+        {
+            r = sx;
+            if (sy > 0.0f)
+                theta = sy / r;
+            else
+                theta = 8.0f + sy / r;
+        }
+        else
+        {
+            r = sy;
+            theta = 2.0f - sx / r;
+        }
+    }
+    else
+    {
+        if (sx <= sy)
+        {
+            r = -sx;
+            theta = 4.0f - sy / r;
+        }
+        else
+        {
+            r = -sy;
+            theta = 6.0f + sx / r;
+        }
+    }
+
+    theta *= PI / 4.0f;
+
+    dx = r * cosf(theta);
+    dy = r * sinf(theta);
+}
+
+// ONB_METHOD 1.
+static Basis GetONB(bvhvec3 z)
+{
+    float lenSq = Dot(z, z);
+    if (lenSq == 0.0f)
+        return { bvhvec3(1.0f, 0.0f, 0.0f), bvhvec3(0.0f, 1.0f, 0.0f), bvhvec3(0.0f, 0.0f, 1.0f) };
+
+    z = Normalize(z);
+    float k = 1.0f / fmaxf(1.0f + z.z, 0.00001f);
+    float a = z.y * k;
+    float b = z.y * a;
+    float c = -z.x * a;
+
+    bvhvec3 x = Normalize(bvhvec3(z.z + b, c, -z.x));
+    bvhvec3 y = Normalize(bvhvec3(c, 1.0f - b, -z.y));
+    return { x, y, z };
+}
+
+static bvhvec3 ToWorld(const Basis& basis, const bvhvec3& local)
+{
+    return basis.x * local.x + basis.y * local.y + basis.z * local.z;
+}
+
+static bvhvec3 ToLocal(const Basis& basis, const bvhvec3& world)
+{
+    return bvhvec3(Dot(basis.x, world), Dot(basis.y, world), Dot(basis.z, world));
+}
+
+// sampling.hlsl
+
+static float GTR1(float NDotH, float a)
+{
+    if (a >= 1.0f)
+        return INV_PI;
+
+    float a2 = a * a;
+    float t = 1.0f + (a2 - 1.0f) * NDotH * NDotH;
+    return (a2 - 1.0f) / (PI * logf(a2) * t);
+}
+
+static bvhvec3 SampleGTR1(float rgh, float r1, float r2)
+{
+    float a = fmaxf(0.001f, rgh);
+    float a2 = a * a;
+
+    float phi = r1 * TWO_PI;
+
+    float cosTheta = sqrtf((1.0f - powf(a2, 1.0f - r2)) / (1.0f - a2));
+    float sinTheta = Clamp(sqrtf(1.0f - (cosTheta * cosTheta)), 0.0f, 1.0f);
+    float sinPhi = sinf(phi);
+    float cosPhi = cosf(phi);
+
+    return bvhvec3(sinTheta * cosPhi, sinTheta * sinPhi, cosTheta);
+}
+
+static bvhvec3 SampleGGXVNDF(const bvhvec3& V, float ax, float ay, float r1, float r2)
+{
+    bvhvec3 Vh = Normalize(bvhvec3(ax * V.x, ay * V.y, V.z));
+
+    float lensq = Vh.x * Vh.x + Vh.y * Vh.y;
+    bvhvec3 T1 = lensq > 0.0f ? bvhvec3(-Vh.y, Vh.x, 0.0f) * (1.0f / sqrtf(lensq)) : bvhvec3(1.0f, 0.0f, 0.0f);
+    bvhvec3 T2 = Cross(Vh, T1);
+
+    float r = sqrtf(r1);
+    float phi = 2.0f * PI * r2;
+    float t1 = r * cosf(phi);
+    float t2 = r * sinf(phi);
+    float s = 0.5f * (1.0f + Vh.z);
+    t2 = (1.0f - s) * sqrtf(1.0f - t1 * t1) + s * t2;
+
+    bvhvec3 Nh = t1 * T1 + t2 * T2 + sqrtf(fmaxf(0.0f, 1.0f - t1 * t1 - t2 * t2)) * Vh;
+
+    return Normalize(bvhvec3(ax * Nh.x, ay * Nh.y, fmaxf(0.0f, Nh.z)));
+}
+
+static float GTR2Aniso(float NDotH, float HDotX, float HDotY, float ax, float ay)
+{
+    float a = HDotX / ax;
+    float b = HDotY / ay;
+    float c = a * a + b * b + NDotH * NDotH;
+    return 1.0f / (PI * ax * ay * c * c);
+}
+
+static float SmithG(float NDotV, float alphaG)
+{
+    float a = alphaG * alphaG;
+    float b = NDotV * NDotV;
+    return (2.0f * NDotV) / (NDotV + sqrtf(a + b - a * b));
+}
+
+static float SmithGAniso(float NDotV, float VDotX, float VDotY, float ax, float ay)
+{
+    float a = VDotX * ax;
+    float b = VDotY * ay;
+    float c = NDotV;
+    return (2.0f * NDotV) / (NDotV + sqrtf(a * a + b * b + c * c));
+}
+
+static float SchlickWeight(float u)
+{
+    float m = Clamp(1.0f - u, 0.0f, 1.0f);
+    float m2 = m * m;
+    return m2 * m2 * m;
+}
+
+static float DielectricFresnel(float cosThetaI, float eta)
+{
+    float sinThetaTSq = eta * eta * (1.0f - cosThetaI * cosThetaI);
+
+    // Total internal reflection
+    if (sinThetaTSq > 1.0f)
+        return 1.0f;
+
+    float cosThetaT = sqrtf(fmaxf(1.0f - sinThetaTSq, 0.0f));
+
+    float rs = (eta * cosThetaT - cosThetaI) / (eta * cosThetaT + cosThetaI);
+    float rp = (eta * cosThetaI - cosThetaT) / (eta * cosThetaI + cosThetaT);
+
+    return 0.5f * (rs * rs + rp * rp);
+}
+
+static bvhvec3 CosineSampleHemisphere(float r1, float r2)
+{
+    bvhvec3 dir;
+    float r = sqrtf(r1);
+    float phi = TWO_PI * r2;
+    dir.x = r * cosf(phi);
+    dir.y = r * sinf(phi);
+    dir.z = sqrtf(fmaxf(0.0f, 1.0f - dir.x * dir.x - dir.y * dir.y));
+    return dir;
+}
+
+static float PowerHeuristic(float a, float b)
+{
+    float t = a * a;
+    return t / (b * b + t);
+}
+
+// texture.hlsl
+
+static bvhvec4 GetTexturePixel(const uint32_t* textureData, uint32_t textureDataOffset, uint32_t width, uint32_t height,
+                               uint32_t x, uint32_t y)
+{
+    x = std::min(x, width - 1);
+    y = std::min(y, height - 1);
+
+    uint32_t pixelData = textureData[textureDataOffset + (y * width + x)];
+    float r = (pixelData & 0xFF) / 255.0f;
+    float g = ((pixelData >> 8) & 0xFF) / 255.0f;
+    float b = ((pixelData >> 16) & 0xFF) / 255.0f;
+    float a = ((pixelData >> 24) & 0xFF) / 255.0f;
+    return bvhvec4(r, g, b, a);
+}
+
+static bvhvec4 SampleTexture(const RenderContext& ctx, int textureIndex, bvhvec2 uv, bool linearSample)
+{
+    if (textureIndex < 0)
+        return bvhvec4(0.0f);
+
+    const uint32_t* textureData = ctx.scene.textureData;
+    uint32_t descriptorOffset = textureIndex * 4;
+    uint32_t width = textureData[descriptorOffset + 0];
+    uint32_t height = textureData[descriptorOffset + 1];
+    uint32_t offset = textureData[descriptorOffset + 2];
+
+    // The shader would loop forever on infinite coordinates, sample the first texel instead.
+    float u = std::isfinite(uv.x) ? uv.x : 0.0f;
+    float v = std::isfinite(uv.y) ? uv.y : 0.0f;
+    while (u > 1.0f)
+        u -= 1.0f;
+    while (v > 1.0f)
+        v -= 1.0f;
+    while (u < 0.0f)
+        u += 1.0f;
+    while (v < 0.0f)
+        v += 1.0f;
+
+    float tu = u * (width - 1.0f);
+    float tv = v * (height - 1.0f);
+
+    uint32_t tx = (uint32_t)tu;
+    uint32_t ty = (uint32_t)tv;
+
+    bvhvec4 p1 = GetTexturePixel(textureData, offset, width, height, tx, ty);
+    if (!linearSample)
+        return p1;
+
+    float uFraction = tu - tx;
+    float vFraction = tv - ty;
+    bvhvec4 p2 = GetTexturePixel(textureData, offset, width, height, tx + 1, ty);
+    bvhvec4 p3 = GetTexturePixel(textureData, offset, width, height, tx, ty + 1);
+    bvhvec4 p4 = GetTexturePixel(textureData, offset, width, height, tx + 1, ty + 1);
+    return Lerp(Lerp(p1, p2, uFraction), Lerp(p3, p4, uFraction), vFraction);
+}
+
+// material.hlsl
+
+static bvhvec3 GetEmission(const RenderContext& ctx, const MaterialData& material, bvhvec2 uv)
+{
+    if (ctx.scene.textureData == nullptr || material.textures2.y < 0.0f)
+        return bvhvec3(material.data2);
+    return bvhvec3(SampleTexture(ctx, (int)material.textures2.y, uv, true));
+}
+
+static bvhvec2 GetMetallicRoughness(const RenderContext& ctx, const MaterialData& material, bvhvec2 uv)
+{
+    if (ctx.scene.textureData == nullptr || material.textures1.y < 0.0f)
+        return bvhvec2(material.data3);
+    bvhvec4 pixel = SampleTexture(ctx, (int)material.textures1.y, uv, true);
+    return bvhvec2(pixel.z, pixel.y * pixel.y);
+}
+
+static bvhvec4 GetBaseColorOpacity(const RenderContext& ctx, const MaterialData& material, bvhvec2 uv)
+{
+    if (ctx.scene.textureData == nullptr || material.textures1.x < 0.0f)
+        return material.data1;
+    uv = uv * bvhvec2(material.texture1Transform.x, material.texture1Transform.y) +
+         bvhvec2(material.texture1Transform.z, material.texture1Transform.w);
+    bvhvec4 pixel = SampleTexture(ctx, (int)material.textures1.x, uv, true);
+    return pixel * material.data1;
+}
+
+static float GetOcclusion(const RenderContext& ctx, const MaterialData& material, bvhvec2 uv)
+{
+    if (ctx.scene.textureData == nullptr || material.textures2.z < 0.0f)
+        return 1.0f;
+    float pixel = SampleTexture(ctx, (int)material.textures2.z, uv, true).x;
+    return 1.0f + (pixel - 1.0f);
+}
+
+static Material GetMaterial(const RenderContext& ctx, const MaterialData& materialData, const Ray& ray, const RayHit& hit)
+{
+    bvhvec2 uv = hit.uv;
+
+    bvhvec4 baseColorOpacity = GetBaseColorOpacity(ctx, materialData, uv);
+
+    Material material;
+    material.baseColor = bvhvec3(baseColorOpacity);
+    material.opacity = baseColorOpacity.w;
+    material.alphaMode = materialData.data4.x;
+    material.alphaCutoff = materialData.data2.w;
+    material.emission = GetEmission(ctx, materialData, uv);
+    bvhvec2 metallicRoughness = GetMetallicRoughness(ctx, materialData, uv);
+    material.metallic = metallicRoughness.x;
+    material.roughness = fmaxf(metallicRoughness.y, 0.001f);
+    material.subsurface = materialData.data5.z;
+    material.specularTint = materialData.data4.w;
+    material.sheen = materialData.data5.x;
+    material.sheenTint = materialData.data5.y;
+    material.clearcoat = materialData.data5.w;
+    material.clearcoatRoughness = Lerp(0.1f, 0.001f, materialData.data6.x);
+    material.specTrans = 1.0f - Saturate(baseColorOpacity.w);
+    material.ior = Clamp(materialData.data3.w, 1.001f, 2.0f);
+    material.anisotropic = Clamp(materialData.data4.y, -0.9f, 0.9f);
+    material.occlusion = GetOcclusion(ctx, materialData, uv);
+
+    float aspect = sqrtf(1.0f - material.anisotropic * 0.9f);
+    material.ax = fmaxf(0.001f, material.roughness / aspect);
+    material.ay = fmaxf(0.001f, material.roughness * aspect);
+
+    material.eta = (Dot(ray.direction, hit.normal) < 0.0f) ? 1.0f / material.ior : material.ior;
+
+    return material;
+}
+
+// brdf.hlsl
+
+static void TintColors(const Material& mat, float eta, float& F0, bvhvec3& Csheen, bvhvec3& Cspec0)
+{
+    float lum = Luminance(mat.baseColor);
+    bvhvec3 ctint = lum > 0.0f ? Div(mat.baseColor, lum) : bvhvec3(1.0f);
+
+    F0 = (1.0f - eta) / (1.0f + eta);
+    F0 *= F0;
+
+    Cspec0 = F0 * Lerp(bvhvec3(1.0f), ctint, mat.specularTint);
+    Csheen = Lerp(bvhvec3(1.0f), ctint, mat.sheenTint);
+}
+
+static bvhvec3 EvalDiffuse(const Material& mat, const bvhvec3& Csheen, const bvhvec3& V, const bvhvec3& L, const bvhvec3& H, float& pdf)
+{
+    pdf = 0.0f;
+    if (L.z <= 0.0f)
+        return bvhvec3(0.0f);
+
+    float LDotH = Dot(L, H);
+
+    float Rr = 2.0f * mat.roughness * LDotH * LDotH;
+
+    // Diffuse
+    float FL = SchlickWeight(L.z);
+    float FV = SchlickWeight(V.z);
+    float Fretro = Rr * (FL + FV + FL * FV * (Rr - 1.0f));
+    float Fd = (1.0f - 0.5f * FL) * (1.0f - 0.5f * FV);
+
+    // Fake subsurface
+    float Fss90 = 0.5f * Rr;
+    float Fss = Lerp(1.0f, Fss90, FL) * Lerp(1.0f, Fss90, FV);
+    float ss = 1.25f * (Fss * (1.0f / (L.z + V.z) - 0.5f) + 0.5f);
+
+    // Sheen
+    float FH = SchlickWeight(LDotH);
+    bvhvec3 Fsheen = FH * mat.sheen * Csheen;
+
+    pdf = L.z * INV_PI;
+    return INV_PI * mat.baseColor * Lerp(Fd + Fretro, ss, mat.subsurface) + Fsheen;
+}
+
+static bvhvec3 EvalMicrofacetReflection(const Material& mat, const bvhvec3& V, const bvhvec3& L, const bvhvec3& H, const bvhvec3& F, float& pdf)
+{
+    pdf = 0.0f;
+    if (L.z <= 0.0f)
+        return bvhvec3(0.0f);
+
+    float D = GTR2Aniso(H.z, H.x, H.y, mat.ax, mat.ay);
+    float G1 = SmithGAniso(fabsf(V.z), V.x, V.y, mat.ax, mat.ay);
+    float G2 = G1 * SmithGAniso(fabsf(L.z), L.x, L.y, mat.ax, mat.ay);
+
+    pdf = G1 * D / (4.0f * V.z);
+    return Div(F * D * G2, 4.0f * L.z * V.z);
+}
+
+static bvhvec3 EvalMicrofacetRefraction(const Material& mat, float eta, const bvhvec3& V, const bvhvec3& L, const bvhvec3& H, const bvhvec3& F, float& pdf)
+{
+    pdf = 0.0f;
+    if (L.z >= 0.0f)
+        return bvhvec3(0.0f);
+
+    float LDotH = Dot(L, H);
+    float VDotH = Dot(V, H);
+
+    float D = GTR2Aniso(H.z, H.x, H.y, mat.ax, mat.ay);
+    float G1 = SmithGAniso(fabsf(V.z), V.x, V.y, mat.ax, mat.ay);
+    float G2 = G1 * SmithGAniso(fabsf(L.z), L.x, L.y, mat.ax, mat.ay);
+    float denom = LDotH + VDotH * eta;
+    denom *= denom;
+    float eta2 = eta * eta;
+    float jacobian = fabsf(LDotH) / denom;
+
+    pdf = G1 * fmaxf(0.0f, VDotH) * D * jacobian / V.z;
+    return Div(Pow(mat.baseColor, 0.5f) * (bvhvec3(1.0f) - F) * D * G2 * fabsf(VDotH) * jacobian * eta2, fabsf(L.z * V.z));
+}
+
+static bvhvec3 EvalClearcoat(const Material& mat, const bvhvec3& V, const bvhvec3& L, const bvhvec3& H, float& pdf)
+{
+    pdf = 0.0f;
+    if (L.z <= 0.0f)
+        return bvhvec3(0.0f);
+
+    float VDotH = Dot(V, H);
+
+    float F = Lerp(0.04f, 1.0f, SchlickWeight(VDotH));
+    float D = GTR1(H.z, mat.clearcoatRoughness);
+    float G = SmithG(L.z, 0.25f) * SmithG(V.z, 0.25f);
+    float jacobian = 1.0f / (4.0f * VDotH);
+
+    pdf = D * H.z * jacobian;
+    return bvhvec3(F) * D * G;
+}
+
+// _EvalBRDF
+static bvhvec3 EvalBRDFLocal(const Material& mat, bvhvec3 V, bvhvec3 L, const Basis& onb, float& pdf)
+{
+    pdf = 0.0f;
+    bvhvec3 f(0.0f);
+
+    V = ToLocal(onb, V);
+    L = ToLocal(onb, L);
+
+    bvhvec3 H;
+    if (L.z > 0.0f)
+        H = Normalize(L + V);
+    else
+        H = Normalize(L + V * mat.eta);
+
+    if (H.z < 0.0f)
+        H = -H;
+
+    // Tint colors
+    bvhvec3 Csheen, Cspec0;
+    float F0;
+    TintColors(mat, mat.eta, F0, Csheen, Cspec0);
+
+    // Model weights
+    float dielectricWt = (1.0f - mat.metallic) * (1.0f - mat.specTrans);
+    float metalWt = mat.metallic;
+    float glassWt = (1.0f - mat.metallic) * mat.specTrans;
+
+    // Lobe probabilities
+    float schlickWt = SchlickWeight(V.z);
+
+    float diffPr = dielectricWt * Luminance(mat.baseColor);
+    float dielectricPr = dielectricWt * Luminance(Lerp(Cspec0, bvhvec3(1.0f), schlickWt));
+    float metalPr = metalWt * Luminance(Lerp(mat.baseColor, bvhvec3(1.0f), schlickWt));
+    float glassPr = glassWt;
+    float clearCtPr = 0.25f * mat.clearcoat;
+
+    // Normalize probabilities
+    float invTotalWt = 1.0f / (diffPr + dielectricPr + metalPr + glassPr + clearCtPr);
+    diffPr *= invTotalWt;
+    dielectricPr *= invTotalWt;
+    metalPr *= invTotalWt;
+    glassPr *= invTotalWt;
+    clearCtPr *= invTotalWt;
+
+    bool reflect = L.z * V.z > 0.0f;
+
+    float tmpPdf = 0.0f;
+    float VDotH = fabsf(Dot(V, H));
+
+    // Diffuse
+    if (diffPr > 0.0f && reflect)
+    {
+        f += EvalDiffuse(mat, Csheen, V, L, H, tmpPdf) * dielectricWt;
+        pdf += tmpPdf * diffPr;
+    }
+
+    // Dielectric Reflection
+    if (dielectricPr > 0.0f && reflect)
+    {
+        // Normalize for interpolating based on Cspec0
+        float F = 0.0f;
+        if (F0 != 1.0f && mat.ior != 0.0f)
+        {
+            float invEta = 1.0f / mat.ior;
+            float invF0 = 1.0f - F0;
+            invF0 = 1.0f / invF0;
+            F = (DielectricFresnel(VDotH, invEta) - F0) * invF0;
+        }
+
+        f += EvalMicrofacetReflection(mat, V, L, H, Lerp(Cspec0, bvhvec3(1.0f), F), tmpPdf) * dielectricWt;
+        pdf += tmpPdf * dielectricPr;
+    }
+
+    // Metallic Reflection
+    if (metalPr > 0.0f && reflect)
+    {
+        // Tinted to base color
+        bvhvec3 F = Lerp(mat.baseColor, bvhvec3(1.0f), SchlickWeight(VDotH));
+
+        f += EvalMicrofacetReflection(mat, V, L, H, F, tmpPdf) * metalWt;
+        pdf += tmpPdf * metalPr;
+    }
+
+    // Glass/Specular BSDF
+    if (glassPr > 0.0f)
+    {
+        // Dielectric fresnel (achromatic)
+        float F = DielectricFresnel(VDotH, mat.eta);
+
+        if (reflect)
+        {
+            f += EvalMicrofacetReflection(mat, V, L, H, bvhvec3(F), tmpPdf) * glassWt;
+            pdf += tmpPdf * glassPr * F;
+        }
+        else
+        {
+            f += EvalMicrofacetRefraction(mat, mat.eta, V, L, H, bvhvec3(F), tmpPdf) * glassWt;
+            pdf += tmpPdf * glassPr * (1.0f - F);
+        }
+    }
+
+    // Clearcoat
+    if (clearCtPr > 0.0f && reflect)
+    {
+        f += EvalClearcoat(mat, V, L, H, tmpPdf) * 0.25f * mat.clearcoat;
+        pdf += tmpPdf * clearCtPr;
+    }
+
+    f *= mat.occlusion;
+
+    return f * fabsf(L.z);
+}
+
+static bvhvec3 EvalBRDF(const Material& mat, const bvhvec3& V, const bvhvec3& N, const bvhvec3& L, float& pdf)
+{
+    Basis onb = GetONB(N);
+    return EvalBRDFLocal(mat, V, L, onb, pdf);
+}
+
+static bvhvec3 SampleBRDF(const Material& mat, bvhvec3 V, const bvhvec3& N, bvhvec3& L, float& pdf, uint32_t& rngState)
+{
+    pdf = 0.0f;
+
+    float r1 = RandomFloat(rngState);
+    float r2 = RandomFloat(rngState);
+
+    Basis onb = GetONB(N);
+
+    V = ToLocal(onb, V);
+
+    // Tint colors
+    bvhvec3 Csheen, Cspec0;
+    float F0;
+    TintColors(mat, mat.eta, F0, Csheen, Cspec0);
+
+    // Model weights
+    float dielectricWt = (1.0f - mat.metallic) * (1.0f - mat.specTrans);
+    float metalWt = mat.metallic;
+    float glassWt = (1.0f - mat.metallic) * mat.specTrans;
+
+    // Lobe probabilities
+    float schlickWt = SchlickWeight(V.z);
+
+    float diffPr = dielectricWt * Luminance(mat.baseColor);
+    float dielectricPr = dielectricWt * Luminance(Lerp(Cspec0, bvhvec3(1.0f), schlickWt));
+    float metalPr = metalWt * Luminance(Lerp(mat.baseColor, bvhvec3(1.0f), schlickWt));
+    float glassPr = glassWt;
+    float clearCtPr = 0.25f * mat.clearcoat;
+
+    // Normalize probabilities
+    float invTotalWt = 1.0f / (diffPr + dielectricPr + metalPr + glassPr + clearCtPr);
+    diffPr *= invTotalWt;
+    dielectricPr *= invTotalWt;
+    metalPr *= invTotalWt;
+    glassPr *= invTotalWt;
+    clearCtPr *= invTotalWt;
+
+    // CDF of the sampling probabilities
+    float cdf0 = diffPr;
+    float cdf1 = cdf0 + dielectricPr;
+    float cdf2 = cdf1 + metalPr;
+    float cdf3 = cdf2 + glassPr;
+
+    // Sample a lobe based on its importance
+    float r3 = RandomFloat(rngState);
+
+    if (r3 < cdf0) // Diffuse
+    {
+        L = CosineSampleHemisphere(r1, r2);
+    }
+    else if (r3 < cdf2) // Dielectric + Metallic reflection
+    {
+        bvhvec3 H = SampleGGXVNDF(V, mat.ax, mat.ay, r1, r2);
+
+        if (H.z < 0.0f)
+            H = -H;
+
+        L = Normalize(Reflect(-V, H));
+    }
+    else if (r3 < cdf3) // Glass
+    {
+        bvhvec3 H = SampleGGXVNDF(V, mat.ax, mat.ay, r1, r2);
+        float F = DielectricFresnel(fabsf(Dot(V, H)), mat.eta);
+
+        if (H.z < 0.0f)
+            H = -H;
+
+        // Rescale random number for reuse
+        r3 = (r3 - cdf2) / (cdf3 - cdf2);
+
+        // Reflection
+        if (r3 < F)
+            L = Normalize(Reflect(-V, H));
+        else // Transmission
+            L = Normalize(Refract(-V, H, mat.eta));
+    }
+    else // Clearcoat
+    {
+        bvhvec3 H = SampleGTR1(mat.clearcoatRoughness, r1, r2);
+
+        if (H.z < 0.0f)
+            H = -H;
+
+        L = Normalize(Reflect(-V, H));
+    }
+
+    L = ToWorld(onb, L);
+    V = ToWorld(onb, V);
+
+    return EvalBRDFLocal(mat, V, L, onb, pdf);
+}
+
+// sky.hlsl
+
+// SampleLevel of the environment texture with the bilinear, repeating sampler Unity gives
+// the render texture the shader samples.
+static bvhvec3 SampleEnvironmentTexture(const ReferenceScene& scene, bvhvec2 uv)
+{
+    int width = scene.environmentTextureWidth;
+    int height = scene.environmentTextureHeight;
+    float x = uv.x * width - 0.5f;
+    float y = uv.y * height - 0.5f;
+    float fx = floorf(x);
+    float fy = floorf(y);
+    int x0 = (static_cast<int>(fx) % width + width) % width;
+    int y0 = (static_cast<int>(fy) % height + height) % height;
+    int x1 = (x0 + 1) % width;
+    int y1 = (y0 + 1) % height;
+
+    const bvhvec4* pixels = scene.environmentTexture;
+    bvhvec4 top = Lerp(pixels[y0 * width + x0], pixels[y0 * width + x1], x - fx);
+    bvhvec4 bottom = Lerp(pixels[y1 * width + x0], pixels[y1 * width + x1], x - fx);
+    return bvhvec3(Lerp(top, bottom, y - fy));
+}
+
+static bvhvec2 BinarySearch(const ReferenceScene& scene, float value)
+{
+    int width = scene.environmentTextureWidth;
+    int height = scene.environmentTextureHeight;
+    const float* cdf = scene.environmentCdf;
+
+    int lower = 0;
+    int upper = height - 1;
+    while (lower < upper)
+    {
+        int mid = (lower + upper) >> 1;
+        int idx = mid * width + width - 1;
+        if (value < cdf[idx])
+            upper = mid;
+        else
+            lower = mid + 1;
+    }
+
+    int y = std::min(std::max(lower, 0), height - 1);
+
+    lower = 0;
+    upper = width - 1;
+    while (lower < upper)
+    {
+        int mid = (lower + upper) >> 1;
+        int idx = y * width + mid;
+        if (value < cdf[idx])
+            upper = mid;
+        else
+            lower = mid + 1;
+    }
+
+    int x = std::min(std::max(lower, 0), width - 1);
+    return bvhvec2((float)x / (float)width, (float)y / (float)height);
+}
+
+static bvhvec4 EvalEnvMap(const RenderContext& ctx, const bvhvec3& r, float intensity)
+{
+    const ReferenceScene& scene = ctx.scene;
+    float theta = acosf(Clamp(r.y, -1.0f, 1.0f));
+    float r_atan = atan2f(r.z, r.x);
+    bvhvec2 uv = bvhvec2((PI + r_atan) * INV_TWO_PI, 1.0f - theta * INV_PI) + bvhvec2(ctx.settings.environmentMapRotation, 0.0f);
+
+    uv.x = fmodf(uv.x, 1.0f);
+    uv.y = fmodf(uv.y, 1.0f);
+    if (uv.x < 0.0f)
+        uv.x += 1.0f;
+    if (uv.y < 0.0f)
+        uv.y += 1.0f;
+
+    bvhvec3 color = SampleEnvironmentTexture(scene, uv);
+    float pdf = Luminance(color) / scene.environmentCdfSum;
+    pdf = (pdf * scene.environmentTextureWidth * scene.environmentTextureHeight) / (TWO_PI * PI * sinf(theta));
+    return bvhvec4(color * intensity, pdf);
+}
+
+static bvhvec4 SampleEnvMap(const RenderContext& ctx, bvhvec3& color, uint32_t& rngState)
+{
+    const ReferenceScene& scene = ctx.scene;
+    float rnd = RandomFloat(rngState) * scene.environmentCdfSum;
+    bvhvec2 uv = BinarySearch(scene, rnd);
+    uv.y = 1.0f - uv.y;
+
+    color = SampleEnvironmentTexture(scene, uv);
+    float pdf = Luminance(color) / scene.environmentCdfSum;
+
+    uv.x -= ctx.settings.environmentMapRotation;
+    float phi = uv.x * TWO_PI;
+    float theta = uv.y * PI;
+
+    float sinTheta = sinf(theta);
+    if (sinTheta == 0.0f)
+        pdf = 0.0f;
+
+    return bvhvec4(-sinTheta * cosf(phi), cosf(theta), -sinTheta * sinf(phi),
+                   (pdf * scene.environmentTextureWidth * scene.environmentTextureHeight) / (TWO_PI * PI * sinTheta));
+}
+
+static bvhvec4 EnvironmentSky(const RenderContext& ctx, const bvhvec3& r, float intensity)
+{
+    if (ctx.scene.environmentTexture != nullptr)
+        return EvalEnvMap(ctx, r, intensity);
+
+    float pdf = 1.0f / (4.0f * PI);
+    return bvhvec4(ctx.settings.environmentColor * intensity, pdf);
+}
+
+static bvhvec4 BasicSky(const bvhvec3& r, float intensity)
+{
+    float pdf = 1.0f / (4.0f * PI);
+    float a = Saturate(0.5f * (r.y + 1.0f));
+    bvhvec3 color = (1.0f - a) * bvhvec3(1.0f) + a * Pow(bvhvec3(0.5f, 0.7f, 1.0f), 2.2f);
+    return bvhvec4(color * intensity, pdf);
+}
+
+static bvhvec4 SampleSkyRadiance(const RenderContext& ctx, const bvhvec3& direction, int rayDepth)
+{
+    bvhvec4 radiance(0.0f);
+    float intensity = rayDepth > 0 ? ctx.settings.environmentIntensity : 1.0f;
+    if (ctx.settings.environmentMode == SKY_MODE_ENVIRONMENT)
+        radiance = EnvironmentSky(ctx, direction, intensity);
+    else if (ctx.settings.environmentMode == SKY_MODE_BASIC)
+        radiance = BasicSky(direction, intensity);
+    return radiance;
+}
+
+// intersect.hlsl
+
+static float RectIntersect(const bvhvec3& pos, const bvhvec3& u, const bvhvec3& v, const bvhvec4& plane, const Ray& r)
+{
+    bvhvec3 n = bvhvec3(plane);
+    float dt = Dot(r.direction, n);
+    float t = (plane.w - Dot(n, r.origin)) / dt;
+    float res = FAR_PLANE;
+
+    if (t > EPSILON)
+    {
+        bvhvec3 p = r.origin + r.direction * t;
+        bvhvec3 vi = p - pos;
+        float a1 = Dot(u, vi);
+        if (a1 >= 0.0f && a1 <= 1.0f)
+        {
+            float a2 = Dot(v, vi);
+            if (a2 >= 0.0f && a2 <= 1.0f)
+                res = t;
+        }
+    }
+
+    return res;
+}
+
+static void IntersectLights(const RenderContext& ctx, const Ray& ray, RayHit& hit)
+{
+    for (int i = 0; i < ctx.scene.lightCount; ++i)
+    {
+        const LightData& light = ctx.scene.lights[i];
+        if (light.type == LIGHT_TYPE_RECTANGLE)
+        {
+            bvhvec3 normal = Normalize(Cross(light.u, light.v));
+            bvhvec4 plane = bvhvec4(normal, Dot(normal, light.position));
+            bvhvec3 u = Div(light.u, Dot(light.u, light.u));
+            bvhvec3 v = Div(light.v, Dot(light.v, light.v));
+            float d = RectIntersect(light.position, u, v, plane, ray);
+            if (d > 0.0f && d < hit.distance && Dot(normal, ray.direction) < 0.0f)
+            {
+                hit.distance = d;
+                hit.position = ray.origin + d * ray.direction;
+                hit.normal = normal;
+                hit.ffnormal = Dot(hit.normal, ray.direction) <= 0.0f ? hit.normal : -hit.normal;
+                hit.triIndex = i;
+                hit.intersectType = INTERSECT_LIGHT;
+            }
+        }
+    }
+}
+
+// bvh.hlsl and tlas.hlsl
+
+static bvhvec2 InterpolateAttribute(const bvhvec2& barycentric, const bvhvec2& attr0, const bvhvec2& attr1, const bvhvec2& attr2)
+{
+    return attr0 * (1.0f - barycentric.x - barycentric.y) + attr1 * barycentric.x + attr2 * barycentric.y;
+}
+
+static bvhvec3 InterpolateAttribute(const bvhvec2& barycentric, const bvhvec3& attr0, const bvhvec3& attr1, const bvhvec3& attr2)
+{
+    return attr0 * (1.0f - barycentric.x - barycentric.y) + attr1 * barycentric.x + attr2 * barycentric.y;
+}
+
+// RayIntersectBvh of bvh.hlsl, for scenes without a TLAS. Shadow rays stop at the first hit,
+// which is all ShadowRayIntersect asks about.
+static bool RayIntersectBvh(RenderContext& ctx, const Ray& ray, RayHit& hit, bool isShadowRay)
+{
+    const ReferenceScene& scene = ctx.scene;
+    CWBVHRay bvhRay = { ray.origin, ray.direction, 0.0001f };
+    CWBVHHit bvhHit = { hit.distance, 0.0f, 0.0f, 0, 0, 0 };
+    if (IntersectCWBVH(scene.bvhNodes, scene.bvhTris, scene.compressedTris != 0, bvhRay, bvhHit, isShadowRay, ctx.simd))
+    {
+        hit.barycentric = bvhvec2(bvhHit.u, bvhHit.v);
+        hit.triIndex = bvhHit.triIndex;
+        hit.distance = bvhHit.distance;
+    }
+
+    if (!isShadowRay && hit.distance < FAR_PLANE)
+    {
+        const TriangleAttributes& triAttr = scene.triangleAttributes[hit.triIndex];
+
+        hit.position = ray.origin + hit.distance * ray.direction;
+        hit.tangent = Normalize(InterpolateAttribute(hit.barycentric, triAttr.tangent0, triAttr.tangent1, triAttr.tangent2));
+        hit.normal = Normalize(InterpolateAttribute(hit.barycentric, triAttr.normal0, triAttr.normal1, triAttr.normal2));
+        hit.ffnormal = Dot(hit.normal, ray.direction) <= 0.0f ? hit.normal : -hit.normal;
+        hit.uv = InterpolateAttribute(hit.barycentric, triAttr.uv0, triAttr.uv1, triAttr.uv2);
+        hit.materialIndex = triAttr.materialIndex;
+        hit.intersectType = INTERSECT_TRIANGLE;
+    }
+
+    return hit.distance < FAR_PLANE;
+}
+
+// RayIntersectBvh of tlas.hlsl, for an instance of a TLAS. Returns whether the instance was hit.
+static bool RayIntersectInstance(RenderContext& ctx, const Ray& worldRay, const GPUInstance& instance, bool isShadowRay, RayHit& hit)
+{
+    const ReferenceScene& scene = ctx.scene;
+    const bvhvec3 localOrigin = Mul(instance.worldToLocal, worldRay.origin, 1.0f);
+    // To handle instance scale, transform the ray direction to local space but do not normalize it
+    const bvhvec3 localDirection = Mul(instance.worldToLocal, worldRay.direction, 0.0f);
+
+    // Like LoadBVHNode and LoadBVHTri, without BVH_PAGED every instance is in the first page.
+    const bvhvec4* nodes = instance.bvhPage != 0 && scene.bvhNodes1 != nullptr ? scene.bvhNodes1 : scene.bvhNodes;
+    const bvhvec4* tris = instance.triPage != 0 && scene.bvhTris1 != nullptr ? scene.bvhTris1 : scene.bvhTris;
+
+    CWBVHRay localRay = { localOrigin, localDirection, 0.0f };
+    CWBVHHit bvhHit = { hit.distance, 0.0f, 0.0f, 0, 0, 0 };
+    if (!IntersectCWBVH(nodes + static_cast<size_t>(instance.bvhOffset) * 5, tris + instance.triOffset, scene.compressedTris != 0,
+                        localRay, bvhHit, isShadowRay, ctx.simd))
+        return false;
+
+    hit.barycentric = bvhvec2(bvhHit.u, bvhHit.v);
+    hit.triIndex = instance.triAttributeOffset + bvhHit.triIndex;
+    hit.distance = bvhHit.distance;
+
+    if (!isShadowRay)
+    {
+        const TriangleAttributes& triAttr = scene.triangleAttributes[hit.triIndex];
+
+        hit.intersectType = INTERSECT_TRIANGLE;
+
+        // To handle instance scale, get the local space hit position and transform it back to world space
+        hit.position = Mul(instance.localToWorld, localOrigin + hit.distance * localDirection, 1.0f);
+        hit.distance = Length(hit.position - worldRay.origin);
+
+        hit.uv = InterpolateAttribute(hit.barycentric, triAttr.uv0, triAttr.uv1, triAttr.uv2);
+
+        bvhvec3 normal = Normalize(InterpolateAttribute(hit.barycentric, triAttr.normal0, triAttr.normal1, triAttr.normal2));
+        // Use the transposed inverse to transform the normal to world space
+        hit.normal = Normalize(MulTransposed(instance.worldToLocal, normal));
+
+        bvhvec3 tangent = Normalize(InterpolateAttribute(hit.barycentric, triAttr.tangent0, triAttr.tangent1, triAttr.tangent2));
+        hit.tangent = Normalize(Mul(instance.localToWorld, tangent, 0.0f));
+
+        hit.ffnormal = Dot(hit.normal, worldRay.direction) <= 0.0f ? hit.normal : -hit.normal;
+
+        hit.materialIndex = instance.materialIndex;
+    }
+
+    return true;
+}
+
+static bool RayIntersectTLAS(RenderContext& ctx, const Ray& ray, RayHit& hit, bool isShadowRay)
+{
+    const float* tlasData = ctx.scene.tlasData;
+    bvhvec3 O = ray.origin;
+    bvhvec3 D = Normalize(ray.direction);
+    bvhvec3 rD = bvhvec3(1.0f / D.x, 1.0f / D.y, 1.0f / D.z);
+
+    bool hitFound = false;
+    uint32_t stack[kTLASStackSize];
+    uint32_t nodeIndex = 0;
+    uint32_t stackPtr = 0;
+
+    while (true)
+    {
+        const float* node = tlasData + nodeIndex * 16;
+
+        uint32_t instanceCount = AsUint(node[11]);
+
+        if (instanceCount == 0)
+        {
+            bvhvec3 lmin(node[0], node[1], node[2]);
+            bvhvec3 lmax(node[4], node[5], node[6]);
+            bvhvec3 rmin(node[8], node[9], node[10]);
+            bvhvec3 rmax(node[12], node[13], node[14]);
+
+            uint32_t left = AsUint(node[3]);
+            uint32_t right = AsUint(node[7]);
+
+            // child AABB intersection tests
+            bvhvec3 t1a = (lmin - O) * rD;
+            bvhvec3 t2a = (lmax - O) * rD;
+            bvhvec3 minta(fminf(t1a.x, t2a.x), fminf(t1a.y, t2a.y), fminf(t1a.z, t2a.z));
+            bvhvec3 maxta(fmaxf(t1a.x, t2a.x), fmaxf(t1a.y, t2a.y), fmaxf(t1a.z, t2a.z));
+            float tmina = fmaxf(fmaxf(fmaxf(minta.x, minta.y), minta.z), 0.0f);
+            float tmaxa = fminf(fminf(fminf(maxta.x, maxta.y), maxta.z), hit.distance);
+            float dist1 = tmina > tmaxa ? FAR_PLANE : tmina;
+
+            bvhvec3 t1b = (rmin - O) * rD;
+            bvhvec3 t2b = (rmax - O) * rD;
+            bvhvec3 mintb(fminf(t1b.x, t2b.x), fminf(t1b.y, t2b.y), fminf(t1b.z, t2b.z));
+            bvhvec3 maxtb(fmaxf(t1b.x, t2b.x), fmaxf(t1b.y, t2b.y), fmaxf(t1b.z, t2b.z));
+            float tminb = fmaxf(fmaxf(fmaxf(mintb.x, mintb.y), mintb.z), 0.0f);
+            float tmaxb = fminf(fminf(fminf(maxtb.x, maxtb.y), maxtb.z), hit.distance);
+            float dist2 = tminb > tmaxb ? FAR_PLANE : tminb;
+
+            // traverse nearest child first
+            if (dist1 > dist2)
+            {
+                std::swap(dist1, dist2);
+                std::swap(left, right);
+            }
+
+            if (dist1 == FAR_PLANE)
+            {
+                if (stackPtr > 0)
+                    nodeIndex = stack[--stackPtr];
+                else
+                    break;
+            }
+            else
+            {
+                nodeIndex = left;
+                if (dist2 != FAR_PLANE)
+                    stack[stackPtr++] = right;
+            }
+        }
+
+        if (instanceCount > 0)
+        {
+            uint32_t firstInstance = AsUint(node[15]);
+
+            for (uint32_t i = 0; i < instanceCount; ++i)
+            {
+                uint32_t instanceIndex = AsUint(tlasData[ctx.scene.tlasIndexOffset + firstInstance + i]);
+                hitFound = RayIntersectInstance(ctx, ray, ctx.scene.blasInstances[instanceIndex], isShadowRay, hit) || hitFound;
+                if (hitFound && isShadowRay)
+                    return true;
+            }
+
+            if (stackPtr > 0)
+                nodeIndex = stack[--stackPtr];
+            else
+                break;
+        }
+    }
+
+    return hitFound;
+}
+
+static bool RayIntersect(RenderContext& ctx, const Ray& ray, RayHit& hit)
+{
+    ctx.rays++;
+    hit.distance = FAR_PLANE;
+
+    if (ctx.scene.tlasData != nullptr)
+        RayIntersectTLAS(ctx, ray, hit, false);
+    else
+        RayIntersectBvh(ctx, ray, hit, false);
+
+    IntersectLights(ctx, ray, hit);
+
+    return hit.distance < FAR_PLANE;
+}
+
+static bool ShadowRayIntersect(RenderContext& ctx, const Ray& ray)
+{
+    ctx.rays++;
+    RayHit hit = {};
+    hit.distance = FAR_PLANE;
+    if (ctx.scene.tlasData != nullptr)
+        return RayIntersectTLAS(ctx, ray, hit, true);
+    return RayIntersectBvh(ctx, ray, hit, true);
+}
+
+// light.hlsl
+
+static bool SampleRectLight(const RenderContext& ctx, const LightData& light, const bvhvec3& scatterPos, LightSampleRec& lightSample, uint32_t& rngState)
+{
+    float r1 = RandomFloat(rngState);
+    float r2 = RandomFloat(rngState);
+
+    bvhvec3 lightSurfacePos = light.position + light.u * r1 + light.v * r2;
+    lightSample.direction = lightSurfacePos - scatterPos;
+    lightSample.distance = Length(lightSample.direction);
+
+    float distSq = lightSample.distance * lightSample.distance;
+    lightSample.direction = Div(lightSample.direction, lightSample.distance);
+    lightSample.normal = Normalize(Cross(light.u, light.v));
+    lightSample.emission = light.emission * float(ctx.scene.lightCount);
+    lightSample.pdf = distSq / (light.area * fabsf(Dot(lightSample.normal, lightSample.direction)));
+
+    return true;
+}
+
+static bool SamplePointLight(const LightData& light, const bvhvec3& scatterPos, LightSampleRec& lightSample)
+{
+    lightSample.normal = Normalize(scatterPos - light.position);
+    lightSample.emission = light.emission;
+    lightSample.direction = -lightSample.normal;
+    lightSample.distance = Length(scatterPos - light.position);
+    lightSample.pdf = 0.0f;
+
+    return true;
+}
+
+static bool SampleSpotLight(const LightData& light, const bvhvec3& scatterPos, LightSampleRec& lightSample)
+{
+    lightSample.normal = Normalize(light.u);
+    lightSample.emission = light.emission;
+    lightSample.direction = -Normalize(scatterPos - light.position);
+    lightSample.distance = Length(light.position - scatterPos);
+    lightSample.pdf = 0.0f;
+
+    return true;
+}
+
+static bool SampleOneLight(const RenderContext& ctx, const LightData& light, const bvhvec3& scatterPos, LightSampleRec& lightSample, uint32_t& rngState)
+{
+    uint32_t type = light.type;
+    bool result = false;
+    if (type == LIGHT_TYPE_SPOT)
+        result = SampleSpotLight(light, scatterPos, lightSample);
+    else if (type == LIGHT_TYPE_RECTANGLE)
+        result = SampleRectLight(ctx, light, scatterPos, lightSample, rngState);
+    else if (type == LIGHT_TYPE_POINT)
+        result = SamplePointLight(light, scatterPos, lightSample);
+    return result;
+}
+
+static bvhvec3 EvalLight(RenderContext& ctx, const Ray& ray, const RayHit& hit, const Material& mat, const LightData& light,
+                         const bvhvec3& scatterPos, const LightSampleRec& lightSample)
+{
+    float falloff = 1.0f;
+    if (lightSample.distance > light.range)
+    {
+        falloff = 0.0f;
+    }
+    else
+    {
+        float r = lightSample.distance / light.range;
+        float atten = Saturate(1.0f / (1.0f + 25.0f * r * r) * Saturate((1.0f - r) * 5.0f));
+        falloff *= atten;
+    }
+
+    if (light.type == LIGHT_TYPE_RECTANGLE)
+    {
+        // Only light in the forward direction of the light.
+        float cosTheta = Dot(Normalize(-lightSample.direction), Normalize(lightSample.normal));
+        falloff = cosTheta < 0.0f ? 0.0f : falloff;
+    }
+
+    if (light.type == LIGHT_TYPE_SPOT)
+    {
+        // v.x and v.y are the cosines of the outer and inner spotlight angles.
+        float cosTheta = Dot(Normalize(-lightSample.direction), Normalize(lightSample.normal));
+        if (cosTheta < light.v.x)
+            falloff = 0.0f;
+        else if (cosTheta > light.v.x && cosTheta < light.v.y)
+            falloff *= (cosTheta - light.v.x) / (light.v.y - light.v.x);
+    }
+
+    bvhvec3 Li = light.emission * falloff;
+    bvhvec3 Ld(0.0f);
+
+    Ray shadowRay = { scatterPos, lightSample.direction };
+    bool inShadow = ShadowRayIntersect(ctx, shadowRay);
+    if (!inShadow)
+    {
+        float pdf = 0.0f;
+        bvhvec3 f = EvalBRDF(mat, -ray.direction, hit.normal, lightSample.direction, pdf);
+        float lightPdf = 1.0f;
+        if (lightSample.pdf > 0.0f)
+            lightPdf = lightSample.pdf;
+        Ld += Div(Li * f, lightPdf);
+    }
+
+    return Ld;
+}
+
+static bvhvec3 DirectLight(RenderContext& ctx, const Ray& ray, const RayHit& hit, const Material& mat, uint32_t& rngState)
+{
+    const ReferenceScene& scene = ctx.scene;
+    const ReferenceRenderSettings& settings = ctx.settings;
+    bvhvec3 Ld(0.0f);
+    bvhvec3 scatterPos = hit.position + hit.normal * EPSILON;
+
+    ScatterSampleRec scatterSample = {};
+    if (settings.environmentMode == 0)
+    {
+        if (scene.environmentTexture != nullptr)
+        {
+            bvhvec3 Li(0.0f);
+            bvhvec4 dirPdf = SampleEnvMap(ctx, Li, rngState);
+            bvhvec3 lightDir = bvhvec3(dirPdf);
+            float lightPdf = dirPdf.w;
+            Ray shadowRay = { scatterPos, lightDir };
+            bool inShadow = ShadowRayIntersect(ctx, shadowRay);
+            if (!inShadow)
+            {
+                scatterSample.f = EvalBRDF(mat, -ray.direction, hit.ffnormal, lightDir, scatterSample.pdf);
+                if (scatterSample.pdf > 0.0f)
+                {
+                    float misWeight = PowerHeuristic(lightPdf, scatterSample.pdf);
+                    if (misWeight > 0.0f)
+                        Ld += Div(misWeight * Li * scatterSample.f * settings.environmentIntensity, lightPdf);
+                }
+            }
+        }
+        else
+        {
+            bvhvec3 Li = settings.environmentColor * settings.environmentIntensity;
+            float lightPdf = 1.0f / (4.0f * PI);
+            bvhvec3 lightDir = Normalize(RandomCosineHemisphere(hit.normal, rngState));
+            Ray shadowRay = { scatterPos, lightDir };
+            bool inShadow = ShadowRayIntersect(ctx, shadowRay);
+            if (!inShadow)
+            {
+                scatterSample.f = EvalBRDF(mat, -ray.direction, hit.ffnormal, lightDir, scatterSample.pdf);
+                if (scatterSample.pdf > 0.0f)
+                {
+                    float misWeight = PowerHeuristic(lightPdf, scatterSample.pdf);
+                    if (misWeight > 0.0f)
+                        Ld += Div(misWeight * Li * scatterSample.f, lightPdf);
+                }
+            }
+        }
+    }
+
+    if (scene.lightCount > 0)
+    {
+        LightSampleRec lightSample = {};
+
+        // Pick a light to sample. A random float of exactly 1 picks one past the last light,
+        // which the GPU reads as zeros.
+        int lightIndex = int(RandomFloat(rngState) * float(scene.lightCount));
+        LightData light = lightIndex < scene.lightCount ? scene.lights[lightIndex] : LightData {};
+
+        if (SampleOneLight(ctx, light, scatterPos, lightSample, rngState))
+            Ld += EvalLight(ctx, ray, hit, mat, light, scatterPos, lightSample);
+    }
+
+    return Ld;
+}
+
+// pathtrace.hlsl
+
+static bvhvec3 PathTrace(RenderContext& ctx, Ray ray, uint32_t& rngState)
+{
+    const ReferenceRenderSettings& settings = ctx.settings;
+    bvhvec3 radiance(0.0f);
+    bvhvec3 throughput(1.0f);
+
+    ScatterSampleRec scatterSample = {};
+
+    const uint32_t maxRayBounces = std::max(settings.maxRayBounces, 1u);
+
+    RayHit hit = {};
+
+    float maxRoughness = 0.0f;
+
+    uint32_t rayDepth = 0;
+    for (; ; ++rayDepth)
+    {
+        bool didHit = RayIntersect(ctx, ray, hit);
+
+        if (!didHit)
+        {
+            bvhvec4 skyColorPDf = SampleSkyRadiance(ctx, ray.direction, rayDepth);
+            float misWeight = 1.0f;
+            // Gather radiance from envmap and use scatterSample.pdf from previous bounce for MIS
+            if (rayDepth > 0)
+                misWeight = PowerHeuristic(scatterSample.pdf, skyColorPDf.w);
+            if (misWeight > 0.0f)
+                radiance += misWeight * bvhvec3(skyColorPDf) * throughput;
+            break;
+        }
+
+        if (ctx.scene.lightCount > 0 && hit.intersectType == INTERSECT_LIGHT)
+        {
+            const LightData& light = ctx.scene.lights[hit.triIndex];
+            radiance += light.emission * throughput;
+            break;
+        }
+
+        Material material = GetMaterial(ctx, ctx.scene.materials[hit.materialIndex], ray, hit);
+
+        // Keep track of the maximum roughness to prevent firefly artifacts
+        // by forcing subsequent bounces to be at least as rough
+        maxRoughness = fmaxf(maxRoughness, material.roughness);
+        material.roughness = maxRoughness;
+
+        // Gather radiance from emissive objects. Emission from meshes is not importance sampled
+        radiance += material.emission * throughput;
+
+        if (rayDepth >= maxRayBounces)
+            break;
+
+        // Ignore intersection and continue ray based on alpha test
+        if ((material.alphaMode == ALPHA_MODE_MASK && material.opacity < material.alphaCutoff) ||
+            (material.alphaMode == ALPHA_MODE_BLEND && RandomFloat(rngState) > material.opacity))
+        {
+            scatterSample.L = ray.direction;
+            rayDepth--;
+        }
+        else
+        {
+            // Next event estimation
+            radiance += DirectLight(ctx, ray, hit, material, rngState) * throughput;
+
+            // Sample BSDF for color and outgoing direction
+            scatterSample.f = SampleBRDF(material, -ray.direction, hit.ffnormal, scatterSample.L, scatterSample.pdf, rngState);
+
+            if (std::isnan(scatterSample.f.x) || std::isnan(scatterSample.f.y) || std::isnan(scatterSample.f.z))
+            {
+                radiance = bvhvec3(0.0f, 1.0f, 0.0f);
+                break;
+            }
+
+            if (scatterSample.pdf > 0.0f)
+                throughput = throughput * Div(scatterSample.f, scatterSample.pdf);
+            else
+                break;
+        }
+
+        // Move ray origin to hit point and set direction for next bounce
+        ray.direction = scatterSample.L;
+        ray.origin = hit.position + ray.direction * EPSILON;
+
+        // Russian roulette termination
+        if (settings.useRussianRoulette)
+        {
+            float rrPcont = fminf(fmaxf(throughput.x, fmaxf(throughput.y, throughput.z)) + 0.001f, 0.95f);
+            if (RandomFloat(rngState) >= rrPcont)
+                break;
+            throughput = Div(throughput, rrPcont);
+        }
+    }
+
+    return radiance;
+}
+
+// camera.hlsl
+
+static Ray GetScreenRay(const RenderContext& ctx, bvhvec2 pixelCoords, uint32_t& rngState)
+{
+    const ReferenceRenderSettings& settings = ctx.settings;
+    bvhvec3 origin = Mul(settings.camToWorld, bvhvec3(0.0f), 1.0f);
+
+    // Compute world space direction
+    bvhvec2 uv = bvhvec2(pixelCoords.x / settings.outputWidth * 2.0f - 1.0f, pixelCoords.y / settings.outputHeight * 2.0f - 1.0f);
+    bvhvec3 direction = Mul(settings.camInvProj, bvhvec3(uv.x, uv.y, 0.0f), 1.0f);
+    direction = Normalize(Mul(settings.camToWorld, direction, 0.0f));
+
+    if (settings.aperture > 0.0f && settings.focalLength > 0.0f)
+    {
+        float sampleLensU = RandomFloat(rngState);
+        float sampleLensV = RandomFloat(rngState);
+        float lensU, lensV;
+        ConcentricSampleDisk(sampleLensU, sampleLensV, lensU, lensV);
+
+        float lensRadius = settings.aperture * 0.5f;
+        lensU *= lensRadius;
+        lensV *= lensRadius;
+
+        float ft = settings.focalLength;
+        bvhvec3 focalPoint = origin + direction * ft;
+
+        origin = Mul(settings.camToWorld, bvhvec3(lensU, lensV, 0.0f), 1.0f);
+        direction = Normalize(focalPoint - origin);
+    }
+
+    return { origin, direction };
+}
+
+// PathTracer.compute
+
+static bvhvec2 SampleGaussian(float u, float v)
+{
+    const float r = sqrtf(-2.0f * logf(fmaxf(1e-38f, u)));
+    const float theta = 2.0f * PI * v;
+    return r * bvhvec2(cosf(theta), sinf(theta));
+}
+
+int64_t RenderReferenceTile(const ReferenceScene& scene, const ReferenceRenderSettings& settings, bool simd,
+                            int x0, int y0, int x1, int y1, bvhvec4* output)
+{
+    RenderContext ctx = { scene, settings, simd, 0 };
+
+    const int numSamples = std::max(1, settings.samplesPerPass);
+    const float fSamples = (float)numSamples;
+
+    for (int pixelY = y0; pixelY < y1; ++pixelY)
+    {
+        for (int pixelX = x0; pixelX < x1; ++pixelX)
+        {
+            const uint32_t pixelIndex = pixelY * settings.outputWidth + pixelX;
+            bvhvec2 pixelCoords((float)pixelX, (float)pixelY);
+
+            uint32_t rngState = pixelIndex * (settings.currentSample + 1) + settings.rngSeedRoot;
+
+            bvhvec3 color(0.0f);
+            for (int sampleIndex = 0; sampleIndex < numSamples; ++sampleIndex)
+            {
+                // HLSL evaluates SampleGaussian's arguments left to right, C++ needn't.
+                float u = RandomFloat(rngState);
+                float v = RandomFloat(rngState);
+                bvhvec2 subpixelOffset = bvhvec2(0.5f, 0.5f) + ANTIALIASING_STANDARD_DEVIATION * SampleGaussian(u, v);
+
+                Ray ray = GetScreenRay(ctx, pixelCoords + subpixelOffset, rngState);
+
+                bvhvec3 radiance = PathTrace(ctx, ray, rngState);
+
+                if (settings.useFireflyFilter)
+                {
+                    float lum = Luminance(radiance);
+                    if (lum > settings.maxFireflyLuminance)
+                        radiance *= settings.maxFireflyLuminance / lum;
+                }
+
+                color += radiance;
+            }
+
+            bvhvec4& pixel = output[pixelIndex];
+            if (settings.currentSample > 0)
+            {
+                float currentSample = (float)settings.currentSample;
+                pixel = bvhvec4(Div(color + bvhvec3(pixel) * currentSample, currentSample + fSamples), 1.0f);
+            }
+            else
+            {
+                pixel = bvhvec4(Div(color, fSamples), 1.0f);
+            }
+        }
+    }
+
+    return ctx.rays;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "plugin.h"
+
+// Renders columns [x0, x1) of rows [y0, y1) of a PathTracer kernel pass into output, pixel
+// by pixel with the same steps as PathTracer.compute and pathtrace.hlsl, so the image can be
+// compared against the GPU's. simd selects the SSE2 CWBVH node test. Returns the number of
+// rays traced, camera, bounce and shadow rays alike.
+int64_t RenderReferenceTile(const ReferenceScene& scene, const ReferenceRenderSettings& settings, bool simd,
+                            int x0, int y0, int x1, int y1, tinybvh::bvhvec4* output);
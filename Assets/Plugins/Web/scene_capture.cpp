@@ -0,0 +1,105 @@
+#include "scene_capture.h"
+
+#include <chrono>
+
+SceneCapture& SceneCapture::Get()
+{
+    static SceneCapture instance;
+    return instance;
+}
+
+int64_t SceneCapture::Now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool SceneCapture::Start(const char* path)
+{
+    Stop();
+    if (path == nullptr || path[0] == '\0')
+        return false;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _file = fopen(path, "wb");
+    if (_file == nullptr)
+        return false;
+
+    CaptureFileHeader header = {};
+    header.magic = kCaptureMagic;
+    header.captureVersion = kCaptureVersion;
+    header.tinybvhVersion = TINY_BVH_VERSION_SUB + (TINY_BVH_VERSION_MINOR << 8) + (TINY_BVH_VERSION_MAJOR << 16);
+    header.vertexSize = sizeof(tinybvh::bvhvec4);
+    header.instanceSize = sizeof(tinybvh::BLASInstance);
+    if (fwrite(&header, sizeof(header), 1, _file) != 1)
+    {
+        fclose(_file);
+        _file = nullptr;
+        return false;
+    }
+
+    _startTime = Now();
+    _active.store(true);
+    return true;
+}
+
+void SceneCapture::Stop()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _active.store(false);
+    if (_file != nullptr)
+    {
+        fclose(_file);
+        _file = nullptr;
+    }
+}
+
+void SceneCapture::Record(CaptureRecordType type, int count, int quality, int64_t startTime, int64_t handle,
+                          const CaptureArray* arrays, int arrayCount)
+{
+    CaptureRecord record = {};
+    record.type = type;
+    record.count = count;
+    record.quality = quality;
+    record.startTime = startTime;
+    record.duration = Now() - startTime;
+    record.handle = handle;
+    Write(record, arrays, arrayCount);
+}
+
+void SceneCapture::RecordDestroy(CaptureRecordType type, int64_t handle)
+{
+    CaptureRecord record = {};
+    record.type = type;
+    record.startTime = Now();
+    record.handle = handle;
+    Write(record, nullptr, 0);
+}
+
+void SceneCapture::Write(CaptureRecord record, const CaptureArray* arrays, int arrayCount)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_file == nullptr)
+        return;
+
+    // Calls that started before the capture did are recorded as starting with it.
+    record.startTime = record.startTime > _startTime ? record.startTime - _startTime : 0;
+    record.dataSize = 0;
+    for (int i = 0; i < arrayCount; ++i)
+        record.dataSize += sizeof(uint64_t) + (arrays[i].data != nullptr ? arrays[i].size : 0);
+
+    bool written = fwrite(&record, sizeof(record), 1, _file) == 1;
+    for (int i = 0; i < arrayCount && written; ++i)
+    {
+        uint64_t size = arrays[i].data != nullptr ? arrays[i].size : 0;
+        written = fwrite(&size, sizeof(size), 1, _file) == 1;
+        if (written && size > 0)
+            written = fwrite(arrays[i].data, static_cast<size_t>(size), 1, _file) == 1;
+    }
+    if (!written)
+    {
+        // Nothing after a partly written record could be read back, replays stop before it.
+        fclose(_file);
+        _file = nullptr;
+        _active.store(false);
+    }
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+
+#include "plugin.h"
+
+static const uint32_t kCaptureMagic = 0x50414353; // "SCAP"
+static const uint32_t kCaptureVersion = 2;
+
+// A capture file is this header followed by records, each a CaptureRecord and its data: the
+// arrays the call read, each a uint64_t byte size and the bytes. Sizes are stored so a replay
+// can reject files written by a build with different layouts.
+struct CaptureFileHeader
+{
+    uint32_t magic;
+    uint32_t captureVersion;
+    uint32_t tinybvhVersion;
+    uint32_t vertexSize;
+    uint32_t instanceSize;
+    uint32_t padding[3];
+};
+static_assert(sizeof(CaptureFileHeader) == 32, "capture files must not depend on struct padding");
+
+// The plugin call a record is of, and the arrays that follow it. An empty array stands for a
+// null pointer.
+enum CaptureRecordType
+{
+    // BuildBVH: the vertices.
+    CAPTURE_BUILD_BVH = 1,
+    // BuildTLAS: the instances.
+    CAPTURE_BUILD_TLAS = 2,
+    CAPTURE_DESTROY_BVH = 3,
+    CAPTURE_DESTROY_TLAS = 4,
+    // BuildBVHIndexed: the vertices and the indices.
+    CAPTURE_BUILD_BVH_INDEXED = 5,
+    // BuildBVHAsync and BuildBVHDeferred: the vertices.
+    CAPTURE_BUILD_BVH_ASYNC = 6,
+    CAPTURE_BUILD_BVH_DEFERRED = 7,
+    // BuildBVHIndexedDeferred: the vertices and the indices.
+    CAPTURE_BUILD_BVH_INDEXED_DEFERRED = 8,
+    // RefitBVH: the new vertices.
+    CAPTURE_REFIT_BVH = 9,
+    // BuildBVHBatch and BuildBVHBatchDeferred: the vertices, meshOffsets, triCounts and
+    // qualities.
+    CAPTURE_BUILD_BVH_BATCH = 10,
+    CAPTURE_BUILD_BVH_BATCH_DEFERRED = 11,
+    // BuildBVHBatchIndexedDeferred: the vertices, vertexOffsets, vertexCounts, indices,
+    // indexOffsets, triCounts and qualities.
+    CAPTURE_BUILD_BVH_BATCH_INDEXED_DEFERRED = 12,
+    CAPTURE_DESTROY_BVH_BATCH = 13,
+    // RebuildTLAS and RefitTLAS: the instances.
+    CAPTURE_REBUILD_TLAS = 14,
+    CAPTURE_REFIT_TLAS = 15,
+};
+
+// One plugin call. count is the call's triangle, mesh or instance count and quality its
+// BVHBuildQuality, batches have one per mesh in their qualities array instead. Times are in
+// nanoseconds, start from the start of the capture, handle is the handle the call returned
+// or was passed. dataSize is the size of all the arrays that follow.
+struct CaptureRecord
+{
+    uint32_t type;
+    int32_t count;
+    int32_t quality;
+    uint32_t padding;
+    int64_t startTime;
+    int64_t duration;
+    int64_t handle;
+    uint64_t dataSize;
+};
+static_assert(sizeof(CaptureRecord) == 48, "capture files must not depend on struct padding");
+
+// An array a recorded call read.
+struct CaptureArray
+{
+    const void* data;
+    uint64_t size;
+};
+
+// Opt-in recording of the geometry and instances the plugin's BVH builds, refits and
+// destroys are given, with the time of each call, so slow builds in a user's scene can be
+// replayed and profiled offline, see Plugin/tools/scene_replay.cpp. Records are written as
+// the calls return, from any thread.
+class SceneCapture
+{
+public:
+    static SceneCapture& Get();
+
+    // Starts writing a new capture file, ending the current one. Returns false if the file
+    // can't be created.
+    bool Start(const char* path);
+    void Stop();
+
+    bool IsActive() const { return _active.load(std::memory_order_relaxed); }
+
+    // Nanoseconds on the capture clock, for the start times passed to the Record functions.
+    static int64_t Now();
+
+    // Records a call that started at startTime and just returned, and the arrays it read.
+    void Record(CaptureRecordType type, int count, int quality, int64_t startTime, int64_t handle,
+                const CaptureArray* arrays, int arrayCount);
+    void RecordDestroy(CaptureRecordType type, int64_t handle);
+
+private:
+    void Write(CaptureRecord record, const CaptureArray* arrays, int arrayCount);
+
+    std::mutex _mutex;
+    FILE* _file = nullptr;
+    int64_t _startTime = 0;
+    std::atomic<bool> _active { false };
+};
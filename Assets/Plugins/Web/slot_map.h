@@ -0,0 +1,153 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Hands out 64-bit handles to objects owned by the caller. A handle is a slot index in its
+// low 32 bits and the slot's generation in the high bits. The generation changes whenever
+// the slot is freed, so a stale handle finds nothing instead of aliasing a newer object.
+// Handles are always positive, -1 is never a valid handle.
+//
+// Add, Get and Remove are lock-free and can be called from any thread. Slots live in pages
+// that never move once allocated, and freed slots are reused from a free list in O(1).
+// Get only guarantees the handle was valid when it looked: destroying an object while
+// another thread still uses it is up to the caller to prevent.
+template <typename T>
+class SlotMap
+{
+public:
+    SlotMap() = default;
+    SlotMap(const SlotMap&) = delete;
+    SlotMap& operator=(const SlotMap&) = delete;
+
+    ~SlotMap()
+    {
+        for (std::atomic<Slot*>& page : _pages)
+            delete[] page.load();
+    }
+
+    // Returns the new object's handle, or -1 once every slot is in use.
+    int64_t Add(T* value)
+    {
+        uint32_t index = PopFree();
+        if (index == kNoSlot)
+            index = NewSlot();
+        if (index == kNoSlot)
+            return -1;
+
+        Slot* slot = FindSlot(index);
+        slot->value.store(value, std::memory_order_release);
+        return (static_cast<int64_t>(slot->generation.load(std::memory_order_relaxed)) << 32) | index;
+    }
+
+    T* Get(int64_t handle) const
+    {
+        Slot* slot = handle >= 0 ? FindSlot(static_cast<uint32_t>(handle)) : nullptr;
+        if (slot == nullptr)
+            return nullptr;
+
+        // The value is read before the generation: if the slot was freed and reused in
+        // between, the generation no longer matches and the newer object isn't returned.
+        T* value = slot->value.load(std::memory_order_acquire);
+        if (slot->generation.load(std::memory_order_acquire) != static_cast<uint32_t>(handle >> 32))
+            return nullptr;
+        return value;
+    }
+
+    // Frees the handle's slot and returns its object, or null if the handle is stale. Only
+    // one of several threads removing the same handle gets the object.
+    T* Remove(int64_t handle)
+    {
+        Slot* slot = handle >= 0 ? FindSlot(static_cast<uint32_t>(handle)) : nullptr;
+        if (slot == nullptr)
+            return nullptr;
+
+        uint32_t generation = static_cast<uint32_t>(handle >> 32);
+        uint32_t nextGeneration = generation == kMaxGeneration ? 1 : generation + 1;
+        if (!slot->generation.compare_exchange_strong(generation, nextGeneration, std::memory_order_acq_rel))
+            return nullptr;
+
+        T* value = slot->value.exchange(nullptr, std::memory_order_acq_rel);
+        PushFree(static_cast<uint32_t>(handle));
+        return value;
+    }
+
+private:
+    static const uint32_t kPageSize = 1024;
+    static const uint32_t kMaxPages = 4096;
+    static const uint32_t kNoSlot = 0xFFFFFFFF;
+    // Keeps handles positive.
+    static const uint32_t kMaxGeneration = 0x7FFFFFFF;
+
+    struct Slot
+    {
+        std::atomic<T*> value { nullptr };
+        std::atomic<uint32_t> generation { 1 };
+        // Next slot in the free list plus one, 0 at the end.
+        std::atomic<uint32_t> nextFree { 0 };
+    };
+
+    Slot* FindSlot(uint32_t index) const
+    {
+        if (index >= _slotCount.load(std::memory_order_acquire))
+            return nullptr;
+
+        Slot* page = _pages[index / kPageSize].load(std::memory_order_acquire);
+        return page != nullptr ? &page[index % kPageSize] : nullptr;
+    }
+
+    uint32_t NewSlot()
+    {
+        uint32_t index = _slotCount.load(std::memory_order_relaxed);
+        do
+        {
+            if (index >= kPageSize * kMaxPages)
+                return kNoSlot;
+        } while (!_slotCount.compare_exchange_weak(index, index + 1, std::memory_order_acq_rel));
+
+        // Whoever takes the first slot of a page usually allocates it, but any thread that
+        // gets there first may, the others drop their copy.
+        std::atomic<Slot*>& page = _pages[index / kPageSize];
+        if (page.load(std::memory_order_acquire) == nullptr)
+        {
+            Slot* newPage = new Slot[kPageSize];
+            Slot* expected = nullptr;
+            if (!page.compare_exchange_strong(expected, newPage, std::memory_order_acq_rel))
+                delete[] newPage;
+        }
+        return index;
+    }
+
+    // The free list head holds the top slot plus one in its low 32 bits, and a counter in the
+    // high bits that changes with every update, so a slot popped and pushed back between a
+    // load and a compare-exchange can't be mistaken for an unchanged list.
+    uint32_t PopFree()
+    {
+        uint64_t head = _freeList.load(std::memory_order_acquire);
+        while (static_cast<uint32_t>(head) != 0)
+        {
+            uint32_t index = static_cast<uint32_t>(head) - 1;
+            uint32_t next = FindSlot(index)->nextFree.load(std::memory_order_relaxed);
+            uint64_t newHead = (((head >> 32) + 1) << 32) | next;
+            if (_freeList.compare_exchange_weak(head, newHead, std::memory_order_acq_rel, std::memory_order_acquire))
+                return index;
+        }
+        return kNoSlot;
+    }
+
+    void PushFree(uint32_t index)
+    {
+        Slot* slot = FindSlot(index);
+        uint64_t head = _freeList.load(std::memory_order_relaxed);
+        uint64_t newHead;
+        do
+        {
+            slot->nextFree.store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+            newHead = (((head >> 32) + 1) << 32) | (index + 1);
+        } while (!_freeList.compare_exchange_weak(head, newHead, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    std::atomic<Slot*> _pages[kMaxPages] = {};
+    std::atomic<uint32_t> _slotCount { 0 };
+    std::atomic<uint64_t> _freeList { 0 };
+};
@@ -148,6 +148,14 @@ THE SOFTWARE.
 #ifndef MT_BUILD_THRESHOLD
 #define MT_BUILD_THRESHOLD 50000 // single-threaded builds below this triangle count
 #endif
+#ifndef MT_BUILD_MAX_DEPTH
+#define MT_BUILD_MAX_DEPTH 5 // subtrees above this depth are built in parallel
+#endif
+// Threaded builds spawn two std::threads for each parallel split by default. Define
+// TINYBVH_FORK_JOIN as the name of a function with signature
+//   void f( const std::function<void()>& taskA, const std::function<void()>& taskB )
+// that runs both tasks and returns when both are done, to use an external task scheduler.
+// #define TINYBVH_FORK_JOIN MyForkJoin
 
 // Features
 #ifndef NO_DOUBLE_PRECISION_SUPPORT
@@ -977,6 +985,7 @@ private:
 	static __m128 half4, two4, min1, mask3, binmul3;
 	static __m128i maxbin4;
 	static __m256 max8, mask6, signFlip8;
+	static bool InitAVXConstants();
 public:
 	// helper for AVX binning
 	void BuildAVXBinTask( const uint32_t first, const uint32_t last, __m256* binbox, __m256* orig,
@@ -1348,6 +1357,7 @@ public:
 	void BuildHQ( const bvhvec4slice& vertices, const uint32_t* indices, const uint32_t primCount );
 	void Optimize( const uint32_t iterations = 25, bool extreme = false );
 	void ConvertFrom( MBVH<8>& original, bool compact = true );
+	static uint32_t NodeBlocksNeeded( const MBVH<8>& original ); // node storage ConvertFrom will use.
 	float SAHCost( const uint32_t nodeIdx = 0 ) const;
 	int32_t Intersect( Ray& ray ) const;
 	bool IsOccluded( const Ray& ray ) const { FALLBACK_SHADOW_QUERY( ray ); }
@@ -1500,6 +1510,10 @@ public:
 #include <mutex>
 #include <deque>
 
+#ifdef TINYBVH_FORK_JOIN
+void TINYBVH_FORK_JOIN( const std::function<void()>& taskA, const std::function<void()>& taskB );
+#endif
+
 // We need quite a bit of type reinterpretation, so we'll
 // turn off the gcc warning here until the end of the file.
 #ifdef __GNUC__
@@ -1541,6 +1555,18 @@ inline uint32_t __bfind( uint32_t x ) // https://github.com/mackron/refcode/blob
 }
 #endif
 
+// threaded builds: run two subtree builds in parallel and wait for both.
+static void tinybvh_fork_join( const std::function<void()>& taskA, const std::function<void()>& taskB )
+{
+#ifdef TINYBVH_FORK_JOIN
+	TINYBVH_FORK_JOIN( taskA, taskB );
+#else
+	std::thread t1( taskA ), t2( taskB );
+	t1.join();
+	t2.join();
+#endif
+}
+
 // array element counting; https://stackoverflow.com/questions/12784136
 #define BVH_NUM_ELEMS(a) (sizeof(a)/sizeof 0[a])
 
@@ -1726,14 +1752,23 @@ void BVHBase::CopyBasePropertiesFrom( const BVHBase& original )
 // ----------------------------------------------------------------------------
 
 // static variable declarations
+// The AVX constants are set on first use instead of by static initializers, so that
+// loading code compiled with AVX enabled is safe on CPUs without AVX support.
 #ifdef BVH_USEAVX
-__m128 BVH::half4 = _mm_set1_ps( 0.5f );
-__m128 BVH::two4 = _mm_set1_ps( 2.0f ), BVH::min1 = _mm_set1_ps( -1 );
-__m128i BVH::maxbin4 = _mm_set1_epi32( 7 );
-__m128 BVH::mask3 = _mm_cmpeq_ps( _mm_setr_ps( 0, 0, 0, 1 ), _mm_setzero_ps() );
-__m128 BVH::binmul3 = _mm_set1_ps( AVXBINS * 0.49999f );
-__m256 BVH::max8 = _mm256_set1_ps( -BVH_FAR ), BVH::mask6 = _mm256_set_m128( mask3, mask3 );
-__m256 BVH::signFlip8 = _mm256_setr_ps( -0.0f, -0.0f, -0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f );
+__m128 BVH::half4, BVH::two4, BVH::min1, BVH::mask3, BVH::binmul3;
+__m128i BVH::maxbin4;
+__m256 BVH::max8, BVH::mask6, BVH::signFlip8;
+bool BVH::InitAVXConstants()
+{
+	half4 = _mm_set1_ps( 0.5f );
+	two4 = _mm_set1_ps( 2.0f ), min1 = _mm_set1_ps( -1 );
+	maxbin4 = _mm_set1_epi32( 7 );
+	mask3 = _mm_cmpeq_ps( _mm_setr_ps( 0, 0, 0, 1 ), _mm_setzero_ps() );
+	binmul3 = _mm_set1_ps( AVXBINS * 0.49999f );
+	max8 = _mm256_set1_ps( -BVH_FAR ), mask6 = _mm256_set_m128( mask3, mask3 );
+	signFlip8 = _mm256_setr_ps( -0.0f, -0.0f, -0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f );
+	return true;
+}
 #endif
 
 BVH::~BVH()
@@ -2390,12 +2425,9 @@ void BVH::Build( uint32_t nodeIdx, uint32_t depth )
 			bvhNode[n + 1].aabbMin = bestRMin, bvhNode[n + 1].aabbMax = bestRMax;
 			bvhNode[n + 1].leftFirst = j, bvhNode[n + 1].triCount = rightCount;
 			node.leftFirst = n, node.triCount = 0;
-			if (depth < 5 && threadedBuild)
+			if (depth < MT_BUILD_MAX_DEPTH && threadedBuild)
 			{
-				std::thread t1( &Build_, n, depth + 1, this );
-				std::thread t2( &Build_, n + 1, depth + 1, this );
-				t1.join();
-				t2.join(); // TODO: join is only needed in the 'all done' section below.
+				tinybvh_fork_join( [=]() { Build_( n, depth + 1, this ); }, [=]() { Build_( n + 1, depth + 1, this ); } );
 				break;
 			}
 			task[taskCount++] = n + 1, nodeIdx = n;
@@ -2537,12 +2569,9 @@ void BVH::BuildFullSweep( uint32_t nodeIdx, uint32_t depth )
 			bvhNode[n + 1].leftFirst = node.leftFirst + leftCount;
 			bvhNode[n + 1].triCount = rightCount;
 			node.leftFirst = n, node.triCount = 0;
-			if (leftCount + rightCount > 2000 && depth < 5 && threadedBuild)
+			if (leftCount + rightCount > 2000 && depth < MT_BUILD_MAX_DEPTH && threadedBuild)
 			{
-				std::thread t1( &BuildFullSweep_, n, depth + 1, this );
-				std::thread t2( &BuildFullSweep_, n + 1, depth + 1, this );
-				t1.join();
-				t2.join(); // TODO: join is only needed in the 'all done' section below.
+				tinybvh_fork_join( [=]() { BuildFullSweep_( n, depth + 1, this ); }, [=]() { BuildFullSweep_( n + 1, depth + 1, this ); } );
 				break;
 			}
 			// recurse
@@ -2944,10 +2973,11 @@ void BVH::BuildHQTask(
 			// recurse
 			if (depth < maxDepth && threadedBuild)
 			{
-				std::thread t1( &BuildHQTask_, leftChildIdx, depth + 1, maxDepth, sliceStart, (A + B) >> 1, idxTmp, this );
-				std::thread t2( &BuildHQTask_, rightChildIdx, depth + 1, maxDepth, (A + B) >> 1, sliceEnd, idxTmp, this );
-				t1.join();
-				t2.join(); // TODO: join is only needed in the 'all done' section below.
+				const uint32_t sliceMid = (A + B) >> 1;
+				tinybvh_fork_join(
+					[=]() { BuildHQTask_( leftChildIdx, depth + 1, maxDepth, sliceStart, sliceMid, idxTmp, this ); },
+					[=]() { BuildHQTask_( rightChildIdx, depth + 1, maxDepth, sliceMid, sliceEnd, idxTmp, this ); }
+				);
 				break;
 			}
 			// proceed with left child, push right child on local stack
@@ -2980,7 +3010,7 @@ void BVH::BuildHQ()
 	}
 	// subdivide recursively
 	uint32_t nodeIdx = 0, sliceStart = 0, sliceEnd = triCount + slack, depth = 0;
-	BuildHQTask( nodeIdx, depth, 5, sliceStart, sliceEnd, idxTmp );
+	BuildHQTask( nodeIdx, depth, MT_BUILD_MAX_DEPTH, sliceStart, sliceEnd, idxTmp );
 	// all done.
 	AlignedFree( idxTmp );
 	aabbMin = bvhNode[0].aabbMin, aabbMax = bvhNode[0].aabbMax;
@@ -5839,6 +5869,22 @@ void BVH8_CWBVH::BuildHQ( const bvhvec4slice& vertices, const uint32_t* indices,
 	ConvertFrom( bvh8, true );
 }
 
+// Exact node storage for a BVH8: one 80-byte CWBVH node per interior node reachable from the
+// root. This allows a caller to provide bvh8Data / bvh8Tris and allocatedBlocks up front.
+uint32_t BVH8_CWBVH::NodeBlocksNeeded( const MBVH<8>& original )
+{
+	uint32_t interiorNodes = 0, stack[256], stackPtr = 1;
+	stack[0] = 0;
+	while (stackPtr > 0)
+	{
+		const MBVH<8>::MBVHNode& node = original.mbvhNode[stack[--stackPtr]];
+		interiorNodes++;
+		for (int32_t i = 0; i < 8; i++) if (node.child[i] != 0)
+			if (!original.mbvhNode[node.child[i]].isLeaf()) stack[stackPtr++] = node.child[i];
+	}
+	return interiorNodes * 5; // CWBVH nodes use 80 bytes each.
+}
+
 // Convert a BVH8 to the format specified in: "Efficient Incoherent Ray Traversal on GPUs Through
 // Compressed Wide BVHs", Ylitie et al. 2017. Adapted from code by "AlanWBFT".
 void BVH8_CWBVH::ConvertFrom( MBVH<8>& original, bool )
@@ -5848,9 +5894,11 @@ void BVH8_CWBVH::ConvertFrom( MBVH<8>& original, bool )
 	bvh8 = original;
 	BVH_FATAL_ERROR_IF( bvh8.mbvhNode[0].isLeaf(), "BVH8_CWBVH::ConvertFrom( .. ), converting a single-node bvh." );
 	// allocate memory
-	uint32_t spaceNeeded = bvh8.triCount * 5; // CWBVH nodes use 80 bytes each.
+	uint32_t spaceNeeded = NodeBlocksNeeded( bvh8 );
 	if (spaceNeeded > allocatedBlocks)
 	{
+		AlignedFree( bvh8Data );
+		AlignedFree( bvh8Tris );
 		bvh8Data = (bvhvec4*)AlignedAlloc( spaceNeeded * 16 );
 		bvh8Tris = (bvhvec4*)AlignedAlloc( bvh8.idxCount * 4 * 16 );
 		allocatedBlocks = spaceNeeded;
@@ -6002,24 +6050,28 @@ static uint32_t __popc( uint32_t x )
 }
 
 static const unsigned __A = 0x03020100, __B = 0x07060504, __C = 0x0B0A0908, __D = 0x0F0E0D0C;
-ALIGNED( 64 ) static __m128i idxLUT4_[16] = {
-	_mm_set_epi32( 0, 0, 0, 0 ),		// 0000
-	_mm_set_epi32( 0, 0, 0, __A ),		// 0001
-	_mm_set_epi32( 0, 0, 0, __B ),		// 0010
-	_mm_set_epi32( 0, 0, __B, __A ),	// 0011
-	_mm_set_epi32( 0, 0, 0, __C ),		// 0100
-	_mm_set_epi32( 0, 0, __C, __A ),	// 0101
-	_mm_set_epi32( 0, 0, __C, __B ),	// 0110
-	_mm_set_epi32( 0, __C, __B, __A ),	// 0111
-	_mm_set_epi32( 0, 0, 0, __D ),		// 1000
-	_mm_set_epi32( 0, 0, __D, __A ),	// 1001
-	_mm_set_epi32( 0, 0, __D, __B ),	// 1010
-	_mm_set_epi32( 0, __D, __B, __A ),	// 1011
-	_mm_set_epi32( 0, 0, __D, __C ),	// 1100
-	_mm_set_epi32( 0, __D, __C, __A ),	// 1101
-	_mm_set_epi32( 0, __D, __C, __B ),	// 1110
-	_mm_set_epi32( __D, __C, __B, __A ) // 1111
+// SIMD lookup tables are stored as plain integers, so they are constant-initialized
+// rather than built with SIMD instructions when the library is loaded.
+#define LUT4(d,c,b,a) { a, b, c, d } // same lane order as _mm_set_epi32
+ALIGNED( 64 ) static const uint32_t idxLUT4u[16][4] = {
+	LUT4( 0, 0, 0, 0 ),		// 0000
+	LUT4( 0, 0, 0, __A ),		// 0001
+	LUT4( 0, 0, 0, __B ),		// 0010
+	LUT4( 0, 0, __B, __A ),	// 0011
+	LUT4( 0, 0, 0, __C ),		// 0100
+	LUT4( 0, 0, __C, __A ),	// 0101
+	LUT4( 0, 0, __C, __B ),	// 0110
+	LUT4( 0, __C, __B, __A ),	// 0111
+	LUT4( 0, 0, 0, __D ),		// 1000
+	LUT4( 0, 0, __D, __A ),	// 1001
+	LUT4( 0, 0, __D, __B ),	// 1010
+	LUT4( 0, __D, __B, __A ),	// 1011
+	LUT4( 0, 0, __D, __C ),	// 1100
+	LUT4( 0, __D, __C, __A ),	// 1101
+	LUT4( 0, __D, __C, __B ),	// 1110
+	LUT4( __D, __C, __B, __A ) // 1111
 };
+static const __m128i* const idxLUT4_ = (const __m128i*)idxLUT4u;
 
 int32_t BVH4_CPU::Intersect( Ray& ray ) const
 {
@@ -6384,6 +6436,8 @@ void BVH::PrepareAVXBuild( const bvhvec4slice& vertices, const uint32_t* indices
 	BVH_FATAL_ERROR_IF( vertices.count == 0, "BVH::PrepareAVXBuild( .. ), primCount == 0." );
 	BVH_FATAL_ERROR_IF( vertices.stride & 15, "BVH::PrepareAVXBuild( .. ), stride must be multiple of 16." );
 	// some constants
+	static const bool constantsReady = InitAVXConstants();
+	(void)constantsReady;
 	static const __m128 min4 = _mm_set1_ps( BVH_FAR ), max4 = _mm_set1_ps( -BVH_FAR );
 	// reset node pool
 	uint32_t primCount = prims > 0 ? prims : vertices.count / 3;
@@ -6600,12 +6654,9 @@ void BVH::BuildAVXSubtree( uint32_t nodeIdx, uint32_t depth )
 			node.leftFirst = n, node.triCount = 0;
 			*(__m256*)& bvhNode[n + 1] = _mm256_xor_ps( bestRBox, signFlip8 );
 			bvhNode[n + 1].leftFirst = i, bvhNode[n + 1].triCount = rightCount;
-			if (leftCount + rightCount > 2000 && depth < 5 && threadedBuild)
+			if (leftCount + rightCount > 2000 && depth < MT_BUILD_MAX_DEPTH && threadedBuild)
 			{
-				std::thread t1( &BuildAVXSubtree_, n, depth + 1, this );
-				std::thread t2( &BuildAVXSubtree_, n + 1, depth + 1, this );
-				t1.join();
-				t2.join(); // TODO: join is only needed in the 'all done' section below.
+				tinybvh_fork_join( [=]() { BuildAVXSubtree_( n, depth + 1, this ); }, [=]() { BuildAVXSubtree_( n + 1, depth + 1, this ); } );
 				break;
 			}
 			task[taskCount++] = n + 1, nodeIdx = n;
@@ -7115,8 +7166,10 @@ int32_t BVH8_CWBVH::Intersect( Ray& ray ) const
 
 #ifdef BVH_USEAVX2
 
-#define TO256(x) _mm256_cvtepu8_epi32( _mm_cvtsi64_si128( x ) )
-ALIGNED( 64 ) static const __m256i idxLUT256[256] = {
+#define TO256(x) { (uint32_t)((x##ull) & 255), (uint32_t)(((x##ull) >> 8) & 255), (uint32_t)(((x##ull) >> 16) & 255), \
+	(uint32_t)(((x##ull) >> 24) & 255), (uint32_t)(((x##ull) >> 32) & 255), (uint32_t)(((x##ull) >> 40) & 255), \
+	(uint32_t)(((x##ull) >> 48) & 255), (uint32_t)(((x##ull) >> 56) & 255) } // _mm256_cvtepu8_epi32 of x
+ALIGNED( 64 ) static const uint32_t idxLUT256u[256][8] = {
 	TO256( 506097522914230528 ), TO256( 1976943448883713 ), TO256( 1976943448883712 ), TO256( 7722435347202 ), TO256( 1976943448883456 ), TO256( 7722435347201 ), TO256(
 	7722435347200 ), TO256( 30165763075 ), TO256( 1976943448817920 ), TO256( 7722435346945 ), TO256( 7722435346944 ), TO256( 30165763074 ), TO256( 7722435346688 ), TO256(
 	30165763073 ), TO256( 30165763072 ), TO256( 117835012 ), TO256( 1976943432040704 ), TO256( 7722435281409 ), TO256( 7722435281408 ), TO256( 30165762818 ), TO256(
@@ -7144,6 +7197,7 @@ ALIGNED( 64 ) static const __m256i idxLUT256[256] = {
 	67305728 ), TO256( 262913 ), TO256( 262912 ), TO256( 1027 ), TO256( 67240192 ), TO256( 262657 ), TO256( 262656 ), TO256( 1026 ), TO256( 262400 ), TO256( 1025 ), TO256( 1024 ), TO256( 4 ), TO256( 50462976 ), TO256( 197121 ), TO256(
 	197120 ), TO256( 770 ), TO256( 196864 ), TO256( 769 ), TO256( 768 ), TO256( 3 ), TO256( 131328 ), TO256( 513 ), TO256( 512 ), TO256( 2 ), TO256( 256 ), TO256( 1 ), TO256( 0 ), TO256( 0 )
 };
+static const __m256i* const idxLUT256 = (const __m256i*)idxLUT256u;
 
 int32_t BVH8_CPU::Intersect( Ray& ray ) const
 {
@@ -8073,12 +8127,9 @@ void BVH_Double::Build( uint64_t nodeIdx, uint32_t depth )
 			bvhNode[n + 1].aabbMin = bestRMin, bvhNode[n + 1].aabbMax = bestRMax;
 			bvhNode[n + 1].leftFirst = j, bvhNode[n + 1].triCount = rightCount;
 			node.leftFirst = n, node.triCount = 0;
-			if (depth < 5)
+			if (depth < MT_BUILD_MAX_DEPTH)
 			{
-				std::thread t1( &BuildDouble_, n, depth + 1, this );
-				std::thread t2( &BuildDouble_, n + 1, depth + 1, this );
-				t1.join();
-				t2.join();
+				tinybvh_fork_join( [=]() { BuildDouble_( n, depth + 1, this ); }, [=]() { BuildDouble_( n + 1, depth + 1, this ); } );
 				break;
 			}
 			// recurse
@@ -20,11 +20,12 @@ float3 InterpolateAttribute(float2 barycentric, float3 attr0, float3 attr1, floa
     return attr0 * (1.0f - barycentric.x - barycentric.y) + attr1 * barycentric.x + attr2 * barycentric.y;
 }
 
-void IntersectTriangle(int triAddr, const Ray ray, inout RayHit hit)
+void IntersectTriangle(int triBase, int triangleIndex, const Ray ray, inout RayHit hit)
 {
-    float3 v0 = BVHTris[triAddr + 2].xyz;
-    float3 e1 = BVHTris[triAddr + 1].xyz;
-    float3 e2 = BVHTris[triAddr + 0].xyz;
+    float4 tri;
+    float3 e1, e2;
+    uint triAddr = LoadBVHTriangle(0, triBase, triangleIndex, tri, e1, e2);
+    float3 v0 = tri.xyz;
 
     float3 r = cross(ray.direction.xyz, e2);
     float a = dot(e1, r);
@@ -46,7 +47,7 @@ void IntersectTriangle(int triAddr, const Ray ray, inout RayHit hit)
 
                 if (d > 0.0001f && d < hit.distance)
                 {
-                    uint triIndex = asuint(BVHTris[triAddr + 2].w);
+                    uint triIndex = asuint(tri.w);
                     float2 barycentric = float2(u, v);
                     hit.barycentric = barycentric;
                     hit.triAddr = triAddr;
@@ -159,7 +160,7 @@ bool RayIntersectBvh(const Ray ray, inout RayHit hit, bool isShadowRay)
             uint relativeIndex = countbits(mask & ~(0xFFFFFFFF << slotIndex));
             uint childNodeIndex = childNodeBaseIndex + relativeIndex;
 
-            BVHNode node = BVHNodes[nodeOffset + childNodeIndex];
+            BVHNode node = LoadBVHNode(0, nodeOffset + childNodeIndex);
             uint hitmask = IntersectCWBVHNode(ray.origin, invDir, octinv4, hit.distance, node);
 
             nodeGroup.x = asuint(node.n1.x);
@@ -179,10 +180,9 @@ bool RayIntersectBvh(const Ray ray, inout RayHit hit, bool isShadowRay)
         {
             count += 4;
             int triangleIndex = firstbithigh(triGroup.y);
-            int triAddr = triGroup.x + (triangleIndex * 3);
 
             // Check intersection and update hit if its closer
-            IntersectTriangle(triAddr, ray, hit);
+            IntersectTriangle(triGroup.x, triangleIndex, ray, hit);
 
             triGroup.y -= 1 << triangleIndex;
         }
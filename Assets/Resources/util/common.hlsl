@@ -28,6 +28,10 @@ struct BLASInstance
     int triOffset;
     int triAttributeOffset;
     int materialIndex;
+    // Pages of the BVH buffers holding the nodes and triangles, see BVH_PAGED.
+    int bvhPage;
+    int triPage;
+    int2 padding;
 };
 
 // This node struct is stored in the TLASData buffer, left here for reference
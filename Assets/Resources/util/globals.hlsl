@@ -59,4 +59,71 @@ StructuredBuffer<float4> BVHTris;
 StructuredBuffer<TriangleAttributes> TriangleAttributesBuffer;
 #endif
 
+#if BVH_PAGED
+// BVH data too large for one storage buffer binding continues in a second page. No BLAS is
+// split across pages, so each instance knows which page holds its nodes and its triangles.
+// More pages would go over the storage buffer limit.
+StructuredBuffer<BVHNode> BVHNodes1;
+StructuredBuffer<float4> BVHTris1;
+#endif
+
+BVHNode LoadBVHNode(uint page, uint index)
+{
+#if BVH_PAGED
+    if (page != 0)
+        return BVHNodes1[index];
+#endif
+    return BVHNodes[index];
+}
+
+float4 LoadBVHTri(uint page, uint index)
+{
+#if BVH_PAGED
+    if (page != 0)
+        return BVHTris1[index];
+#endif
+    return BVHTris[index];
+}
+
+#if BVH_COMPRESSED_TRIS
+// A vertex of a compressed triangle block, stored as packed float3s from vertexBase.
+float3 LoadBVHVertex(uint page, uint vertexBase, uint vertex)
+{
+    uint first = vertex * 3;
+    uint component = first & 3;
+    float4 a = LoadBVHTri(page, vertexBase + (first >> 2));
+    if (component == 0)
+        return a.xyz;
+    if (component == 1)
+        return a.yzw;
+    float4 b = LoadBVHTri(page, vertexBase + (first >> 2) + 1);
+    return component == 2 ? float3(a.zw, b.x) : float3(a.w, b.xy);
+}
+#endif
+
+// Loads triangle triangleIndex of the block at triBase: its first vertex, with the triangle
+// index in w, and its two edges. Returns the address of the triangle's data. Compressed
+// blocks hold two uints per triangle, two to a float4: the block indices of its vertices in
+// the low three bytes and the float4 offset of the vertices in the high byte, then the
+// triangle index. See CompressCWBVHTris in the plugin.
+uint LoadBVHTriangle(uint page, uint triBase, uint triangleIndex, out float4 v0, out float3 e1, out float3 e2)
+{
+#if BVH_COMPRESSED_TRIS
+    uint triAddr = triBase + (triangleIndex >> 1);
+    float4 record = LoadBVHTri(page, triAddr);
+    uint2 tri = asuint((triangleIndex & 1) != 0 ? record.zw : record.xy);
+    uint vertexBase = triBase + (tri.x >> 24);
+    float3 p0 = LoadBVHVertex(page, vertexBase, tri.x & 0xFF);
+    v0 = float4(p0, asfloat(tri.y));
+    e1 = LoadBVHVertex(page, vertexBase, (tri.x >> 8) & 0xFF) - p0;
+    e2 = LoadBVHVertex(page, vertexBase, (tri.x >> 16) & 0xFF) - p0;
+#else
+    uint triAddr = triBase + triangleIndex * 3;
+    v0 = LoadBVHTri(page, triAddr + 2);
+    e1 = LoadBVHTri(page, triAddr + 1).xyz;
+    e2 = LoadBVHTri(page, triAddr + 0).xyz;
+#endif
+    return triAddr;
+}
+
 #endif // __UNITY_PATHTRACER_GLOBALS_HLSL__
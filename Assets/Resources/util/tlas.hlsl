@@ -19,12 +19,13 @@ float3 InterpolateAttribute(float2 barycentric, float3 attr0, float3 attr1, floa
     return attr0 * (1.0f - barycentric.x - barycentric.y) + attr1 * barycentric.x + attr2 * barycentric.y;
 }
 
-bool IntersectTriangle(const BLASInstance instance, int triAddr, const Ray ray, inout RayHit hit)
+bool IntersectTriangle(const BLASInstance instance, int triBase, int triangleIndex, const Ray ray, inout RayHit hit)
 {
     bool hitFound = false;
-    float3 v0 = BVHTris[triAddr + 2].xyz;
-    float3 e1 = BVHTris[triAddr + 1].xyz;
-    float3 e2 = BVHTris[triAddr + 0].xyz;
+    float4 tri;
+    float3 e1, e2;
+    uint triAddr = LoadBVHTriangle(instance.triPage, triBase, triangleIndex, tri, e1, e2);
+    float3 v0 = tri.xyz;
 
     float3 r = cross(ray.direction, e2);
     float a = dot(e1, r);
@@ -46,7 +47,7 @@ bool IntersectTriangle(const BLASInstance instance, int triAddr, const Ray ray,
 
                 if (distance > 0.0f && distance < hit.distance)
                 {
-                    uint triIndex = instance.triAttributeOffset + asuint(BVHTris[triAddr + 2].w);
+                    uint triIndex = instance.triAttributeOffset + asuint(tri.w);
                     hit.barycentric = float2(u, v);
                     hit.triAddr = triAddr;
                     hit.triIndex = triIndex;
@@ -169,7 +170,7 @@ bool RayIntersectBvh(const Ray worldRay, in BLASInstance instance, bool isShadow
             uint relativeIndex = countbits(mask & ~(0xFFFFFFFF << slotIndex));
             uint childNodeIndex = childNodeBaseIndex + relativeIndex;
 
-            BVHNode node = BVHNodes[nodeOffset + childNodeIndex];
+            BVHNode node = LoadBVHNode(instance.bvhPage, nodeOffset + childNodeIndex);
             uint hitmask = IntersectCWBVHNode(localRay.origin, invDir, octinv4, hit.distance, node);
 
             nodeGroup.x = asuint(node.n1.x);
@@ -189,10 +190,9 @@ bool RayIntersectBvh(const Ray worldRay, in BLASInstance instance, bool isShadow
         {
             hit.steps += 4;
             int triangleIndex = firstbithigh(triGroup.y);
-            int triAddr = triGroup.x + (triangleIndex * 3);
 
             // Check intersection and update hit if its closer
-            hitFound = IntersectTriangle(instance, instance.triOffset + triAddr, localRay, hit) | hitFound;
+            hitFound = IntersectTriangle(instance, instance.triOffset + triGroup.x, triangleIndex, localRay, hit) | hitFound;
 
             triGroup.y -= 1 << triangleIndex;
         }
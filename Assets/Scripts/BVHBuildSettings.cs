@@ -0,0 +1,9 @@
+using UnityEngine;
+
+// Overrides the BVH build quality of a mesh, e.g. spatial splits for a static hero mesh or quick
+// builds for proxy geometry. Only used with the TLAS, where every mesh has its own BLAS.
+[RequireComponent(typeof(MeshFilter))]
+public class BVHBuildSettings : MonoBehaviour
+{
+    public BVHBuildQuality quality = BVHBuildQuality.Binned;
+}
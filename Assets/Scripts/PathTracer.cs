@@ -22,6 +22,32 @@ public enum EnvironmentMode {
 public class PathTracer : MonoBehaviour
 {
     public bool useTLAS = false;
+    // Read back mesh vertices and indices instead of a triangle soup for the BVH builds
+    public bool useIndexedGeometry = false;
+    // Moving instances refit the TLAS instead of rebuilding it every time they move
+    public bool refitTLAS = true;
+    // Moving instances refit the TLAS until its SAH cost grows by this factor, then rebuild it
+    public float tlasRebuildThreshold = 1.5f;
+    // BLAS build quality for meshes without a BVHBuildSettings component
+    public BVHBuildQuality bvhBuildQuality = BVHBuildQuality.Binned;
+    // Reinsertion passes of BVHBuildQuality.Optimized builds, extreme passes are slower but better
+    public int bvhOptimizeIterations = 25;
+    public bool bvhOptimizeExtreme = false;
+    // Start rendering with quick BVHs and swap in ones of the above quality once they're built
+    public bool progressiveBVHBuilds = false;
+    // Free BVH build data as soon as each BVH is encoded, for memory-constrained browser tabs
+    public bool leanBVHBuilds = false;
+    // Store BVH triangles as shared vertices and small indices, about half the memory
+    public bool compressedBVHTriangles = false;
+    // Largest BVH buffer binding, bigger scenes are split into pages of this size. 0 uses the
+    // device's buffer size limit, so only scenes too large for one binding are split
+    public int bvhPageSizeMB = 0;
+    // Worker threads used for BVH builds, 0 uses one per core
+    public int bvhBuildThreads = 0;
+    // Cache built BVHs on disk, up to the size below, so unchanged geometry loads instead of
+    // rebuilding. Off by default since it writes to the user's persistent data folder
+    public bool bvhCache = false;
+    public int bvhCacheSizeMB = 1024;
     public int samplesPerPass = 1;
     public int maxSamples = 100000;
     public int maxRayBounces = 5;
@@ -102,6 +128,18 @@ public class PathTracer : MonoBehaviour
         _camera.cullingMask = 0;
         _camera.clearFlags = CameraClearFlags.SolidColor;
 
+        if (bvhBuildThreads > 0)
+            TinyBVH.SetWorkerCount(bvhBuildThreads);
+
+        TinyBVH.SetTLASRebuildThreshold(tlasRebuildThreshold);
+        TinyBVH.SetBVHOptimizeSettings(bvhOptimizeIterations, bvhOptimizeExtreme);
+        TinyBVH.SetBVHProgressiveBuilds(progressiveBVHBuilds);
+        TinyBVH.SetBVHLeanBuilds(leanBVHBuilds);
+        TinyBVH.SetBVHCompressedTris(compressedBVHTriangles);
+
+        if (bvhCache)
+            TinyBVH.SetBVHCacheDirectory(System.IO.Path.Combine(Application.persistentDataPath, "BVHCache"), bvhCacheSizeMB);
+
         _bvhScene = new BVHScene();
         _cmd = new CommandBuffer();
 
@@ -111,6 +149,7 @@ public class PathTracer : MonoBehaviour
         _hasTexturesKeyword = _pathTracerShader.keywordSpace.FindKeyword("HAS_TEXTURES");
         _hasEnvironmentTextureKeyword = _pathTracerShader.keywordSpace.FindKeyword("HAS_ENVIRONMENT_TEXTURE");
         _hasLightsKeyword = _pathTracerShader.keywordSpace.FindKeyword("HAS_LIGHTS");
+        _pathTracerShader.SetKeyword(_pathTracerShader.keywordSpace.FindKeyword("BVH_COMPRESSED_TRIS"), compressedBVHTriangles);
 
         _lastEnvironmentMapRotation = environmentMapRotation;
         _lastAperture = aperture;
@@ -161,11 +200,13 @@ public class PathTracer : MonoBehaviour
     {
         if (_initialize)
         {
-            _bvhScene.Start(useTLAS);
+            _bvhScene.Start(useTLAS, useIndexedGeometry, refitTLAS, bvhBuildQuality, bvhPageSizeMB);
             UpdateLights();
             _initialize = false;
         }
 
+        _bvhScene.Update();
+
         if (_bvhScene.UpdateTLAS())
             Reset();
 
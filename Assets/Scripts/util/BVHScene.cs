@@ -10,7 +10,7 @@ using UnityEngine.Experimental.Rendering;
 using System.Text;
 
 // Instance data passed to the GPU for rendering.
-// This must match GPUInstance in tlas.hlsl.
+// This must match BLASInstance in common.hlsl.
 struct GPUInstance
 {
     public Matrix4x4 localToWorld;
@@ -19,6 +19,9 @@ struct GPUInstance
     public int triOffset;
     public int triAttributeOffset;
     public int materialIndex;
+    public int bvhPage;
+    public int triPage;
+    public Vector2Int padding;
 };
 
 // Instance data passed to TinyBVH for building the TLAS.
@@ -45,28 +48,52 @@ public class BVHScene
     LocalKeyword _hasNormalsKeyword;
     LocalKeyword _hasUVsKeyword;
     LocalKeyword _hasTangentsKeyword;
+    LocalKeyword _indexedOutputKeyword;
+    int _processVerticesKernel;
 
     int _totalVertexCount = 0;
     int _totalTriangleCount = 0;
     DateTime _readbackStartTime;
     ComputeBuffer _vertexPositionBufferGPU;
     NativeArray<Vector4> _vertexPositionBufferCPU;
+    // With indexed geometry the vertex position buffers hold each mesh vertex once, and
+    // these hold three indices per triangle.
+    ComputeBuffer _indexBufferGPU;
+    NativeArray<uint> _indexBufferCPU;
+    int _pendingReadbacks = 0;
     ComputeBuffer _triangleAttributesBuffer;
     ComputeBuffer _materialsBuffer;
 
     ComputeShader _textureCopyShader;
     ComputeBuffer _textureDataBuffer;
 
-    // BVH data
-    ComputeBuffer _bvhNodesBuffer;
-    ComputeBuffer _bvhTrianglesBuffer;
+    // BVH data, in pages of at most _bvhPageSize bytes once it outgrows a single buffer
+    // binding, which is the device's limit unless a smaller page size is asked for. Data that
+    // fits one binding stays in one buffer. No BLAS is split across pages. The shaders read
+    // at most kMaxBVHPages pages of each, see BVH_PAGED in globals.hlsl.
+    const int kMaxBVHPages = 2;
+    long _bvhPageSize;
+    ComputeBuffer[] _bvhNodesBuffers = new ComputeBuffer[kMaxBVHPages];
+    ComputeBuffer[] _bvhTrianglesBuffers = new ComputeBuffer[kMaxBVHPages];
+
+    // BVHs are built on the plugin's worker threads. These are the builds started from the
+    // last readback, which are uploaded once all of them are ready and freed once uploaded.
+    List<long> _bvhList = new();
+    // In TLAS mode all meshes are built as one batch, packed into a single arena by the plugin.
+    long _bvhBatch = -1;
+    bool _bvhBuildPending = false;
+    DateTime _bvhStartTime;
+    // Sum of the versions of the uploaded BVHs. Progressive builds bump it as they swap in
+    // improved BVHs, which are then uploaded again.
+    int _bvhVersion = 0;
 
     List<Material> _materials = new();
 
     // Struct sizes in bytes
     const int kVertexPositionSize = 16;
+    const int kVertexIndexSize = 4;
     const int kTriangleAttributeSize = 128;
-    const int kGPUInstanceSize = 144;
+    const int kGPUInstanceSize = 160;
     const int kBLASInstanceSize = 192; // 160 + 32 padding for 64-bit alignment
     const int kBVHNodeSize = 80;
     const int kBVHTriSize = 16;
@@ -82,8 +109,13 @@ public class BVHScene
     List<int> _meshTriangleCount = new();
     List<int> _triangleAttributeOffsets = new();
     List<int> _vertexPositionOffsets = new();
+    List<int> _meshVertexCounts = new();
+    // BVHBuildQuality of each mesh's BLAS, from its BVHBuildSettings or the default.
+    List<int> _meshBuildQualities = new();
 
     bool _useTLAS;
+    bool _useIndexedGeometry;
+    BVHBuildQuality _buildQuality;
 
     // List of instance data passed to TinyBVH. This is kept persistent so we can update transforms
     // and rebuild the TLAS as necessary.
@@ -93,12 +125,21 @@ public class BVHScene
 
     int _gpuInstanceCount = 0;
     int _tlasIndexOffset = 0;
+    // Kept alive so UpdateTLAS can refit or rebuild it in place as instances move.
+    long _tlasHandle = -1;
+    bool _refitTLAS;
+    // Copy of _blasInstances the plugin reads from, reused between TLAS updates.
+    NativeArray<BLASInstance> _blasInstancesNative;
     ComputeBuffer _tlasDataBuffer;
     ComputeBuffer _blasInstancesBuffer;
 
-    public void Start(bool useTlas)
+    public void Start(bool useTlas, bool useIndexedGeometry, bool refitTlas, BVHBuildQuality buildQuality, int bvhPageSizeMB)
     {
         _useTLAS = useTlas;
+        _useIndexedGeometry = useIndexedGeometry;
+        _refitTLAS = refitTlas;
+        _buildQuality = buildQuality;
+        _bvhPageSize = bvhPageSizeMB > 0 ? Math.Min((long)bvhPageSizeMB << 20, SystemInfo.maxGraphicsBufferSize) : SystemInfo.maxGraphicsBufferSize;
 
         // Load compute shader
         _meshProcessingShader = Resources.Load<ComputeShader>("MeshProcessing");
@@ -107,6 +148,8 @@ public class BVHScene
         _hasNormalsKeyword = _meshProcessingShader.keywordSpace.FindKeyword("HAS_NORMALS");
         _hasUVsKeyword = _meshProcessingShader.keywordSpace.FindKeyword("HAS_UVS");
         _hasTangentsKeyword = _meshProcessingShader.keywordSpace.FindKeyword("HAS_TANGENTS");
+        _indexedOutputKeyword = _meshProcessingShader.keywordSpace.FindKeyword("INDEXED_OUTPUT");
+        _processVerticesKernel = _meshProcessingShader.FindKernel("ProcessVertices");
 
         _textureCopyShader = Resources.Load<ComputeShader>("CopyTextureData");
 
@@ -115,11 +158,32 @@ public class BVHScene
 
     public void OnDestroy()
     {
+        // The plugin may still be reading the vertex data from its worker threads,
+        // DestroyBVH waits for any build in flight before freeing it.
+        foreach (long bvhHandle in _bvhList)
+            TinyBVH.DestroyBVH(bvhHandle);
+        _bvhList.Clear();
+        if (_bvhBatch >= 0)
+            TinyBVH.DestroyBVHBatch(_bvhBatch);
+        _bvhBatch = -1;
+        _bvhBuildPending = false;
+        if (_tlasHandle >= 0)
+            TinyBVH.DestroyTLAS(_tlasHandle);
+        _tlasHandle = -1;
+        if (_blasInstancesNative.IsCreated)
+            _blasInstancesNative.Dispose();
+
         _vertexPositionBufferGPU?.Release();
         _triangleAttributesBuffer?.Release();
         _vertexPositionBufferCPU.Dispose();
-        _bvhNodesBuffer?.Release();
-        _bvhTrianglesBuffer?.Release();
+        _indexBufferGPU?.Release();
+        if (_indexBufferCPU.IsCreated)
+            _indexBufferCPU.Dispose();
+        for (int page = 0; page < kMaxBVHPages; ++page)
+        {
+            _bvhNodesBuffers[page]?.Release();
+            _bvhTrianglesBuffers[page]?.Release();
+        }
         _materialsBuffer?.Release();
         _textureDataBuffer?.Release();
 
@@ -127,9 +191,31 @@ public class BVHScene
         _blasInstancesBuffer?.Release();
     }
 
+    // Checks on BVH builds running in the plugin, and uploads the BVH data once all of them finish.
+    public void Update()
+    {
+        if (!_bvhBuildPending)
+        {
+            UpdateImprovedBVHs();
+            return;
+        }
+
+        if (_bvhBatch >= 0 && !TinyBVH.IsBVHBatchReady(_bvhBatch))
+            return;
+
+        foreach (long bvhHandle in _bvhList)
+        {
+            if (!TinyBVH.IsBVHReady(bvhHandle))
+                return;
+        }
+
+        _bvhBuildPending = false;
+        OnBVHBuildsComplete();
+    }
+
     public bool CanRender()
     {
-        return _bvhNodesBuffer != null && _bvhTrianglesBuffer != null;
+        return _bvhNodesBuffers[0] != null && _bvhTrianglesBuffers[0] != null;
     }
 
     public bool HasTextures()
@@ -139,7 +225,7 @@ public class BVHScene
 
     public void PrepareShader(CommandBuffer cmd, ComputeShader shader, int kernelIndex)
     {
-        if (_bvhNodesBuffer == null || _bvhTrianglesBuffer == null || _triangleAttributesBuffer == null)
+        if (!CanRender() || _triangleAttributesBuffer == null)
             return;
 
         LocalKeyword hasTLASKeyword = shader.keywordSpace.FindKeyword("HAS_TLAS");
@@ -148,8 +234,21 @@ public class BVHScene
         else
             shader.DisableKeyword(hasTLASKeyword);
 
-        cmd.SetComputeBufferParam(shader, kernelIndex, "BVHNodes", _bvhNodesBuffer);
-        cmd.SetComputeBufferParam(shader, kernelIndex, "BVHTris", _bvhTrianglesBuffer);
+        cmd.SetComputeBufferParam(shader, kernelIndex, "BVHNodes", _bvhNodesBuffers[0]);
+        cmd.SetComputeBufferParam(shader, kernelIndex, "BVHTris", _bvhTrianglesBuffers[0]);
+
+        // Both second pages are bound once either is in use, the first one stands in for an unused one.
+        LocalKeyword bvhPagedKeyword = shader.keywordSpace.FindKeyword("BVH_PAGED");
+        if (_bvhNodesBuffers[1] != null || _bvhTrianglesBuffers[1] != null)
+        {
+            shader.EnableKeyword(bvhPagedKeyword);
+            cmd.SetComputeBufferParam(shader, kernelIndex, "BVHNodes1", _bvhNodesBuffers[1] ?? _bvhNodesBuffers[0]);
+            cmd.SetComputeBufferParam(shader, kernelIndex, "BVHTris1", _bvhTrianglesBuffers[1] ?? _bvhTrianglesBuffers[0]);
+        }
+        else
+        {
+            shader.DisableKeyword(bvhPagedKeyword);
+        }
         cmd.SetComputeBufferParam(shader, kernelIndex, "TriangleAttributesBuffer", _triangleAttributesBuffer);
         cmd.SetComputeBufferParam(shader, kernelIndex, "Materials", _materialsBuffer);
 
@@ -439,6 +538,8 @@ public class BVHScene
         _materials.Clear();
         _triangleAttributeOffsets.Clear();
         _vertexPositionOffsets.Clear();
+        _meshVertexCounts.Clear();
+        _meshBuildQualities.Clear();
 
         // Populate list of mesh renderers to trace against
         var meshRenderers = UnityEngine.Object.FindObjectsByType<MeshRenderer>(FindObjectsSortMode.None);
@@ -459,14 +560,19 @@ public class BVHScene
             }
 
             int triangleCount = Utilities.GetTriangleCount(mesh);
+            int vertexCount = _useIndexedGeometry ? mesh.vertexCount : triangleCount * 3;
 
             _meshes.Add(mesh);
             _meshRenderers.Add(renderer);
             _meshStartIndices.Add(_totalTriangleCount);
             _meshTriangleCount.Add(triangleCount);
+            _meshVertexCounts.Add(vertexCount);
+
+            BVHBuildSettings buildSettings = renderer.GetComponent<BVHBuildSettings>();
+            _meshBuildQualities.Add((int)(buildSettings != null ? buildSettings.quality : _buildQuality));
 
             _totalTriangleCount += triangleCount;
-            _totalVertexCount += triangleCount * 3;
+            _totalVertexCount += vertexCount;
         }
 
         if (_totalVertexCount == 0)
@@ -479,8 +585,13 @@ public class BVHScene
 
         // Allocate buffers
         _vertexPositionBufferGPU = new ComputeBuffer(_totalVertexCount, kVertexPositionSize);
-        _vertexPositionBufferCPU = new NativeArray<Vector4>(_totalVertexCount * kVertexPositionSize, Allocator.Persistent);
+        _vertexPositionBufferCPU = new NativeArray<Vector4>(_totalVertexCount, Allocator.Persistent);
         _triangleAttributesBuffer = new ComputeBuffer(_totalTriangleCount, kTriangleAttributeSize);
+        if (_useIndexedGeometry)
+        {
+            _indexBufferGPU = new ComputeBuffer(_totalTriangleCount * 3, kVertexIndexSize);
+            _indexBufferCPU = new NativeArray<uint>(_totalTriangleCount * 3, Allocator.Persistent);
+        }
 
         int vertexOffset = 0;
         int triangleOffset = 0;
@@ -491,6 +602,7 @@ public class BVHScene
         {
             Mesh mesh = _meshes[meshIndex];
             int triangleCount = Utilities.GetTriangleCount(mesh);
+            int vertexCount = _meshVertexCounts[meshIndex];
 
             int materialIndex = 0; // materialIndex is stored in GPUInstance
 
@@ -540,6 +652,13 @@ public class BVHScene
             _meshProcessingShader.SetInt("TriangleCount", triangleCount);
             _meshProcessingShader.SetInt("OutputTriangleStart", triangleOffset);
             _meshProcessingShader.SetInt("MaterialIndex", materialIndex);
+            _meshProcessingShader.SetInt("VertexCount", vertexCount);
+            _meshProcessingShader.SetInt("OutputVertexStart", vertexOffset);
+            // A BLAS per mesh indexes from the mesh's first vertex, a single BVH over all
+            // meshes indexes the whole buffer.
+            _meshProcessingShader.SetInt("IndexBase", _useTLAS ? 0 : vertexOffset);
+            if (_useIndexedGeometry)
+                _meshProcessingShader.SetBuffer(0, "IndexOutputBuffer", _indexBufferGPU);
 
             _meshProcessingShader.SetMatrix("LocalToWorld", localToWorld);
             _meshProcessingShader.SetMatrix("WorldToLocal", worldToLocal);
@@ -550,22 +669,33 @@ public class BVHScene
             _meshProcessingShader.SetKeyword(_hasUVsKeyword, mesh.HasVertexAttribute(VertexAttribute.TexCoord0));
             _meshProcessingShader.SetKeyword(_hasTangentsKeyword, mesh.HasVertexAttribute(VertexAttribute.Tangent));
             _meshProcessingShader.SetKeyword(_hasIndexBufferKeyword, indexBuffer != null);
+            _meshProcessingShader.SetKeyword(_indexedOutputKeyword, _useIndexedGeometry);
 
             int dispatchX = Mathf.CeilToInt(triangleCount / 64.0f);
             _meshProcessingShader.Dispatch(0, dispatchX, 1, 1);
 
+            if (_useIndexedGeometry)
+            {
+                _meshProcessingShader.SetBuffer(_processVerticesKernel, "VertexBuffer", vertexBuffer);
+                _meshProcessingShader.SetBuffer(_processVerticesKernel, "VertexPositionBuffer", _vertexPositionBufferGPU);
+                _meshProcessingShader.Dispatch(_processVerticesKernel, Mathf.CeilToInt(vertexCount / 64.0f), 1, 1);
+            }
+
             vertexBuffer?.Dispose();
             indexBuffer?.Dispose();
 
             triangleOffset += triangleCount;
-            vertexOffset += triangleCount * 3;
+            vertexOffset += vertexCount;
         }
 
         Debug.Log($"Meshes processed.");
 
         // Initiate async readback of vertex buffer to pass to TinyBVH to build
         _readbackStartTime = DateTime.UtcNow;
+        _pendingReadbacks = _useIndexedGeometry ? 2 : 1;
         AsyncGPUReadback.RequestIntoNativeArray(ref _vertexPositionBufferCPU, _vertexPositionBufferGPU, OnCompleteReadback);
+        if (_useIndexedGeometry)
+            AsyncGPUReadback.RequestIntoNativeArray(ref _indexBufferCPU, _indexBufferGPU, OnCompleteReadback);
     }
 
     unsafe void OnCompleteReadback(AsyncGPUReadbackRequest request)
@@ -576,95 +706,67 @@ public class BVHScene
             return;
         }
 
+        // Indexed geometry reads back vertices and indices separately, build once both arrived.
+        if (--_pendingReadbacks > 0)
+            return;
+
         TimeSpan readbackTime = DateTime.UtcNow - _readbackStartTime;
         Debug.Log($"Mesh GPU Readback Took: {readbackTime.TotalMilliseconds:n0}ms");
 
-        // In the editor if we exit play mode before the bvh is finished building the memory will be freed
-        // and TinyBVH will illegal access and crash everything. 
-        #if UNITY_EDITOR
-            NativeArray<Vector4> persistentBuffer = new(_vertexPositionBufferCPU.Length, Allocator.Persistent);
-            persistentBuffer.CopyFrom(_vertexPositionBufferCPU);
-            IntPtr dataPointer = (IntPtr)NativeArrayUnsafeUtility.GetUnsafeReadOnlyPtr(persistentBuffer);
-        #else
-            IntPtr dataPointer = (IntPtr)NativeArrayUnsafeUtility.GetUnsafeReadOnlyPtr(_vertexPositionBufferCPU);
-        #endif
-
-        DateTime bvhStartTime = DateTime.UtcNow;
-
-        int totalNodeSize = 0;
-        int totalTriSize = 0;
+        // The builds read straight from _vertexPositionBufferCPU and _indexBufferCPU, which stay
+        // alive until OnDestroy. OnDestroy waits for any builds still in flight before they are disposed.
+        IntPtr dataPointer = (IntPtr)NativeArrayUnsafeUtility.GetUnsafeReadOnlyPtr(_vertexPositionBufferCPU);
+        IntPtr indexPointer = _useIndexedGeometry ? (IntPtr)NativeArrayUnsafeUtility.GetUnsafeReadOnlyPtr(_indexBufferCPU) : IntPtr.Zero;
 
-        List<int> bvhList = new();
-        List<int> nodeSizeList = new();
-        List<int> triSizeList = new();
+        _bvhStartTime = DateTime.UtcNow;
+        _bvhList.Clear();
+        _bvhVersion = 0;
 
         if (_useTLAS)
         {
+            int[] meshOffsets = new int[_meshes.Count];
+            int[] vertexCounts = new int[_meshes.Count];
+            int[] indexOffsets = new int[_meshes.Count];
+            int[] triCounts = new int[_meshes.Count];
+            int[] qualities = _meshBuildQualities.ToArray();
             for (int i = 0; i < _meshes.Count; i++)
             {
-                int meshTriangleCount = _meshTriangleCount[i];
-                int dataPointerOffset = _vertexPositionOffsets[i];
-
-                MeshRenderer renderer = _meshRenderers[i];
-                Debug.Log($"Building BVH for Mesh {i + 1}/{_meshes.Count} {renderer.gameObject.name} Triangles: {meshTriangleCount:n0} Offset: {dataPointerOffset:n0} / {_vertexPositionBufferCPU.Length:n0}");
-
-                IntPtr meshPtr = IntPtr.Add(dataPointer, dataPointerOffset);
-
-                int bvhIndex = TinyBVH.BuildBVH(meshPtr, meshTriangleCount);
-                bvhList.Add(bvhIndex);
-
-                // Get the sizes of the arrays
-                int nodesSize = TinyBVH.GetCWBVHNodesSize(bvhIndex);
-                int trisSize = TinyBVH.GetCWBVHTrisSize(bvhIndex);
-                nodeSizeList.Add(nodesSize);
-                triSizeList.Add(trisSize);
-
-                totalNodeSize += nodesSize;
-                totalTriSize += trisSize;
-                Debug.Log($"BVH Nodes Size: {nodesSize:n0} Triangles Size: {trisSize:n0}");
+                meshOffsets[i] = _vertexPositionOffsets[i] / kVertexPositionSize;
+                vertexCounts[i] = _meshVertexCounts[i];
+                indexOffsets[i] = _meshStartIndices[i] * 3;
+                triCounts[i] = _meshTriangleCount[i];
             }
+
+            Debug.Log($"Building BVHs for {_meshes.Count} Meshes, Triangles: {_totalTriangleCount:n0}");
+            if (_useIndexedGeometry)
+                _bvhBatch = TinyBVH.BuildBVHBatchIndexedDeferred(dataPointer, meshOffsets, vertexCounts, indexPointer, indexOffsets, triCounts, qualities, _meshes.Count);
+            else
+                _bvhBatch = TinyBVH.BuildBVHBatchDeferred(dataPointer, meshOffsets, triCounts, qualities, _meshes.Count);
         }
-        else
+        // Without a TLAS the whole scene is one BVH, built with the default quality.
+        else if (_useIndexedGeometry)
         {
-            int bvhIndex = TinyBVH.BuildBVH(dataPointer, _totalTriangleCount);
-            bvhList.Add(bvhIndex);
-            int nodesSize = TinyBVH.GetCWBVHNodesSize(bvhIndex);
-            int trisSize = TinyBVH.GetCWBVHTrisSize(bvhIndex);
-            nodeSizeList.Add(nodesSize);
-            triSizeList.Add(trisSize);
-            totalNodeSize += nodesSize;
-            totalTriSize += trisSize;
-            Debug.Log($"BVH Nodes Size: {nodesSize:n0} Triangles Size: {trisSize:n0}");
+            _bvhList.Add(TinyBVH.BuildBVHIndexedDeferred(dataPointer, _totalVertexCount, indexPointer, _totalTriangleCount, _buildQuality));
         }
-
-        _bvhNodesBuffer = new ComputeBuffer(totalNodeSize / 4, 4);
-        _bvhTrianglesBuffer = new ComputeBuffer(totalTriSize / 4, 4);
-
-        List<int> nodeOffsetList = new();
-        List<int> triOffsetList = new();
-
-        int nodeOffset = 0;
-        int triOffset = 0;
-        for (int i = 0; i < bvhList.Count; ++i)
+        else
         {
-            int bvhIndex = bvhList[i];
-            int nodesSize = nodeSizeList[i];
-            int trisSize = triSizeList[i];
+            _bvhList.Add(TinyBVH.BuildBVHDeferred(dataPointer, _totalTriangleCount, _buildQuality));
+        }
 
-            //Debug.Log($"Uploading BVH Data for Mesh {i + 1}/{_meshes.Count} Offset:{nodeOffset:n0}-{(nodeOffset + nodesSize):n0}/{totalNodeSize:n0} TriOffset:{triOffset:n0}-{(triOffset + trisSize):n0}/{totalTriSize:n0}");
+        _bvhBuildPending = true;
+    }
 
-            if (TinyBVH.GetCWBVHData(bvhIndex, out IntPtr nodesPtr, out IntPtr trisPtr))
-            {
-                Utilities.UploadFromPointer(ref _bvhNodesBuffer, nodesPtr, nodesSize, 4, totalNodeSize, nodeOffset);
-                Utilities.UploadFromPointer(ref _bvhTrianglesBuffer, trisPtr, trisSize, 4, totalTriSize, triOffset);
-            }
+    // Called from Update once every BVH started in OnCompleteReadback has finished building.
+    unsafe void OnBVHBuildsComplete()
+    {
+        TimeSpan buildTime = DateTime.UtcNow - _bvhStartTime;
+        Debug.Log($"BVH builds finished in: {buildTime.TotalMilliseconds:n0}ms");
 
-            nodeOffsetList.Add(nodeOffset);
-            triOffsetList.Add(triOffset);
+        DateTime uploadStartTime = DateTime.UtcNow;
 
-            nodeOffset += nodesSize;
-            triOffset += trisSize;
-        }
+        BVHPageEntry[] pageTable = _bvhBatch >= 0 ? UploadBVHBatch() : UploadBVHList(_bvhList);
+        if (pageTable == null)
+            return;
 
         int totalInstancedTriangles = 0;
 
@@ -689,22 +791,19 @@ public class BVHScene
                 Matrix4x4 worldToLocal = renderer.worldToLocalMatrix;
                 Bounds bounds = renderer.bounds;
 
-                int bvhIndex = bvhList[meshIndex];
-
                 _blasInstances[instanceIndex].localToWorld = localToWorld;
                 _blasInstances[instanceIndex].worldToLocal = worldToLocal;
                 _blasInstances[instanceIndex].aabbMin = bounds.min;
                 _blasInstances[instanceIndex].blasIndex = instanceIndex;
                 _blasInstances[instanceIndex].aabbMax = bounds.max;
 
-                _gpuInstances[instanceIndex].bvhOffset = nodeOffsetList[meshIndex] / kBVHNodeSize;
-                _gpuInstances[instanceIndex].triOffset = triOffsetList[meshIndex] / kBVHTriSize;
+                SetInstancePages(ref _gpuInstances[instanceIndex], pageTable[meshIndex]);
                 _gpuInstances[instanceIndex].triAttributeOffset = _triangleAttributeOffsets[meshIndex] / kTriangleAttributeSize;
                 _gpuInstances[instanceIndex].materialIndex = materialIndex;
                 _gpuInstances[instanceIndex].localToWorld = localToWorld;
                 _gpuInstances[instanceIndex].worldToLocal = worldToLocal;
 
-                //Debug.Log($"INSTANCE {instanceIndex} Mesh: {meshIndex} BVH: {bvhIndex} Material: {materialIndex} Bounds: {bounds.min}x{bounds.max} TriOffset: {_gpuInstances[instanceIndex].triOffset} TriAttrOffset: {_gpuInstances[instanceIndex].triAttributeOffset}");
+                //Debug.Log($"INSTANCE {instanceIndex} Mesh: {meshIndex} Material: {materialIndex} Bounds: {bounds.min}x{bounds.max} TriOffset: {_gpuInstances[instanceIndex].triOffset} TriAttrOffset: {_gpuInstances[instanceIndex].triAttributeOffset}");
 
                 totalInstancedTriangles += _meshTriangleCount[meshIndex];
             }
@@ -727,43 +826,221 @@ public class BVHScene
             }
             //Debug.Log("-------");
 
-            NativeArray<BLASInstance> blasInstancesPtr = new(_blasInstances, Allocator.Persistent);
-            IntPtr blasInstancesCPtr = (IntPtr)NativeArrayUnsafeUtility.GetUnsafeReadOnlyPtr(blasInstancesPtr);
+            IntPtr blasInstancesCPtr = CopyBLASInstances();
 
-            int tlasIndex = TinyBVH.BuildTLAS(blasInstancesCPtr, _blasInstances.Length);
+            if (_tlasHandle >= 0)
+                TinyBVH.RebuildTLAS(_tlasHandle, blasInstancesCPtr, _blasInstances.Length);
+            else
+                _tlasHandle = TinyBVH.BuildTLAS(blasInstancesCPtr, _blasInstances.Length);
             Debug.Log($"Total Instances: {_blasInstances.Length} Instanced Triangles: {totalInstancedTriangles:n0}");
+            Debug.Log($"TLAS Nodes Size: {TinyBVH.GetTLASNodesSize(_tlasHandle):n0} bytes");
 
-            if (TinyBVH.GetTLASData(tlasIndex, out IntPtr tlasNodesPtr, out IntPtr tlasIndicesPtr))
-            {
-                int tlasNodeSize = TinyBVH.GetTLASNodesSize(tlasIndex);
-                Debug.Log($"TLAS Nodes Size: {tlasNodeSize:n0}  Buffer Size: {tlasNodeSize:n0} {tlasIndicesPtr} bytes");
+            UploadTLAS();
+        }
+
+        TimeSpan uploadTime = DateTime.UtcNow - uploadStartTime;
 
-                int tlasDataSize = tlasNodeSize + (_blasInstances.Length * 4);
+        Debug.Log($"Uploading BVH took: {uploadTime.TotalMilliseconds:n0}ms");
 
-                _tlasIndexOffset = tlasNodeSize / 4;
+        ReleaseUploadedBVHs();
+    }
 
-                Utilities.UploadFromPointer(ref _tlasDataBuffer, tlasNodesPtr, tlasNodeSize, 4, tlasDataSize, 0);
-                Utilities.UploadFromPointer(ref _tlasDataBuffer, tlasIndicesPtr, _blasInstances.Length * 4, 4, tlasDataSize, tlasNodeSize);
+    // BVH data is now on the GPU, so the plugin's copies can be freed. Progressive builds keep
+    // them until every BVH has been improved and uploaded again.
+    void ReleaseUploadedBVHs()
+    {
+        if (_bvhBatch >= 0 && TinyBVH.IsBVHBatchImproving(_bvhBatch))
+            return;
+        foreach (long bvhHandle in _bvhList)
+        {
+            if (TinyBVH.IsBVHImproving(bvhHandle))
+                return;
+        }
+
+        if (_bvhBatch >= 0)
+        {
+            TinyBVH.DestroyBVHBatch(_bvhBatch);
+            _bvhBatch = -1;
+        }
+        foreach (long bvhHandle in _bvhList)
+            TinyBVH.DestroyBVH(bvhHandle);
+        _bvhList.Clear();
+
+        // Gives the memory builds no longer need back to the system.
+        TinyBVH.GetBuildArenaUsage(out _, out long peak, out long reserved);
+        long released = TinyBVH.TrimBuildArena();
+        Debug.Log($"BVH build memory peak: {peak:n0} bytes, released: {released:n0} of {reserved:n0} bytes");
+    }
+
+    // The plugin encodes every mesh of the batch straight into the mapped GPU buffers, in the
+    // layout the shaders read, so there is no intermediate CPU copy. Returns where each mesh
+    // went, or null if the batch doesn't fit.
+    unsafe BVHPageEntry[] UploadBVHBatch()
+    {
+        long nodesSize = TinyBVH.GetBVHBatchNodesSize(_bvhBatch);
+        long trisSize = TinyBVH.GetBVHBatchTrisSize(_bvhBatch);
+        Debug.Log($"BVH Nodes Size: {nodesSize:n0} Triangles Size: {trisSize:n0}");
+
+        BVHPageEntry[] pageTable = new BVHPageEntry[_meshes.Count];
+        long[] nodePageSizes = new long[_meshes.Count];
+        long[] triPageSizes = new long[_meshes.Count];
+        if (!TinyBVH.LayoutBVHBatchPages(_bvhBatch, _bvhPageSize, pageTable, nodePageSizes, triPageSizes))
+        {
+            LogBVHPageTooSmall();
+            return null;
+        }
+
+        IntPtr* nodePages = stackalloc IntPtr[kMaxBVHPages];
+        IntPtr* triPages = stackalloc IntPtr[kMaxBVHPages];
+        if (!BeginPagedWrite(_bvhNodesBuffers, nodePageSizes, kBVHNodeSize, nodePages, out BVHPagedBuffer nodes))
+            return null;
+        if (!BeginPagedWrite(_bvhTrianglesBuffers, triPageSizes, kBVHTriSize, triPages, out BVHPagedBuffer tris))
+        {
+            EndPagedWrite(_bvhNodesBuffers);
+            return null;
+        }
+
+        bool written = TinyBVH.WriteBVHBatchDataPaged(_bvhBatch, ref nodes, ref tris, pageTable);
+        EndPagedWrite(_bvhNodesBuffers);
+        EndPagedWrite(_bvhTrianglesBuffers);
+        return written ? pageTable : null;
+    }
+
+    // Uploads the BVHs of progressive builds again whenever the plugin swapped in improved ones.
+    // Improved BVHs have other sizes, so every mesh moves in the buffers.
+    void UpdateImprovedBVHs()
+    {
+        if (_bvhBatch < 0 && _bvhList.Count == 0)
+            return;
+
+        int version = 0;
+        bool improving = false;
+        if (_bvhBatch >= 0)
+        {
+            version = TinyBVH.GetBVHBatchVersion(_bvhBatch);
+            improving = TinyBVH.IsBVHBatchImproving(_bvhBatch);
+        }
+        foreach (long bvhHandle in _bvhList)
+        {
+            version += TinyBVH.GetBVHVersion(bvhHandle);
+            improving |= TinyBVH.IsBVHImproving(bvhHandle);
+        }
+
+        if (version != _bvhVersion)
+        {
+            _bvhVersion = version;
+            Debug.Log($"Uploading improved BVHs after: {(DateTime.UtcNow - _bvhStartTime).TotalMilliseconds:n0}ms");
+
+            BVHPageEntry[] pageTable = _bvhBatch >= 0 ? UploadBVHBatch() : UploadBVHList(_bvhList);
+            if (_useTLAS && pageTable != null)
+            {
+                for (int instanceIndex = 0; instanceIndex < _sceneMeshRenderers.Count; ++instanceIndex)
+                {
+                    Mesh mesh = _sceneMeshRenderers[instanceIndex].gameObject.GetComponent<MeshFilter>().sharedMesh;
+                    int meshIndex = _meshes.IndexOf(mesh);
+                    SetInstancePages(ref _gpuInstances[instanceIndex], pageTable[meshIndex]);
+                }
+                _blasInstancesBuffer.SetData(_gpuInstances);
             }
+        }
 
-            blasInstancesPtr.Dispose();
+        if (!improving)
+            ReleaseUploadedBVHs();
+    }
+
+    // Writes separately built BVHs into the node and triangle buffers, where LayoutBVHPages puts them.
+    unsafe BVHPageEntry[] UploadBVHList(List<long> bvhList)
+    {
+        long[] handles = bvhList.ToArray();
+        BVHPageEntry[] pageTable = new BVHPageEntry[handles.Length];
+        long[] nodePageSizes = new long[handles.Length];
+        long[] triPageSizes = new long[handles.Length];
+        if (!TinyBVH.LayoutBVHPages(handles, handles.Length, _bvhPageSize, pageTable, nodePageSizes, triPageSizes))
+        {
+            LogBVHPageTooSmall();
+            return null;
+        }
 
-            // We will rebuild a TLAS if the scene changes, so we don't need to keep the CPU memory of the current
-            // TLAS, as the data has already been uploaded to the GPU.
-            TinyBVH.DestroyTLAS(tlasIndex);
+        foreach (long bvhHandle in handles)
+            Debug.Log($"BVH Nodes Size: {TinyBVH.GetCWBVHNodesSize(bvhHandle):n0} Triangles Size: {TinyBVH.GetCWBVHTrisSize(bvhHandle):n0}");
 
-            // BVH data is now on the GPU, we can free the CPU memory
-            for (int i = 0; i < bvhList.Count; ++i)
-                TinyBVH.DestroyBVH(bvhList[i]);
+        IntPtr* nodePages = stackalloc IntPtr[kMaxBVHPages];
+        IntPtr* triPages = stackalloc IntPtr[kMaxBVHPages];
+        if (!BeginPagedWrite(_bvhNodesBuffers, nodePageSizes, kBVHNodeSize, nodePages, out BVHPagedBuffer nodes))
+            return null;
+        if (!BeginPagedWrite(_bvhTrianglesBuffers, triPageSizes, kBVHTriSize, triPages, out BVHPagedBuffer tris))
+        {
+            EndPagedWrite(_bvhNodesBuffers);
+            return null;
         }
 
-        TimeSpan bvhTime = DateTime.UtcNow - bvhStartTime;
+        bool written = true;
+        for (int i = 0; i < handles.Length; ++i)
+        {
+            BVHPageEntry entry = pageTable[i];
+            long nodesOffset = entry.nodePage * nodes.pageSize + (long)entry.nodeOffset * kBVHNodeSize;
+            long trisOffset = entry.triPage * tris.pageSize + (long)entry.triOffset * kBVHTriSize;
+            written &= TinyBVH.WriteCWBVHDataPaged(handles[i], ref nodes, nodesOffset, ref tris, trisOffset);
+        }
+        EndPagedWrite(_bvhNodesBuffers);
+        EndPagedWrite(_bvhTrianglesBuffers);
+        return written ? pageTable : null;
+    }
 
-        Debug.Log($"Building BVH took: {bvhTime.TotalMilliseconds:n0}ms");
+    static void SetInstancePages(ref GPUInstance instance, BVHPageEntry entry)
+    {
+        instance.bvhOffset = entry.nodeOffset;
+        instance.triOffset = entry.triOffset;
+        instance.bvhPage = entry.nodePage;
+        instance.triPage = entry.triPage;
+    }
+
+    // Sizes the pages of a BVH buffer to the bytes the layout uses in each and maps them for the
+    // plugin to write to. Returns false if the layout needs more pages than the shaders read.
+    unsafe bool BeginPagedWrite(ComputeBuffer[] buffers, long[] pageSizes, int elementSize, IntPtr* pages, out BVHPagedBuffer paged)
+    {
+        int pageCount = Math.Max(1, Array.FindLastIndex(pageSizes, size => size > 0) + 1);
+        paged = new BVHPagedBuffer { pages = (IntPtr)pages, pageCount = pageCount, pageSize = _bvhPageSize / elementSize * elementSize };
+        if (pageCount > kMaxBVHPages)
+        {
+            Debug.LogError($"BVH data needs {pageCount} pages of {paged.pageSize:n0} bytes, the shaders read {kMaxBVHPages}. " +
+                           "Enable compressedBVHTriangles, or raise bvhPageSizeMB or set it to 0 to use the device's buffer size limit.");
+            return false;
+        }
 
-        #if UNITY_EDITOR
-            persistentBuffer.Dispose();
-        #endif
+        for (int page = 0; page < kMaxBVHPages; ++page)
+        {
+            if (page < pageCount)
+            {
+                long pageBytes = page < pageSizes.Length ? pageSizes[page] : 0;
+                Utilities.PrepareWritableBuffer(ref buffers[page], (int)(pageBytes / 4), 4);
+                pages[page] = Utilities.BeginWrite(buffers[page]);
+            }
+            else
+            {
+                buffers[page]?.Release();
+                buffers[page] = null;
+            }
+        }
+        return true;
+    }
+
+    void LogBVHPageTooSmall()
+    {
+        string fix = _bvhPageSize < SystemInfo.maxGraphicsBufferSize
+            ? "Raise bvhPageSizeMB or set it to 0 to use the device's buffer size limit"
+            : _useTLAS ? "Split the largest mesh or enable compressedBVHTriangles"
+                       : "Enable useTLAS to build a BVH per mesh, or enable compressedBVHTriangles";
+        Debug.LogError($"A BVH doesn't fit in a page of {_bvhPageSize:n0} bytes. {fix}.");
+    }
+
+    static void EndPagedWrite(ComputeBuffer[] buffers)
+    {
+        foreach (ComputeBuffer buffer in buffers)
+        {
+            if (buffer != null)
+                Utilities.EndWrite(buffer);
+        }
     }
 
     public unsafe bool UpdateTLAS()
@@ -794,7 +1071,7 @@ public class BVHScene
                 continue;
             }
 
-            // A TLAS instance has been updated, we'll need to rebuild the TLAS structure.
+            // A TLAS instance has been updated, we'll need to refit the TLAS structure.
             isDirty = true;
 
             Matrix4x4 worldToLocal = renderer.worldToLocalMatrix;
@@ -817,26 +1094,63 @@ public class BVHScene
 
         _blasInstancesBuffer.SetData(_gpuInstances);
 
-        NativeArray<BLASInstance> blasInstancesPtr = new(_blasInstances, Allocator.Persistent);
-        IntPtr blasInstancesCPtr = (IntPtr)NativeArrayUnsafeUtility.GetUnsafeReadOnlyPtr(blasInstancesPtr);
+        IntPtr blasInstancesCPtr = CopyBLASInstances();
 
-        int tlasIndex = TinyBVH.BuildTLAS(blasInstancesCPtr, _gpuInstanceCount);
+        // Refitting keeps the tree and only moves bounds, the plugin rebuilds it once the
+        // tree has degraded too much. Either way the TLAS is updated in place.
+        if (_refitTLAS)
+            TinyBVH.RefitTLAS(_tlasHandle, blasInstancesCPtr, _gpuInstanceCount);
+        else
+            TinyBVH.RebuildTLAS(_tlasHandle, blasInstancesCPtr, _gpuInstanceCount);
 
-        if (TinyBVH.GetTLASData(tlasIndex, out IntPtr tlasNodesPtr, out IntPtr tlasIndicesPtr))
-        {
-            int tlasNodeSize = TinyBVH.GetTLASNodesSize(tlasIndex);
-            int tlasDataSize = tlasNodeSize + (_blasInstances.Length * 4);
+        UploadTLAS();
 
-            _tlasIndexOffset = tlasNodeSize / 4;
+        return true;
+    }
 
-            Utilities.UploadFromPointer(ref _tlasDataBuffer, tlasNodesPtr, tlasNodeSize, 4, tlasDataSize, 0);
-            Utilities.UploadFromPointer(ref _tlasDataBuffer, tlasIndicesPtr, _blasInstances.Length * 4, 4, tlasDataSize, tlasNodeSize);
+    // Copies the instances into memory the plugin can read, reusing the array between frames.
+    unsafe IntPtr CopyBLASInstances()
+    {
+        if (!_blasInstancesNative.IsCreated || _blasInstancesNative.Length != _blasInstances.Length)
+        {
+            if (_blasInstancesNative.IsCreated)
+                _blasInstancesNative.Dispose();
+            _blasInstancesNative = new NativeArray<BLASInstance>(_blasInstances.Length, Allocator.Persistent);
         }
 
-        blasInstancesPtr.Dispose();
+        _blasInstancesNative.CopyFrom(_blasInstances);
+        return (IntPtr)NativeArrayUnsafeUtility.GetUnsafeReadOnlyPtr(_blasInstancesNative);
+    }
 
-        TinyBVH.DestroyTLAS(tlasIndex);
+    // Uploads the TLAS nodes followed by its instance indices. The buffer only grows, so small
+    // changes in the node count don't recreate it, and only the ranges the plugin reports as
+    // changed since the last update are uploaded.
+    unsafe void UploadTLAS()
+    {
+        if (!TinyBVH.GetTLASDirtyRanges(_tlasHandle, out IntPtr tlasDataPtr, out IntPtr dirtyRangesPtr, out int dirtyRangeCount))
+            return;
 
-        return true;
+        int tlasNodeSize = TinyBVH.GetTLASNodesSize(_tlasHandle);
+        int tlasDataSize = tlasNodeSize + _blasInstances.Length * 4;
+
+        _tlasIndexOffset = tlasNodeSize / 4;
+
+        bool recreated = Utilities.ReserveBuffer(ref _tlasDataBuffer, tlasDataSize / 4, 4);
+        int tlasBufferSize = _tlasDataBuffer.count * 4;
+
+        if (recreated)
+        {
+            Utilities.UploadFromPointer(ref _tlasDataBuffer, tlasDataPtr, tlasDataSize, 4, tlasBufferSize, 0);
+            return;
+        }
+
+        // Two ints per range, its byte offset and size.
+        int* dirtyRanges = (int*)dirtyRangesPtr;
+        for (int i = 0; i < dirtyRangeCount; ++i)
+        {
+            int offset = dirtyRanges[i * 2];
+            int size = dirtyRanges[i * 2 + 1];
+            Utilities.UploadFromPointer(ref _tlasDataBuffer, tlasDataPtr + offset, size, 4, tlasBufferSize, offset);
+        }
     }
 }
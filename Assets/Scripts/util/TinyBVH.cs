@@ -1,5 +1,124 @@
 using System;
 using System.Runtime.InteropServices;
+using UnityEngine;
+
+// How much time a BLAS build spends on the quality of the tree, matches BVHBuildQuality in plugin.h.
+public enum BVHBuildQuality
+{
+    // Mid-point splits, for proxy geometry and meshes that are rebuilt often.
+    Quick = 0,
+    // Binned SAH.
+    Binned = 1,
+    // SAH with spatial splits. Slowest to build and can't be refit, for static hero meshes.
+    Spatial = 2,
+    // Binned SAH improved by subtree reinsertion, see SetBVHOptimizeSettings.
+    Optimized = 3,
+}
+
+// Caller memory split into pages of pageSize bytes, matches BVHPagedBuffer in plugin.h. pages
+// points to pageCount pointers, such as mapped GPU buffers. Node pages must hold whole 80 byte
+// nodes and triangle pages whole 16 byte float4s.
+[StructLayout(LayoutKind.Sequential)]
+public struct BVHPagedBuffer
+{
+    public IntPtr pages;
+    public int pageCount;
+    public long pageSize;
+}
+
+// Where a BLAS sits in paged BVH data, matches BVHPageEntry in plugin.h: the page holding its
+// nodes and its first node in that page, and likewise for its triangles in float4s.
+[StructLayout(LayoutKind.Sequential)]
+public struct BVHPageEntry
+{
+    public int nodePage;
+    public int nodeOffset;
+    public int triPage;
+    public int triOffset;
+}
+
+// A ray for IntersectRays and IsOccludedRays, matches BVHRay in plugin.h. The direction needn't
+// be normalized, hit distances are along the normalized direction and only count below tMax.
+[StructLayout(LayoutKind.Sequential)]
+public struct BVHRay
+{
+    public Vector3 origin;
+    public float tMax;
+    public Vector3 direction;
+    public float padding;
+}
+
+// Closest hit of a ray, matches BVHHit in plugin.h. prim is the triangle index, or
+// TinyBVH.NoHit with t = tMax if the ray hit nothing.
+[StructLayout(LayoutKind.Sequential)]
+public struct BVHHit
+{
+    public float t;
+    public float u;
+    public float v;
+    public uint prim;
+}
+
+// Closest hit of a ray in a query scene, matches BVHSceneHit in plugin.h. prim is the triangle
+// index within the instance's BLAS, both are TinyBVH.NoHit if the ray hit nothing.
+[StructLayout(LayoutKind.Sequential)]
+public struct BVHSceneHit
+{
+    public float t;
+    public float u;
+    public float v;
+    public uint prim;
+    public uint instance;
+}
+
+// The buffers for RenderReference, matches ReferenceScene in plugin.h. Pointers are to CPU
+// copies of the PathTracer kernel's buffers, IntPtr.Zero for those it isn't bound to.
+[StructLayout(LayoutKind.Sequential)]
+public struct ReferenceScene
+{
+    public IntPtr bvhNodes;
+    public IntPtr bvhTris;
+    public IntPtr bvhNodes1;
+    public IntPtr bvhTris1;
+    public IntPtr triangleAttributes;
+    public IntPtr materials;
+    public IntPtr tlasData;
+    public IntPtr blasInstances;
+    public IntPtr textureData;
+    public IntPtr lights;
+    public IntPtr environmentTexture;
+    public IntPtr environmentCdf;
+    public uint tlasIndexOffset;
+    public int compressedTris;
+    public int lightCount;
+    public int environmentTextureWidth;
+    public int environmentTextureHeight;
+    public float environmentCdfSum;
+}
+
+// The PathTracer kernel's parameters for RenderReference, matches ReferenceRenderSettings in
+// plugin.h.
+[StructLayout(LayoutKind.Sequential)]
+public struct ReferenceRenderSettings
+{
+    public Matrix4x4 camToWorld;
+    public Matrix4x4 camInvProj;
+    public int outputWidth;
+    public int outputHeight;
+    public uint currentSample;
+    public uint rngSeedRoot;
+    public uint maxRayBounces;
+    public int samplesPerPass;
+    public int useRussianRoulette;
+    public int useFireflyFilter;
+    public float maxFireflyLuminance;
+    public int environmentMode;
+    public float environmentIntensity;
+    public float environmentMapRotation;
+    public Vector3 environmentColor;
+    public float aperture;
+    public float focalLength;
+}
 
 // Access to the TinyBVH plugin.
 public class TinyBVH
@@ -13,39 +132,294 @@ public class TinyBVH
 #endif
 
     [DllImport(libraryName)]
-    public static extern int BuildBVH(IntPtr verticesPtr, int count);
+    public static extern long BuildBVH(IntPtr verticesPtr, int count, BVHBuildQuality quality);
+
+    // Queues the build on the plugin's worker threads. The vertex data must stay alive
+    // until IsBVHReady returns true.
+    [DllImport(libraryName)]
+    public static extern long BuildBVHAsync(IntPtr verticesPtr, int count, BVHBuildQuality quality);
+
+    // Builds from indexed vertices, three uint indices per triangle.
+    [DllImport(libraryName)]
+    public static extern long BuildBVHIndexed(IntPtr verticesPtr, int vertexCount, IntPtr indicesPtr, int triangleCount, BVHBuildQuality quality);
+
+    // Like BuildBVHAsync, but the CWBVH is only encoded by WriteCWBVHData, straight into
+    // the memory it is given. GetCWBVHData returns false for these BVHs.
+    [DllImport(libraryName)]
+    public static extern long BuildBVHDeferred(IntPtr verticesPtr, int count, BVHBuildQuality quality);
+
+    // The vertex and index data must stay alive until the BVH has been written.
+    [DllImport(libraryName)]
+    public static extern long BuildBVHIndexedDeferred(IntPtr verticesPtr, int vertexCount, IntPtr indicesPtr, int triangleCount, BVHBuildQuality quality);
+
+    // Reinsertion passes of BVHBuildQuality.Optimized builds, 25 by default. Extreme passes
+    // reinsert more subtrees each, for better trees at a higher cost.
+    [DllImport(libraryName)]
+    public static extern void SetBVHOptimizeSettings(int iterations, bool extreme);
+
+    // Builds started while enabled return a quick BVH first and rebuild it at the requested
+    // quality in the background. The vertex data must stay alive until they stop improving.
+    [DllImport(libraryName)]
+    public static extern void SetBVHProgressiveBuilds(bool enabled);
+
+    // BVHs built while enabled only keep their encoded CWBVH, which is smaller than the BVHs
+    // it is encoded from. Deferred builds are then encoded right away, and refits rebuild.
+    [DllImport(libraryName)]
+    public static extern void SetBVHLeanBuilds(bool enabled);
+
+    // BVHs built while enabled store their triangles as the distinct vertices of each node and
+    // small indices into them, about half the size. Render them with BVH_COMPRESSED_TRIS.
+    [DllImport(libraryName)]
+    public static extern void SetBVHCompressedTris(bool enabled);
+
+    // Swaps in a finished improvement and returns how many happened so far. Re-upload the BVH
+    // whenever this changes, its sizes and data only change during this call.
+    [DllImport(libraryName)]
+    public static extern int GetBVHVersion(long handle);
+
+    [DllImport(libraryName)]
+    public static extern bool IsBVHImproving(long handle);
+
+    [DllImport(libraryName)]
+    public static extern void DestroyBVH(long handle);
+
+    // Fits a BVH to new positions of the vertices it was built from, for skinned or morphing
+    // meshes, and updates its CWBVH data in place. Returns true if it had to be rebuilt instead.
+    [DllImport(libraryName)]
+    public static extern bool RefitBVH(long handle, IntPtr verticesPtr);
+
+    // SAH cost of the BVH relative to its last full build, refits make it grow as meshes deform.
+    [DllImport(libraryName)]
+    public static extern float GetBVHCostRatio(long handle);
+
+    [DllImport(libraryName)]
+    public static extern bool IsBVHReady(long handle);
+
+    [DllImport(libraryName)]
+    public static extern void WaitForBVH(long handle);
+
+    [DllImport(libraryName)]
+    public static extern int GetPendingBVHCount();
+
+    [DllImport(libraryName)]
+    public static extern void SetWorkerCount(int count);
+
+    [DllImport(libraryName)]
+    public static extern int GetWorkerCount();
+
+    [DllImport(libraryName)]
+    public static extern int GetSimdLevel();
+
+    [DllImport(libraryName)]
+    public static extern void SetSimdLevel(int level);
+
+    // Caches built BLASes on disk keyed by a hash of their vertices, identical geometry is
+    // memory-mapped instead of rebuilt. A null path disables the cache.
+    [DllImport(libraryName)]
+    public static extern void SetBVHCacheDirectory(string path, int maxSizeMB);
+
+    // Records the vertices, indices and instances of every BLAS and TLAS build, rebuild and
+    // refit, batches included, with the time of each call, into a file Plugin/tools/scene_replay
+    // can replay offline.
+    [DllImport(libraryName)]
+    public static extern bool StartSceneCapture(string path);
+
+    [DllImport(libraryName)]
+    public static extern void StopSceneCapture();
+
+    // BLAS builds allocate from an arena that keeps its memory between builds: the bytes in
+    // use, the most in use at once so far, and the bytes the arena holds.
+    [DllImport(libraryName)]
+    public static extern void GetBuildArenaUsage(out long used, out long peak, out long reserved);
 
+    // Releases the arena memory no BVH or build is using, returns the number of bytes released.
     [DllImport(libraryName)]
-    public static extern void DestroyBVH(int index);
+    public static extern long TrimBuildArena();
+
+    public const uint NoHit = 0xFFFFFFFF;
+
+    // Traces rays against a BLAS on the plugin's worker threads and returns how many hit, or -1
+    // for deferred BVHs that aren't encoded yet. Blocks of 256 rays from one origin, such as
+    // camera ray tiles, are traced as packets. Lean BVHs and BVHs loaded from the cache are
+    // traced through their CWBVH instead. The BVH's vertex data must still be alive.
+    [DllImport(libraryName)]
+    public static extern int IntersectRays(long handle, BVHRay[] rays, int count, BVHHit[] hits);
+
+    // Like IntersectRays, but only finds whether each ray hits anything before tMax, 1 if so.
+    // Returns -1 for the same BVHs.
+    [DllImport(libraryName)]
+    public static extern int IsOccludedRays(long handle, BVHRay[] rays, int count, byte[] occluded);
+
+    // Traces rays through the CWBVH of a BLAS exactly like bvh.hlsl, with directions used as
+    // given, as a reference for the GPU traversal. steps may be null.
+    [DllImport(libraryName)]
+    public static extern int IntersectCWBVHRays(long handle, BVHRay[] rays, int count, BVHHit[] hits, uint[] steps);
+
+    // Rays traced by the queries since the last reset, how many took the packet traversal, and
+    // the time spent tracing them.
+    [DllImport(libraryName)]
+    public static extern void GetRayQueryStats(out long rays, out long packetRays, out double seconds);
+
+    [DllImport(libraryName)]
+    public static extern void ResetRayQueryStats();
+
+    [DllImport(libraryName)]
+    public static extern IntPtr GetBVHPtr(long handle);
+
+    [DllImport(libraryName)]
+    public static extern long GetCWBVHNodesSize(long handle);
+
+    [DllImport(libraryName)]
+    public static extern long GetCWBVHTrisSize(long handle);
+
+    [DllImport(libraryName)]
+    public static extern bool GetCWBVHData(long handle, out IntPtr bvhNodes, out IntPtr bvhTris);
+
+    // Writes the BVH's triangles decoded to the uncompressed layout, to check compressed ones
+    // against an uncompressed build. Returns the bytes needed, and only writes if they fit.
+    [DllImport(libraryName)]
+    public static extern long DecodeCWBVHTris(long handle, IntPtr bvhTris, long capacity);
+
+    // Capacities are in bytes. Returns false if the BVH isn't ready or doesn't fit.
+    [DllImport(libraryName)]
+    public static extern bool WriteCWBVHData(long handle, IntPtr bvhNodes, long nodesCapacity, IntPtr bvhTris, long trisCapacity);
+
+    // Writes the BVH at byte offsets of paged buffers, for data larger than one buffer can hold.
+    [DllImport(libraryName)]
+    public static extern bool WriteCWBVHDataPaged(long handle, ref BVHPagedBuffer nodes, long nodesOffset, ref BVHPagedBuffer tris, long trisOffset);
+
+    // Lays out BVHs in pages of at most pageSize bytes without splitting any across pages.
+    // Node pages hold pageSize / 80 nodes and triangle pages pageSize / 16 float4s. Fills an
+    // entry per BVH and the bytes used in each page, 0 past the last page; both page size
+    // arrays need an element per BVH. Returns false if a BVH doesn't fit in a page.
+    [DllImport(libraryName)]
+    public static extern bool LayoutBVHPages(long[] handles, int count, long pageSize, BVHPageEntry[] table,
+        long[] nodePageSizes, long[] triPageSizes);
+
+    // Builds every mesh in parallel into one packed node/triangle arena. meshOffsets are in
+    // vertices and qualities holds a BVHBuildQuality per mesh, or null for the default. The
+    // vertex data must stay alive until IsBVHBatchReady returns true.
+    [DllImport(libraryName)]
+    public static extern long BuildBVHBatch(IntPtr verticesPtr, int[] meshOffsets, int[] triCounts, int[] qualities, int meshCount);
+
+    // Like BuildBVHBatch, but nothing is packed: WriteBVHBatchData encodes every mesh in
+    // parallel straight into the memory it is given.
+    [DllImport(libraryName)]
+    public static extern long BuildBVHBatchDeferred(IntPtr verticesPtr, int[] meshOffsets, int[] triCounts, int[] qualities, int meshCount);
+
+    // vertexOffsets are in vertices and indexOffsets in indices. Each mesh's indices are
+    // relative to its first vertex.
+    [DllImport(libraryName)]
+    public static extern long BuildBVHBatchIndexedDeferred(IntPtr verticesPtr, int[] vertexOffsets, int[] vertexCounts,
+        IntPtr indicesPtr, int[] indexOffsets, int[] triCounts, int[] qualities, int meshCount);
+
+    [DllImport(libraryName)]
+    public static extern void DestroyBVHBatch(long handle);
+
+    [DllImport(libraryName)]
+    public static extern bool IsBVHBatchReady(long handle);
+
+    [DllImport(libraryName)]
+    public static extern void WaitForBVHBatch(long handle);
+
+    // Like GetBVHVersion, for every mesh of the batch. Swapping in improved meshes changes the
+    // batch's sizes and offsets.
+    [DllImport(libraryName)]
+    public static extern int GetBVHBatchVersion(long handle);
+
+    [DllImport(libraryName)]
+    public static extern bool IsBVHBatchImproving(long handle);
+
+    [DllImport(libraryName)]
+    public static extern long GetBVHBatchNodesSize(long handle);
+
+    [DllImport(libraryName)]
+    public static extern long GetBVHBatchTrisSize(long handle);
+
+    // offsets points to two longs per mesh: the byte offset of its nodes and of its triangles.
+    [DllImport(libraryName)]
+    public static extern bool GetBVHBatchData(long handle, out IntPtr bvhNodes, out IntPtr bvhTris, out IntPtr offsets);
+
+    [DllImport(libraryName)]
+    public static extern IntPtr GetBVHBatchOffsets(long handle);
+
+    [DllImport(libraryName)]
+    public static extern bool WriteBVHBatchData(long handle, IntPtr bvhNodes, long nodesCapacity, IntPtr bvhTris, long trisCapacity);
+
+    // Like LayoutBVHPages, for the meshes of a batch.
+    [DllImport(libraryName)]
+    public static extern bool LayoutBVHBatchPages(long handle, long pageSize, BVHPageEntry[] table,
+        long[] nodePageSizes, long[] triPageSizes);
+
+    // Like WriteBVHBatchData, into paged buffers. Meshes go where the table from
+    // LayoutBVHBatchPages puts them, or at the batch's offsets if it is null.
+    [DllImport(libraryName)]
+    public static extern bool WriteBVHBatchDataPaged(long handle, ref BVHPagedBuffer nodes, ref BVHPagedBuffer tris, BVHPageEntry[] table);
+
+    [DllImport(libraryName)]
+    public static extern long BuildTLAS(IntPtr instances, int instanceCount);
+
+    // Rebuilds the TLAS in place, reusing its buffers if they are large enough.
+    [DllImport(libraryName)]
+    public static extern bool RebuildTLAS(long handle, IntPtr instances, int instanceCount);
+
+    // Fits the TLAS to moved instances without rebuilding it, unless its SAH cost grew past
+    // the rebuild threshold. Returns true if it was rebuilt.
+    [DllImport(libraryName)]
+    public static extern bool RefitTLAS(long handle, IntPtr instances, int instanceCount);
 
     [DllImport(libraryName)]
-    public static extern bool IsBVHReady(int index);
+    public static extern void SetTLASRebuildThreshold(float threshold);
 
     [DllImport(libraryName)]
-    public static extern IntPtr GetBVHPtr(int index);
+    public static extern float GetTLASCostRatio(long handle);
 
     [DllImport(libraryName)]
-    public static extern int GetCWBVHNodesSize(int index);
+    public static extern void DestroyTLAS(long handle);
 
     [DllImport(libraryName)]
-    public static extern int GetCWBVHTrisSize(int index);
+    public static extern bool IsTLASReady(long handle);
 
     [DllImport(libraryName)]
-    public static extern bool GetCWBVHData(int index, out IntPtr bvhNodes, out IntPtr bvhTris);
+    public static extern int GetTLASNodesSize(long handle);
 
+    [DllImport(libraryName)]
+    public static extern bool GetTLASData(long handle, out IntPtr tlasNodes, out IntPtr tlasIndices);
+
+    // The TLAS nodes and indices back to back, and the byte ranges of them that changed with the
+    // last build, rebuild or refit, two ints per range: offset and size.
+    [DllImport(libraryName)]
+    public static extern bool GetTLASDirtyRanges(long handle, out IntPtr tlasData, out IntPtr ranges, out int rangeCount);
+
+    // CPU ray queries through both levels of a scene, like the shaders trace it. Instances refer
+    // to the BLASes by their index in blasHandles, and the BLASes must outlive the scene.
+    [DllImport(libraryName)]
+    public static extern long CreateQueryScene(long[] blasHandles, int blasCount);
+
+    // Copies the BLAS instances, as passed to BuildTLAS, and builds the scene's TLAS over them.
+    // Call again after a BLAS is refit or improved, queries return -1 until then.
+    [DllImport(libraryName)]
+    public static extern bool SetQuerySceneInstances(long handle, IntPtr instances, int instanceCount);
+
+    [DllImport(libraryName)]
+    public static extern void DestroyQueryScene(long handle);
 
+    // Like IntersectRays and IsOccludedRays, for a query scene.
     [DllImport(libraryName)]
-    public static extern int BuildTLAS(IntPtr instances, int instanceCount);
+    public static extern int IntersectSceneRays(long handle, BVHRay[] rays, int count, BVHSceneHit[] hits);
 
     [DllImport(libraryName)]
-    public static extern void DestroyTLAS(int index);
+    public static extern int IsOccludedSceneRays(long handle, BVHRay[] rays, int count, byte[] occluded);
 
+    // Renders a pass of the PathTracer kernel on the CPU into output, a float4 per pixel, to
+    // check the GPU's image against. Blends with output's previous pass unless currentSample is 0.
     [DllImport(libraryName)]
-    public static extern bool IsTLASReady(int index);
+    public static extern bool RenderReference(ref ReferenceScene scene, ref ReferenceRenderSettings settings, Vector4[] output);
 
+    // Pixel samples and rays traced by RenderReference since the last reset, and the time it took.
     [DllImport(libraryName)]
-    public static extern int GetTLASNodesSize(int index);
+    public static extern void GetReferenceRenderStats(out long samples, out long rays, out double seconds);
 
     [DllImport(libraryName)]
-    public static extern bool GetTLASData(int index, out IntPtr tlasNodes, out IntPtr tlasIndices);
+    public static extern void ResetReferenceRenderStats();
 }
@@ -73,6 +73,48 @@ internal static class Utilities
         }
     }
 
+    // Like PrepareBuffer, but keeps the buffer if it is already large enough and grows it by half
+    // again otherwise, for data whose size changes from frame to frame. Returns true if the buffer
+    // was recreated, and so lost its contents.
+    public static bool ReserveBuffer(ref ComputeBuffer buffer, int count, int stride)
+    {
+        if (buffer != null && buffer.count >= count && buffer.stride == stride)
+            return false;
+
+        int capacity = buffer != null && buffer.stride == stride ? Math.Max(count, buffer.count + buffer.count / 2) : count;
+        buffer?.Release();
+        buffer = new ComputeBuffer(capacity, stride, ComputeBufferType.Structured);
+        return true;
+    }
+
+    // Like PrepareBuffer, but the buffer can be written in place with BeginWrite/EndWrite.
+    public static void PrepareWritableBuffer(ref ComputeBuffer buffer, int count, int stride)
+    {
+        if (buffer != null && (buffer.count != count || buffer.stride != stride))
+        {
+            buffer.Release();
+            buffer = null;
+        }
+
+        if (buffer == null)
+        {
+            buffer = new ComputeBuffer(count, stride, ComputeBufferType.Structured, ComputeBufferMode.SubUpdates);
+        }
+    }
+
+    // Maps a whole writable buffer and returns a pointer native code can write into.
+    // Every BeginWrite must be followed by EndWrite before the buffer is used.
+    public unsafe static IntPtr BeginWrite(ComputeBuffer buffer)
+    {
+        NativeArray<float> data = buffer.BeginWrite<float>(0, buffer.count * buffer.stride / 4);
+        return (IntPtr)NativeArrayUnsafeUtility.GetUnsafePtr(data);
+    }
+
+    public static void EndWrite(ComputeBuffer buffer)
+    {
+        buffer.EndWrite<float>(buffer.count * buffer.stride / 4);
+    }
+
     // Ensures the buffer is render texture and matches the requested width, height, and format.
     public static bool PrepareRenderTexture(ref RenderTexture texture, int width, int height, RenderTextureFormat format)
     {
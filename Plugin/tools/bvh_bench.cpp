@@ -0,0 +1,414 @@
+// Standalone benchmark of the plugin's BVH builders, run outside Unity. Loads triangle soups,
+// float4 vertices three per triangle exactly as BuildBVH receives them, builds every mode in
+// every layout and prints the results as JSON:
+//
+//   bvh_bench [--repeats N] [--rays N] [--threads N] [--no-epo] [--output file] scene.bin...
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#define TINYBVH_IMPLEMENTATION
+#include "plugin.h"
+#include "bvh_build_avx.h"
+#include "cwbvh_traversal.h"
+#include "bvh_bench.h"
+
+using tinybvh::bvhvec3;
+using tinybvh::bvhvec4;
+
+static const char* const kModeNames[] = { "quick", "binned", "hq", "optimized" };
+static const char* const kLayoutNames[] = { "BVH", "BVH_GPU", "BVH8_CWBVH", "BVH8_CPU" };
+static const int kModeCount = 4;
+static const int kLayoutCount = 4;
+
+struct BenchOptions
+{
+    int repeats = 3;
+    int rayCount = 1 << 20;
+    int threads = 0;
+    bool epo = true;
+    const char* output = nullptr;
+    std::vector<const char*> scenes;
+};
+
+struct BenchScene
+{
+    std::string path;
+    std::vector<bvhvec4> vertices;
+    uint32_t triangleCount = 0;
+    std::vector<BenchRay> primaryRays;
+    std::vector<BenchRay> diffuseRays;
+    LayoutResult results[kModeCount][kLayoutCount];
+};
+
+static bool CpuHasAVX2()
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+    int info[4];
+    __cpuid(info, 1);
+    bool fma = (info[2] & (1 << 12)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0 && (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+    __cpuidex(info, 7, 0);
+    return avx && fma && (info[1] & (1 << 5)) != 0;
+#elif defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+    return false;
+#endif
+}
+
+static bool LoadScene(const char* path, BenchScene& scene)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr)
+    {
+        fprintf(stderr, "bvh_bench: can't open %s\n", path);
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    const long triangleSize = 3 * sizeof(bvhvec4);
+    if (size <= 0 || size % triangleSize != 0)
+    {
+        fprintf(stderr, "bvh_bench: %s isn't a triangle soup of float4 vertices\n", path);
+        fclose(file);
+        return false;
+    }
+
+    scene.path = path;
+    scene.triangleCount = static_cast<uint32_t>(size / triangleSize);
+    scene.vertices.resize(scene.triangleCount * 3);
+    bool read = fread(scene.vertices.data(), triangleSize, scene.triangleCount, file) == scene.triangleCount;
+    fclose(file);
+    if (!read)
+        fprintf(stderr, "bvh_bench: failed to read %s\n", path);
+    return read;
+}
+
+static BenchRay MakeBenchRay(const bvhvec3& origin, const bvhvec3& direction)
+{
+    BenchRay ray;
+    ray.origin[0] = origin.x, ray.origin[1] = origin.y, ray.origin[2] = origin.z;
+    ray.direction[0] = direction.x, ray.direction[1] = direction.y, ray.direction[2] = direction.z;
+    return ray;
+}
+
+// Random float in [0, 1) from a per-ray xorshift state.
+static float NextRandom(uint32_t& state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return (state >> 8) * (1.0f / 16777216.0f);
+}
+
+// Primary rays of a pinhole camera looking at the scene's bounds from above and in front, and
+// a cosine-weighted diffuse bounce off every primary hit, found with a reference binned BVH so
+// every layout traces the same rays.
+static void GenerateRays(BenchScene& scene, int rayCount)
+{
+    tinybvh::bvhvec4slice vertices(scene.vertices.data(), scene.triangleCount * 3, sizeof(bvhvec4));
+    tinybvh::BVH bvh;
+    bvh.Build(vertices);
+
+    bvhvec3 extent = bvh.aabbMax - bvh.aabbMin;
+    bvhvec3 center = (bvh.aabbMin + bvh.aabbMax) * 0.5f;
+    float radius = std::max(tinybvh::tinybvh_length(extent) * 0.5f, 1e-6f);
+    bvhvec3 forward = tinybvh::tinybvh_normalize(bvhvec3(-0.4f, -0.35f, -1.0f));
+    bvhvec3 eye = center - forward * (radius * 2.0f);
+    bvhvec3 right = tinybvh::tinybvh_normalize(tinybvh::tinybvh_cross(forward, bvhvec3(0.0f, 1.0f, 0.0f)));
+    bvhvec3 up = tinybvh::tinybvh_cross(right, forward);
+    // A 60 degree field of view over the square image.
+    const float halfWidth = 0.57735027f;
+
+    int side = std::max(static_cast<int>(std::sqrt(static_cast<double>(rayCount))), 1);
+    scene.primaryRays.resize(side * side);
+    scene.diffuseRays.clear();
+    for (int y = 0; y < side; ++y)
+    {
+        for (int x = 0; x < side; ++x)
+        {
+            float u = ((x + 0.5f) / side * 2.0f - 1.0f) * halfWidth;
+            float v = (1.0f - (y + 0.5f) / side * 2.0f) * halfWidth;
+            bvhvec3 direction = tinybvh::tinybvh_normalize(forward + right * u + up * v);
+            scene.primaryRays[y * side + x] = MakeBenchRay(eye, direction);
+
+            tinybvh::Ray ray(eye, direction);
+            bvh.Intersect(ray);
+            if (ray.hit.t >= BVH_FAR)
+                continue;
+
+            const bvhvec4* triangle = &scene.vertices[ray.hit.prim * 3];
+            bvhvec3 v0 = triangle[0], v1 = triangle[1], v2 = triangle[2];
+            bvhvec3 normal = tinybvh::tinybvh_cross(v1 - v0, v2 - v0);
+            if (tinybvh::tinybvh_length(normal) <= 0.0f)
+                continue;
+            normal = tinybvh::tinybvh_normalize(normal);
+            if (tinybvh::tinybvh_dot(normal, direction) > 0.0f)
+                normal = normal * -1.0f;
+
+            bvhvec3 tangent = std::fabs(normal.x) > 0.9f ? bvhvec3(0.0f, 1.0f, 0.0f) : bvhvec3(1.0f, 0.0f, 0.0f);
+            tangent = tinybvh::tinybvh_normalize(tinybvh::tinybvh_cross(normal, tangent));
+            bvhvec3 bitangent = tinybvh::tinybvh_cross(normal, tangent);
+            uint32_t state = static_cast<uint32_t>(y * side + x) * 9781u + 6271u;
+            float r1 = NextRandom(state), r2 = NextRandom(state);
+            float phi = 6.28318530718f * r1, sinTheta = std::sqrt(r2);
+            bvhvec3 bounce = tangent * (std::cos(phi) * sinTheta) + bitangent * (std::sin(phi) * sinTheta) + normal * std::sqrt(1.0f - r2);
+            bvhvec3 origin = eye + direction * ray.hit.t + normal * (radius * 1e-5f);
+            scene.diffuseRays.push_back(MakeBenchRay(origin, tinybvh::tinybvh_normalize(bounce)));
+        }
+    }
+}
+
+static tinybvh::Ray ToTinyBVHRay(const BenchRay& ray)
+{
+    return tinybvh::Ray(bvhvec3(ray.origin[0], ray.origin[1], ray.origin[2]),
+                        bvhvec3(ray.direction[0], ray.direction[1], ray.direction[2]));
+}
+
+static float EPOCost(const tinybvh::BVH& bvh, const BenchOptions& options)
+{
+    return options.epo ? bvh.EPOCost() : -1.0f;
+}
+
+static void BenchBVH(const BenchScene& scene, int mode, const BenchOptions& options, LayoutResult& result)
+{
+    tinybvh::bvhvec4slice vertices(scene.vertices.data(), scene.triangleCount * 3, sizeof(bvhvec4));
+    tinybvh::BVH* bvh = nullptr;
+    result.buildSeconds = FastestRun(options.repeats, [&]()
+    {
+        delete bvh;
+        bvh = new tinybvh::BVH();
+        BuildBenchBVH<tinybvh::BVH, tinybvh::BVH_Verbose>(*bvh, vertices, mode);
+    });
+
+    auto trace = [bvh](const BenchRay& benchRay)
+    {
+        tinybvh::Ray ray = ToTinyBVHRay(benchRay);
+        bvh->Intersect(ray);
+        return ray.hit.t < BVH_FAR;
+    };
+
+    result.supported = true;
+    result.memoryBytes = static_cast<int64_t>(bvh->usedNodes) * sizeof(tinybvh::BVH::BVHNode) +
+                         static_cast<int64_t>(bvh->idxCount) * sizeof(uint32_t);
+    result.sah = bvh->SAHCost();
+    result.epo = EPOCost(*bvh, options);
+    result.primarySeconds = TraceBenchRays(scene.primaryRays, options.repeats, trace, result.primaryHits);
+    result.diffuseSeconds = TraceBenchRays(scene.diffuseRays, options.repeats, trace, result.diffuseHits);
+    delete bvh;
+}
+
+static void BenchBVHGPU(const BenchScene& scene, int mode, const BenchOptions& options, LayoutResult& result)
+{
+    tinybvh::bvhvec4slice vertices(scene.vertices.data(), scene.triangleCount * 3, sizeof(bvhvec4));
+    tinybvh::BVH_GPU* bvh = nullptr;
+    result.buildSeconds = FastestRun(options.repeats, [&]()
+    {
+        delete bvh;
+        bvh = new tinybvh::BVH_GPU();
+        BuildBenchBVH<tinybvh::BVH, tinybvh::BVH_Verbose>(bvh->bvh, vertices, mode);
+        bvh->ConvertFrom(bvh->bvh, true);
+    });
+
+    auto trace = [bvh](const BenchRay& benchRay)
+    {
+        tinybvh::Ray ray = ToTinyBVHRay(benchRay);
+        bvh->Intersect(ray);
+        return ray.hit.t < BVH_FAR;
+    };
+
+    result.supported = true;
+    result.memoryBytes = static_cast<int64_t>(bvh->usedNodes) * sizeof(tinybvh::BVH_GPU::BVHNode) +
+                         static_cast<int64_t>(bvh->bvh.idxCount) * sizeof(uint32_t);
+    result.sah = bvh->SAHCost();
+    result.epo = EPOCost(bvh->bvh, options);
+    result.primarySeconds = TraceBenchRays(scene.primaryRays, options.repeats, trace, result.primaryHits);
+    result.diffuseSeconds = TraceBenchRays(scene.diffuseRays, options.repeats, trace, result.diffuseHits);
+    delete bvh;
+}
+
+// Built and encoded like the plugin's BLASes, see BuildWideBVH, and traced with the plugin's
+// CPU version of the shader traversal.
+static void BenchCWBVH(const BenchScene& scene, int mode, const BenchOptions& options, LayoutResult& result)
+{
+    tinybvh::bvhvec4slice vertices(scene.vertices.data(), scene.triangleCount * 3, sizeof(bvhvec4));
+    tinybvh::BVH8_CWBVH* bvh = nullptr;
+    result.buildSeconds = FastestRun(options.repeats, [&]()
+    {
+        delete bvh;
+        bvh = new tinybvh::BVH8_CWBVH();
+        tinybvh::BVH& bvh2 = bvh->bvh8.bvh;
+        BuildBenchBVH<tinybvh::BVH, tinybvh::BVH_Verbose>(bvh2, vertices, mode);
+        bvh2.Compact();
+        bvh2.may_have_holes = false;
+        bvh2.idxCount = static_cast<uint32_t>(bvh2.PrimCount());
+        bvh2.SplitLeafs(3);
+        bvh->bvh8.ConvertFrom(bvh2, false);
+        bvh->ConvertFrom(bvh->bvh8, true);
+    });
+
+#ifdef CWBVH_TRAVERSAL_SSE2
+    const bool simd = true;
+#else
+    const bool simd = false;
+#endif
+    auto trace = [bvh, simd](const BenchRay& benchRay)
+    {
+        CWBVHRay ray = { bvhvec3(benchRay.origin[0], benchRay.origin[1], benchRay.origin[2]),
+                         bvhvec3(benchRay.direction[0], benchRay.direction[1], benchRay.direction[2]), 0.0f };
+        CWBVHHit hit = { BVH_FAR, 0.0f, 0.0f, BVH_NO_HIT, 0, 0 };
+        return IntersectCWBVH(bvh->bvh8Data, bvh->bvh8Tris, false, ray, hit, false, simd);
+    };
+
+    result.supported = true;
+    result.memoryBytes = static_cast<int64_t>(bvh->usedBlocks) * sizeof(bvhvec4) +
+                         static_cast<int64_t>(bvh->bvh8.idxCount) * 3 * sizeof(bvhvec4);
+    result.sah = bvh->SAHCost();
+    result.primarySeconds = TraceBenchRays(scene.primaryRays, options.repeats, trace, result.primaryHits);
+    result.diffuseSeconds = TraceBenchRays(scene.diffuseRays, options.repeats, trace, result.diffuseHits);
+    delete bvh;
+}
+
+static bool ParseOptions(int argc, char** argv, BenchOptions& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (strcmp(arg, "--repeats") == 0 && hasValue)
+            options.repeats = std::max(atoi(argv[++i]), 1);
+        else if (strcmp(arg, "--rays") == 0 && hasValue)
+            options.rayCount = std::max(atoi(argv[++i]), 1);
+        else if (strcmp(arg, "--threads") == 0 && hasValue)
+            options.threads = std::max(atoi(argv[++i]), 0);
+        else if (strcmp(arg, "--output") == 0 && hasValue)
+            options.output = argv[++i];
+        else if (strcmp(arg, "--no-epo") == 0)
+            options.epo = false;
+        else if (arg[0] == '-')
+            return false;
+        else
+            options.scenes.push_back(arg);
+    }
+    return !options.scenes.empty();
+}
+
+static void WriteJsonString(FILE* out, const std::string& text)
+{
+    fputc('"', out);
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+            fprintf(out, "\\%c", c);
+        else if (static_cast<unsigned char>(c) < 0x20)
+            fprintf(out, "\\u%04x", c);
+        else
+            fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+// Rays per second in millions, 0 for layouts that traced nothing.
+static double MRaysPerSecond(size_t rayCount, double seconds)
+{
+    return seconds > 0.0 ? rayCount / seconds * 1e-6 : 0.0;
+}
+
+static void WriteJson(FILE* out, const BenchOptions& options, const std::vector<BenchScene>& scenes)
+{
+    fprintf(out, "{\n  \"repeats\": %d,\n  \"threads\": %d,\n  \"scenes\": [", options.repeats,
+            JobSystem::Get().GetWorkerCount() + 1);
+    for (size_t s = 0; s < scenes.size(); ++s)
+    {
+        const BenchScene& scene = scenes[s];
+        fprintf(out, "%s\n    {\n      \"file\": ", s == 0 ? "" : ",");
+        WriteJsonString(out, scene.path);
+        fprintf(out, ",\n      \"triangles\": %u,\n      \"primaryRays\": %zu,\n      \"diffuseRays\": %zu,\n      \"results\": [",
+                scene.triangleCount, scene.primaryRays.size(), scene.diffuseRays.size());
+
+        bool first = true;
+        for (int mode = 0; mode < kModeCount; ++mode)
+        {
+            for (int layout = 0; layout < kLayoutCount; ++layout)
+            {
+                const LayoutResult& result = scene.results[mode][layout];
+                fprintf(out, "%s\n        { \"mode\": \"%s\", \"layout\": \"%s\", \"supported\": %s", first ? "" : ",",
+                        kModeNames[mode], kLayoutNames[layout], result.supported ? "true" : "false");
+                first = false;
+                if (result.supported)
+                {
+                    fprintf(out, ", \"buildMs\": %.3f, \"memoryBytes\": %lld", result.buildSeconds * 1000.0,
+                            static_cast<long long>(result.memoryBytes));
+                    if (result.sah >= 0.0f)
+                        fprintf(out, ", \"sah\": %.4f", result.sah);
+                    if (result.epo >= 0.0f)
+                        fprintf(out, ", \"epo\": %.4f", result.epo);
+                    fprintf(out, ", \"primaryMRaysPerSecond\": %.3f, \"primaryHits\": %lld, \"diffuseMRaysPerSecond\": %.3f, \"diffuseHits\": %lld",
+                            MRaysPerSecond(scene.primaryRays.size(), result.primarySeconds), static_cast<long long>(result.primaryHits),
+                            MRaysPerSecond(scene.diffuseRays.size(), result.diffuseSeconds), static_cast<long long>(result.diffuseHits));
+                }
+                fprintf(out, " }");
+            }
+        }
+        fprintf(out, "\n      ]\n    }");
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
+
+int main(int argc, char** argv)
+{
+    BenchOptions options;
+    if (!ParseOptions(argc, argv, options))
+    {
+        fprintf(stderr, "usage: bvh_bench [--repeats N] [--rays N] [--threads N] [--no-epo] [--output file] scene.bin...\n");
+        return 2;
+    }
+
+    JobSystem::Get().SetWorkerCount(options.threads);
+    bool avx2 = CpuHasAVX2();
+
+    std::vector<BenchScene> scenes(options.scenes.size());
+    for (size_t s = 0; s < scenes.size(); ++s)
+    {
+        BenchScene& scene = scenes[s];
+        if (!LoadScene(options.scenes[s], scene))
+            return 1;
+        GenerateRays(scene, options.rayCount);
+        fprintf(stderr, "%s: %u triangles, %zu primary and %zu diffuse rays\n", scene.path.c_str(), scene.triangleCount,
+                scene.primaryRays.size(), scene.diffuseRays.size());
+
+        for (int mode = 0; mode < kModeCount; ++mode)
+        {
+            fprintf(stderr, "  %s\n", kModeNames[mode]);
+            BenchBVH(scene, mode, options, scene.results[mode][0]);
+            BenchBVHGPU(scene, mode, options, scene.results[mode][1]);
+            BenchCWBVH(scene, mode, options, scene.results[mode][2]);
+            if (avx2)
+                BenchBVH8CPU(&scene.vertices[0].x, scene.triangleCount, mode, scene.primaryRays, scene.diffuseRays,
+                             options.repeats, scene.results[mode][3]);
+        }
+    }
+
+    FILE* out = options.output != nullptr ? fopen(options.output, "w") : stdout;
+    if (out == nullptr)
+    {
+        fprintf(stderr, "bvh_bench: can't write %s\n", options.output);
+        return 1;
+    }
+    WriteJson(out, options, scenes);
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
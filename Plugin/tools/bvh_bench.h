@@ -0,0 +1,117 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "job_system.h"
+
+// A ray of the benchmark, independent of the tinybvh copy that traces it.
+struct BenchRay
+{
+    float origin[3];
+    float direction[3];
+};
+
+// What bvh_bench measures for one build mode and layout. Costs are negative when not
+// measured, and nothing else is set for unsupported layouts.
+struct LayoutResult
+{
+    bool supported = false;
+    double buildSeconds = 0.0;
+    int64_t memoryBytes = 0;
+    float sah = -1.0f;
+    float epo = -1.0f;
+    double primarySeconds = 0.0;
+    double diffuseSeconds = 0.0;
+    int64_t primaryHits = 0;
+    int64_t diffuseHits = 0;
+};
+
+// Build modes, the same as BVHBuildQuality in plugin.h.
+enum BenchMode
+{
+    BENCH_MODE_QUICK = 0,
+    BENCH_MODE_BINNED = 1,
+    BENCH_MODE_HQ = 2,
+    BENCH_MODE_OPTIMIZED = 3,
+};
+
+// Subtree reinsertion iterations of the optimized mode, the plugin's default.
+static const int kBenchOptimizeIterations = 25;
+
+// Rays per job when tracing across the worker pool.
+static const int kBenchRayBlockSize = 256;
+
+// Runs body repeats times and returns the fastest run in seconds.
+template <class Body>
+double FastestRun(int repeats, const Body& body)
+{
+    double best = 0.0;
+    for (int i = 0; i < std::max(repeats, 1); ++i)
+    {
+        auto start = std::chrono::steady_clock::now();
+        body();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        best = i == 0 ? seconds : std::min(best, seconds);
+    }
+    return best;
+}
+
+// Traces rays across the worker pool, repeats times, and returns the fastest pass in seconds.
+// trace returns whether the ray it was given hit anything, hits gets the count.
+template <class Trace>
+double TraceBenchRays(const std::vector<BenchRay>& rays, int repeats, const Trace& trace, int64_t& hits)
+{
+    int count = static_cast<int>(rays.size());
+    int blockCount = (count + kBenchRayBlockSize - 1) / kBenchRayBlockSize;
+    return FastestRun(repeats, [&]()
+    {
+        std::atomic<int64_t> hitCount { 0 };
+        JobSystem::Get().ParallelFor(blockCount, [&](int block)
+        {
+            int64_t blockHits = 0;
+            int end = std::min(count, (block + 1) * kBenchRayBlockSize);
+            for (int i = block * kBenchRayBlockSize; i < end; ++i)
+                blockHits += trace(rays[i]) ? 1 : 0;
+            hitCount.fetch_add(blockHits, std::memory_order_relaxed);
+        });
+        hits = hitCount.load();
+    });
+}
+
+// Builds a binary BVH over a triangle soup the way the plugin does for each mode. Optimizing
+// goes through BVH_Verbose directly, BVH::Optimize leaks its copy. Works with either copy of
+// tinybvh.
+template <class BVH, class BVHVerbose, class Slice>
+void BuildBenchBVH(BVH& bvh, const Slice& vertices, int mode)
+{
+    switch (mode)
+    {
+    case BENCH_MODE_QUICK:
+        bvh.BuildQuick(vertices);
+        break;
+    case BENCH_MODE_HQ:
+        bvh.BuildHQ(vertices);
+        break;
+    case BENCH_MODE_OPTIMIZED:
+    {
+        bvh.Build(vertices);
+        BVHVerbose verbose(bvh.context);
+        verbose.ConvertFrom(bvh);
+        verbose.Optimize(kBenchOptimizeIterations, false);
+        bvh.ConvertFrom(verbose);
+        break;
+    }
+    default:
+        bvh.Build(vertices);
+        break;
+    }
+}
+
+// Benchmarks tinybvh's BVH8_CPU layout, which needs the AVX2 copy of tinybvh. Returns false
+// if the bench was built without it. Must only be called on CPUs with AVX2 and FMA.
+bool BenchBVH8CPU(const float* vertices, uint32_t triangleCount, int mode, const std::vector<BenchRay>& primaryRays,
+                  const std::vector<BenchRay>& diffuseRays, int repeats, LayoutResult& result);
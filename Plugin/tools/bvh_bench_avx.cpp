@@ -0,0 +1,55 @@
+#include "bvh_bench.h"
+
+#include "bvh_build_avx.h"
+
+#ifdef PLUGIN_HAS_AVX_BUILDER
+
+#if !defined(__AVX2__) || !defined(__FMA__) && !defined(_MSC_VER)
+#error "bvh_bench_avx.cpp must be compiled with AVX2 and FMA enabled"
+#endif
+
+// The AVX2 copy of tinybvh that bvh_build_avx.cpp implements, with the same settings.
+#define tinybvh tinybvh_avx2
+#define TINYBVH_FORK_JOIN PluginForkJoin
+#define MT_BUILD_MAX_DEPTH 8
+#include "tiny_bvh.h"
+
+bool BenchBVH8CPU(const float* vertices, uint32_t triangleCount, int mode, const std::vector<BenchRay>& primaryRays,
+                  const std::vector<BenchRay>& diffuseRays, int repeats, LayoutResult& result)
+{
+    tinybvh::bvhvec4slice slice(reinterpret_cast<const tinybvh::bvhvec4*>(vertices), triangleCount * 3, sizeof(tinybvh::bvhvec4));
+    tinybvh::BVH8_CPU* bvh = nullptr;
+    result.buildSeconds = FastestRun(repeats, [&]()
+    {
+        delete bvh;
+        bvh = new tinybvh::BVH8_CPU();
+        tinybvh::BVH& bvh2 = bvh->bvh8.bvh;
+        BuildBenchBVH<tinybvh::BVH, tinybvh::BVH_Verbose>(bvh2, slice, mode);
+        bvh->ConvertFrom(bvh->bvh8);
+    });
+
+    auto trace = [bvh](const BenchRay& benchRay)
+    {
+        tinybvh::Ray ray(tinybvh::bvhvec3(benchRay.origin[0], benchRay.origin[1], benchRay.origin[2]),
+                         tinybvh::bvhvec3(benchRay.direction[0], benchRay.direction[1], benchRay.direction[2]));
+        bvh->Intersect(ray);
+        return ray.hit.t < BVH_FAR;
+    };
+
+    result.supported = true;
+    result.memoryBytes = static_cast<int64_t>(bvh->usedBlocks) * 64;
+    result.sah = bvh->SAHCost(0);
+    result.primarySeconds = TraceBenchRays(primaryRays, repeats, trace, result.primaryHits);
+    result.diffuseSeconds = TraceBenchRays(diffuseRays, repeats, trace, result.diffuseHits);
+    delete bvh;
+    return true;
+}
+
+#else
+
+bool BenchBVH8CPU(const float*, uint32_t, int, const std::vector<BenchRay>&, const std::vector<BenchRay>&, int, LayoutResult&)
+{
+    return false;
+}
+
+#endif
@@ -0,0 +1,385 @@
+// Replays a capture written by StartSceneCapture through the plugin's own entry points, at
+// the times the calls were originally made, and prints how long each call took then and now
+// as JSON:
+//
+//   scene_replay [--fast] [--threads N] [--quality Q] [--output file] capture.bin
+//
+// --fast issues the calls back to back instead of waiting for their original start times, and
+// --quality rebuilds every BVH with another BVHBuildQuality. Asynchronous builds are timed
+// like they were captured, until they are queued, and deferred ones are never written since
+// the capture doesn't hold the writes.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <thread>
+#include <vector>
+
+#include "plugin.h"
+#include "scene_capture.h"
+
+struct ReplayOptions
+{
+    bool fast = false;
+    int threads = -1;
+    int quality = -1;
+    const char* output = nullptr;
+    const char* capture = nullptr;
+};
+
+// A replayed call and what it took when captured and when replayed, in nanoseconds.
+struct ReplayedCall
+{
+    CaptureRecord record;
+    int64_t duration;
+};
+
+// The arrays of a record, in float4s so the plugin gets vertices as aligned as it expects.
+typedef std::vector<std::vector<tinybvh::bvhvec4>> RecordArrays;
+
+// A replayed BVH, batch or TLAS and the arrays of the calls on it, kept until it is
+// destroyed since builds in the background and refits may still read them.
+struct ReplayedObject
+{
+    int64_t handle = 0;
+    std::vector<RecordArrays> arrays;
+};
+
+static bool ParseOptions(int argc, char** argv, ReplayOptions& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (strcmp(arg, "--fast") == 0)
+            options.fast = true;
+        else if (strcmp(arg, "--threads") == 0 && hasValue)
+            options.threads = atoi(argv[++i]);
+        else if (strcmp(arg, "--quality") == 0 && hasValue)
+            options.quality = atoi(argv[++i]);
+        else if (strcmp(arg, "--output") == 0 && hasValue)
+            options.output = argv[++i];
+        else if (arg[0] == '-' || options.capture != nullptr)
+            return false;
+        else
+            options.capture = arg;
+    }
+    return options.capture != nullptr;
+}
+
+static bool ReadHeader(FILE* file, const char* path)
+{
+    CaptureFileHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != kCaptureMagic)
+    {
+        fprintf(stderr, "scene_replay: %s isn't a scene capture\n", path);
+        return false;
+    }
+    if (header.captureVersion != kCaptureVersion || header.vertexSize != sizeof(tinybvh::bvhvec4) ||
+        header.instanceSize != sizeof(tinybvh::BLASInstance))
+    {
+        fprintf(stderr, "scene_replay: %s was captured by an incompatible build of the plugin\n", path);
+        return false;
+    }
+    return true;
+}
+
+static bool ReadArrays(FILE* file, const CaptureRecord& record, RecordArrays& arrays)
+{
+    uint64_t remaining = record.dataSize;
+    while (remaining > 0)
+    {
+        uint64_t size = 0;
+        if (remaining < sizeof(size) || fread(&size, sizeof(size), 1, file) != 1 || size > remaining - sizeof(size))
+            return false;
+        remaining -= sizeof(size) + size;
+
+        std::vector<tinybvh::bvhvec4> array(static_cast<size_t>((size + sizeof(tinybvh::bvhvec4) - 1) / sizeof(tinybvh::bvhvec4)));
+        if (size > 0 && fread(array.data(), static_cast<size_t>(size), 1, file) != 1)
+            return false;
+        arrays.push_back(std::move(array));
+    }
+    return true;
+}
+
+// The record's array at index as the type the call takes, null if it is empty or missing
+// like the pointer it was captured from.
+template <class T>
+static T* Array(RecordArrays& arrays, size_t index)
+{
+    return index < arrays.size() && !arrays[index].empty() ? reinterpret_cast<T*>(arrays[index].data()) : nullptr;
+}
+
+static int ArrayCount(const RecordArrays& arrays, size_t index, size_t elementSize)
+{
+    return index < arrays.size() ? static_cast<int>(arrays[index].size() * sizeof(tinybvh::bvhvec4) / elementSize) : 0;
+}
+
+static const char* RecordTypeName(uint32_t type)
+{
+    switch (type)
+    {
+    case CAPTURE_BUILD_BVH:
+        return "BuildBVH";
+    case CAPTURE_BUILD_TLAS:
+        return "BuildTLAS";
+    case CAPTURE_DESTROY_BVH:
+        return "DestroyBVH";
+    case CAPTURE_DESTROY_TLAS:
+        return "DestroyTLAS";
+    case CAPTURE_BUILD_BVH_INDEXED:
+        return "BuildBVHIndexed";
+    case CAPTURE_BUILD_BVH_ASYNC:
+        return "BuildBVHAsync";
+    case CAPTURE_BUILD_BVH_DEFERRED:
+        return "BuildBVHDeferred";
+    case CAPTURE_BUILD_BVH_INDEXED_DEFERRED:
+        return "BuildBVHIndexedDeferred";
+    case CAPTURE_REFIT_BVH:
+        return "RefitBVH";
+    case CAPTURE_BUILD_BVH_BATCH:
+        return "BuildBVHBatch";
+    case CAPTURE_BUILD_BVH_BATCH_DEFERRED:
+        return "BuildBVHBatchDeferred";
+    case CAPTURE_BUILD_BVH_BATCH_INDEXED_DEFERRED:
+        return "BuildBVHBatchIndexedDeferred";
+    case CAPTURE_DESTROY_BVH_BATCH:
+        return "DestroyBVHBatch";
+    case CAPTURE_REBUILD_TLAS:
+        return "RebuildTLAS";
+    case CAPTURE_REFIT_TLAS:
+        return "RefitTLAS";
+    default:
+        return "unknown";
+    }
+}
+
+static bool IsBLASBuild(uint32_t type)
+{
+    switch (type)
+    {
+    case CAPTURE_BUILD_BVH:
+    case CAPTURE_BUILD_BVH_INDEXED:
+    case CAPTURE_BUILD_BVH_ASYNC:
+    case CAPTURE_BUILD_BVH_DEFERRED:
+    case CAPTURE_BUILD_BVH_INDEXED_DEFERRED:
+    case CAPTURE_BUILD_BVH_BATCH:
+    case CAPTURE_BUILD_BVH_BATCH_DEFERRED:
+    case CAPTURE_BUILD_BVH_BATCH_INDEXED_DEFERRED:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Batches take their qualities from an array, --quality replaces it with one of its own.
+static int* BatchQualities(RecordArrays& arrays, size_t index, int meshCount, int quality)
+{
+    if (quality >= 0 && index < arrays.size())
+    {
+        arrays[index].assign((meshCount * sizeof(int) + sizeof(tinybvh::bvhvec4) - 1) / sizeof(tinybvh::bvhvec4), tinybvh::bvhvec4());
+        int* qualities = Array<int>(arrays, index);
+        for (int i = 0; i < meshCount; ++i)
+            qualities[i] = quality;
+    }
+    return Array<int>(arrays, index);
+}
+
+// The replayed object a call on a captured handle goes to, null if its creation wasn't
+// captured.
+static ReplayedObject* FindObject(std::map<int64_t, ReplayedObject>& objects, int64_t handle)
+{
+    auto found = objects.find(handle);
+    return found != objects.end() ? &found->second : nullptr;
+}
+
+static void WriteJson(FILE* out, const ReplayOptions& options, const std::vector<ReplayedCall>& calls, int64_t total)
+{
+    fprintf(out, "{\n  \"timing\": \"%s\",\n  \"threads\": %d,\n  \"totalMs\": %.3f,\n  \"calls\": [",
+            options.fast ? "fast" : "original", GetWorkerCount() + 1, total * 1e-6);
+    for (size_t i = 0; i < calls.size(); ++i)
+    {
+        const CaptureRecord& record = calls[i].record;
+        fprintf(out, "%s\n    { \"call\": \"%s\", \"count\": %d, \"quality\": %d, \"startMs\": %.3f, \"capturedMs\": %.3f, \"replayedMs\": %.3f }",
+                i == 0 ? "" : ",", RecordTypeName(record.type), record.count, record.quality, record.startTime * 1e-6,
+                record.duration * 1e-6, calls[i].duration * 1e-6);
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
+
+int main(int argc, char** argv)
+{
+    ReplayOptions options;
+    if (!ParseOptions(argc, argv, options))
+    {
+        fprintf(stderr, "usage: scene_replay [--fast] [--threads N] [--quality Q] [--output file] capture.bin\n");
+        return 2;
+    }
+
+    FILE* file = fopen(options.capture, "rb");
+    if (file == nullptr)
+    {
+        fprintf(stderr, "scene_replay: can't open %s\n", options.capture);
+        return 1;
+    }
+    if (!ReadHeader(file, options.capture))
+    {
+        fclose(file);
+        return 1;
+    }
+
+    if (options.threads >= 0)
+        SetWorkerCount(options.threads);
+
+    std::map<int64_t, ReplayedObject> bvhs;
+    std::map<int64_t, ReplayedObject> batches;
+    std::map<int64_t, ReplayedObject> tlases;
+    std::vector<ReplayedCall> calls;
+    auto replayStart = std::chrono::steady_clock::now();
+    CaptureRecord record;
+    while (fread(&record, sizeof(record), 1, file) == 1)
+    {
+        RecordArrays arrays;
+        if (!ReadArrays(file, record, arrays))
+        {
+            // The capture ended during a write, e.g. because the process was killed.
+            fprintf(stderr, "scene_replay: %s ends in an incomplete record, stopping there\n", options.capture);
+            break;
+        }
+
+        if (!options.fast)
+            std::this_thread::sleep_until(replayStart + std::chrono::nanoseconds(record.startTime));
+
+        if (options.quality >= 0 && IsBLASBuild(record.type))
+            record.quality = options.quality;
+
+        tinybvh::bvhvec4* vertices = Array<tinybvh::bvhvec4>(arrays, 0);
+        int vertexCount = ArrayCount(arrays, 0, sizeof(tinybvh::bvhvec4));
+        tinybvh::BLASInstance* instances = Array<tinybvh::BLASInstance>(arrays, 0);
+        ReplayedObject object;
+        ReplayedObject* existing = nullptr;
+        std::map<int64_t, ReplayedObject>* created = nullptr;
+        auto start = std::chrono::steady_clock::now();
+        switch (record.type)
+        {
+        case CAPTURE_BUILD_BVH:
+            object.handle = BuildBVH(vertices, record.count, record.quality);
+            created = &bvhs;
+            break;
+        case CAPTURE_BUILD_BVH_INDEXED:
+            object.handle = BuildBVHIndexed(vertices, vertexCount, Array<uint32_t>(arrays, 1), record.count, record.quality);
+            created = &bvhs;
+            break;
+        case CAPTURE_BUILD_BVH_ASYNC:
+            object.handle = BuildBVHAsync(vertices, record.count, record.quality);
+            created = &bvhs;
+            break;
+        case CAPTURE_BUILD_BVH_DEFERRED:
+            object.handle = BuildBVHDeferred(vertices, record.count, record.quality);
+            created = &bvhs;
+            break;
+        case CAPTURE_BUILD_BVH_INDEXED_DEFERRED:
+            object.handle = BuildBVHIndexedDeferred(vertices, vertexCount, Array<uint32_t>(arrays, 1), record.count, record.quality);
+            created = &bvhs;
+            break;
+        case CAPTURE_REFIT_BVH:
+            existing = FindObject(bvhs, record.handle);
+            if (existing != nullptr)
+                RefitBVH(existing->handle, vertices);
+            break;
+        case CAPTURE_BUILD_BVH_BATCH:
+        case CAPTURE_BUILD_BVH_BATCH_DEFERRED:
+        {
+            int* qualities = BatchQualities(arrays, 3, record.count, options.quality);
+            if (record.type == CAPTURE_BUILD_BVH_BATCH)
+                object.handle = BuildBVHBatch(vertices, Array<int>(arrays, 1), Array<int>(arrays, 2), qualities, record.count);
+            else
+                object.handle = BuildBVHBatchDeferred(vertices, Array<int>(arrays, 1), Array<int>(arrays, 2), qualities, record.count);
+            created = &batches;
+            break;
+        }
+        case CAPTURE_BUILD_BVH_BATCH_INDEXED_DEFERRED:
+        {
+            int* qualities = BatchQualities(arrays, 6, record.count, options.quality);
+            object.handle = BuildBVHBatchIndexedDeferred(vertices, Array<int>(arrays, 1), Array<int>(arrays, 2), Array<uint32_t>(arrays, 3),
+                                                         Array<int>(arrays, 4), Array<int>(arrays, 5), qualities, record.count);
+            created = &batches;
+            break;
+        }
+        case CAPTURE_BUILD_TLAS:
+            object.handle = BuildTLAS(instances, record.count);
+            created = &tlases;
+            break;
+        case CAPTURE_REBUILD_TLAS:
+        case CAPTURE_REFIT_TLAS:
+            existing = FindObject(tlases, record.handle);
+            if (existing != nullptr && record.type == CAPTURE_REBUILD_TLAS)
+                RebuildTLAS(existing->handle, instances, record.count);
+            else if (existing != nullptr)
+                RefitTLAS(existing->handle, instances, record.count);
+            break;
+        case CAPTURE_DESTROY_BVH:
+            existing = FindObject(bvhs, record.handle);
+            if (existing != nullptr)
+            {
+                DestroyBVH(existing->handle);
+                bvhs.erase(record.handle);
+            }
+            break;
+        case CAPTURE_DESTROY_BVH_BATCH:
+            existing = FindObject(batches, record.handle);
+            if (existing != nullptr)
+            {
+                DestroyBVHBatch(existing->handle);
+                batches.erase(record.handle);
+            }
+            break;
+        case CAPTURE_DESTROY_TLAS:
+            existing = FindObject(tlases, record.handle);
+            if (existing != nullptr)
+            {
+                DestroyTLAS(existing->handle);
+                tlases.erase(record.handle);
+            }
+            break;
+        default:
+            // Written by a newer plugin, skipped.
+            continue;
+        }
+        int64_t duration = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        calls.push_back({ record, duration });
+
+        if (created != nullptr)
+        {
+            object.arrays.push_back(std::move(arrays));
+            (*created)[record.handle] = std::move(object);
+        }
+        // A refit BVH reads the new vertices from then on, TLASes only read their instances
+        // during the call.
+        else if (existing != nullptr && record.type == CAPTURE_REFIT_BVH)
+            existing->arrays.push_back(std::move(arrays));
+    }
+    fclose(file);
+
+    // Destroying waits for the builds still running in the background.
+    for (auto& tlas : tlases)
+        DestroyTLAS(tlas.second.handle);
+    for (auto& batch : batches)
+        DestroyBVHBatch(batch.second.handle);
+    for (auto& bvh : bvhs)
+        DestroyBVH(bvh.second.handle);
+    int64_t total = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - replayStart).count();
+
+    FILE* out = options.output != nullptr ? fopen(options.output, "w") : stdout;
+    if (out == nullptr)
+    {
+        fprintf(stderr, "scene_replay: can't write %s\n", options.output);
+        return 1;
+    }
+    WriteJson(out, options, calls, total);
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}